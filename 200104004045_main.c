@@ -1,27 +1,220 @@
-#define _GNU_SOURCE // For getline
+#define _GNU_SOURCE // For getline and getopt_long
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <pthread.h>
 #include <signal.h>
 #include <unistd.h> // For write in signal handler
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <glob.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "buffer.h"
+#include "search.h"
+#include "aho_corasick.h"
+#include "steal_pool.h"
+#include "stats.h"
+#include "field_filter.h"
+#include "group_table.h"
+#include "decompress.h"
+#include "ordered_output.h"
+#include "affinity.h"
+#include "regex_dfa.h"
+#include "line_index.h"
+#include "time_range.h"
+#include "async_read.h"
+#include "line_split.h"
+#include "distributed.h"
+
+#define USAGE "Usage: ./LogAnalyzer [--mmap] [--batch N] [--lockfree] [--rate-limit LINES_PER_SEC] [--patterns-file FILE] [--split] [--steal] [--stats]" \
+              " [--file PATH]... [--adaptive] [--max-count N] [--exists] [--index] [--since TIME] [--until TIME] [--aio] [--direct] [--readers N] [--auto-size MIN:MAX] [--memory-budget MB] [--coordinate HOST:PORT,... [--shards N] [--shard-timeout SECONDS]] [-i] [--regex] [--print] [--pin] [--follow] [--interval SECONDS] [--where FIELD=VALUE|FIELD~VALUE]... [--group-by FIELD] [--top K] <buffer_size> <num_workers> <log_file|dir|glob|-> [search_term...]\n" \
+              "       ./LogAnalyzer --serve PORT [--bind ADDRESS] [--serve-root DIR]\n"
+
+// Target size of one slice handed to a worker in --mmap mode. The actual slice is
+// extended to the next newline so that no line is ever split between two workers.
+#define MMAP_CHUNK_SIZE (64 * 1024)
+
+// Size of each pread issued by a worker scanning its own byte range in --split mode
+#define SPLIT_BLOCK_SIZE (1024 * 1024)
+
+// Least room offered to each read() when streaming a file, stdin or --follow. Reads land
+// directly in the line arena, so a 1 MiB chunk takes a few reads before it is retired.
+#define STREAM_READ_SIZE (256 * 1024)
+
+// Newline offsets the line splitter finds per call; a block with more lines takes several calls
+#define LINE_SPLIT_MAX_LINES 4096
+
+// Multi-file input splits plain files into work items of at most this many bytes, so one big
+// file among many small ones is still scanned by several workers
+#define FILE_WORK_RANGE_SIZE (32 * 1024 * 1024)
+
+// How often --follow re-checks the path for rotation when no inotify event arrives
+#define FOLLOW_RECHECK_MS 500
+
+// --memory-budget default with --auto-size, so a ring grown for short lines cannot fill up with huge ones
+#define AUTO_SIZE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// --interval default for --follow, which otherwise would report nothing until SIGINT
+#define FOLLOW_DEFAULT_INTERVAL 5.0
+
+// Cache line size assumed for padding per-worker data, as in buffer_mpmc.c
+#define CACHE_LINE_SIZE 64
+
+// Running counters of one worker, on a cache line of its own so that workers updating their
+// counters never invalidate each other's lines. Only the owning worker writes them, with
+// relaxed atomic stores, so any thread may read them at runtime without locks (e.g. --interval).
+typedef struct {
+    int matches;                // Lines matching (any) search term
+    unsigned long lines;        // Lines scanned; only counted with --stats or LOG_INSTRUMENT, as it costs a pass
+    unsigned long long bytes;   // Bytes scanned
+    unsigned long long wait_ns; // Time spent waiting on the queue for work; only with --stats or LOG_INSTRUMENT
+    unsigned long long busy_ns; // Time spent scanning popped batches; only with --adaptive
+} __attribute__((aligned(CACHE_LINE_SIZE))) worker_counters_t;
 
 // Global variables
 Buffer shared_buffer;
-pthread_barrier_t barrier;
+Buffer *g_node_buffers; // --pin on a multi-node host: queues of shards 1..g_num_shards-1 (shard 0 uses shared_buffer)
+int g_num_shards = 1; // Queues the manager deals batches out to; workers pop from their own shard's (see affinity.h)
+StealPool g_steal_pool; // Per-worker queues used instead of shared_buffer with --steal
 char *g_search_term;
+char **g_patterns; // All search terms (g_search_term is the first); more than one enables multi-pattern mode
+int g_num_patterns = 0;
+AcAutomaton *g_automaton; // Shared read-only by all workers when g_num_patterns > 1
+RegexDfa *g_regex; // --regex: the compiled search term, shared read-only by all workers
+bool g_nocase = false; // -i: match the search term(s) ignoring ASCII case
 int g_num_workers;
-int *worker_match_counts; // Array to store matches per worker, indexed by worker_id
-int g_total_matches_summary = 0; // For final summary report
+worker_counters_t *worker_counters; // Running per-worker counters, indexed by worker_id
+int *g_pattern_totals; // Matches per pattern, folded in by each worker as it finishes (atomic)
+int g_total_matches_summary = 0; // For final summary report; folded in by each worker as it finishes (atomic)
+bool g_use_mmap = false; // --mmap: map the log file and hand out zero-copy slices instead of getline copies
+bool g_use_lockfree = false; // --lockfree: use the lock-free MPMC ring backend for shared_buffer
+int g_batch_size = 16; // --batch: slices moved per buffer lock acquisition by the manager and each worker
+bool g_use_split = false; // --split: each worker preads and scans its own byte range; shared_buffer is unused
+int g_split_fd = -1; // Log file opened for --split, shared by all workers through pread
+size_t g_split_file_size = 0;
+bool g_use_steal = false; // --steal: per-worker queues filled round-robin, idle workers steal from peers
+bool g_report_stats = false; // --stats: print a machine-readable throughput/latency summary at the end
+double g_rate_limit = 0.0; // --rate-limit: lines per second the manager may feed; 0 means full speed
+// One input file of a multi-file run (several paths, a directory or a glob)
+typedef struct {
+    char *path;
+    size_t size;
+    bool compressed;  // Scanned whole through an InputStream instead of in byte ranges
+    int matches;      // Matching lines; ranges of one file may go to several workers (atomic)
+    bool failed;      // Some part could not be read
+    off_t range_start; // Bytes [range_start, range_end) are scanned: all of it, or its --since/--until range
+    off_t range_end;
+} input_file_t;
+
+// A unit of the file-level work queue: bytes [start, end) of a file, moved to line starts
+// by the worker that claims it. A compressed file is always a single item.
+typedef struct {
+    int file;         // Index into g_files
+    off_t start;
+    off_t end;
+    bool at_line_starts; // start and end came from an index and need no resynchronization
+} file_work_t;
+
+bool g_multi_file = false; // Several input files: workers claim files (or ranges) from a queue; shared_buffer is unused
+input_file_t *g_files;
+int g_num_files = 0;
+file_work_t *g_file_work; // Largest first, so the tail ends with small items
+int g_num_file_work = 0;
+int g_next_file_work = 0; // Next unclaimed item (atomic)
+long g_max_count = 0; // --max-count (--exists is 1): stop once this many matching lines were found; 0 means no limit
+long g_limit_matches = 0; // Matches counted towards g_max_count so far (atomic)
+bool g_exists_mode = false; // --exists: report only whether there is a match, through the exit status too
+bool g_use_index = false; // --index: workers scan only the blocks the sidecar index cannot rule out (see line_index.h)
+bool g_time_range = false; // --since/--until: only the lines timed within [g_since, g_until] are scanned (see time_range.h)
+int64_t g_since = INT64_MIN;
+int64_t g_until = INT64_MAX;
+bool g_byte_range = false; // The manager (or --split workers) read only bytes [g_range_start, g_range_end) of one file
+off_t g_range_start = 0; // Set by single-file --since/--until, then narrowed by --shard
+off_t g_range_end = 0;
+bool g_pin = false; // --pin: pin the manager and workers to CPUs, with one queue and line arena per NUMA node
+bool g_use_regex = false; // --regex: the search term is a regular expression (see regex_dfa.h)
+bool g_print = false; // --print: write the matching lines themselves, in input order
+bool g_use_aio = false; // --aio: the manager keeps several block reads in flight (see async_read.h)
+bool g_aio_direct = false; // --direct: --aio reads bypass the page cache with O_DIRECT
+int g_num_readers = 0; // --readers: threads reading byte ranges of the file into shared_buffer instead of the manager
+bool g_auto_size = false; // --auto-size: shared_buffer's capacity follows the wait times, within the bounds below
+int g_auto_size_min = 0;
+int g_auto_size_max = 0;
+size_t g_byte_budget = 0; // --memory-budget: bytes of queued lines the buffer may hold (0: slots are the only limit)
+const char *g_coordinate_hosts = NULL; // --coordinate: HOST:PORT list the shards of this run are sent to (see distributed.h)
+int g_num_dist_shards = 0; // --shards: shards of a --coordinate run
+int g_shard_timeout_s = 0; // --shard-timeout: seconds a --coordinate run waits for one shard's result
+int g_shard_index = 0; // --shard I/N: this run scans only the I-th of N byte ranges and sends its counts to stdout
+int g_shard_count = 0;
+OrderedOutput *g_output; // --print: reorder stage and writer thread for the matching lines, else NULL
+uint64_t g_next_seq = 0; // --print: sequence number of the next slice the manager pushes
+FILE *g_report_out; // Worker and summary report: stdout, or stderr with --print so stdout carries only the lines
+bool g_follow = false; // --follow: keep reading the log file as it grows, reopening it after rotation
+double g_interval_seconds = 0.0; // --interval: seconds between running match reports; 0 means final total only
+FieldFilter g_filter; // --where predicates (ANDed); a line must satisfy them as well as contain a search term
+int g_group_field = -1; // --group-by: ClfField that matching lines are counted by, or -1
+int g_group_top = 10; // --top: number of groups printed with --group-by
+GroupTable **g_group_tables; // --group-by: one table per worker, indexed by worker_id; merged after the join
 
 volatile sig_atomic_t sigint_received_flag = 0;
 
+// Per-worker latency histogram for --stats, indexed by worker_id; merged by main after the join
+typedef struct {
+    LatencyHistogram latency;   // Per slice: time from the manager's push until its scan finished
+} worker_stats_t;
+
+worker_stats_t *g_worker_stats; // NULL unless --stats
+
 typedef struct {
     int id; // Worker ID
 } worker_args_t;
 
+bool g_adaptive = false; // --adaptive: <num_workers> is a maximum; the pool grows and shrinks with queue pressure
+pthread_t *g_worker_threads; // g_num_workers entries, of which the first g_num_started are running
+worker_args_t *g_worker_args;
+int g_num_started = 0; // Workers started so far, by main or the --adaptive controller; main joins them (atomic)
+// Workers started and not yet folded into the totals, plus one held by the manager until no more
+// can start. Whoever brings it to 0 prints the summary (see reduce_release).
+static int s_reduce_pending = 1;
+static int s_workers_finished = 0; // Workers that folded in their counts, for --interval (atomic)
+
+// Queue of a shard: shared_buffer for the first (and, without NUMA sharding, only) one
+static Buffer *shard_buffer(int shard) {
+    return shard == 0 ? &shared_buffer : &g_node_buffers[shard - 1];
+}
+
+static void adaptive_close(void);
+
+// Puts whichever queueing structure this run uses into shutdown mode, waking all waiters
+static void signal_shutdown(void) {
+    for (int i = 0; i < g_num_shards; i++) {
+        buffer_signal_shutdown(shard_buffer(i));
+    }
+    if (g_use_steal) {
+        pool_signal_shutdown(&g_steal_pool);
+    }
+    if (g_output) {
+        ordered_output_stop(g_output); // Results of dropped slices never arrive
+    }
+    if (g_adaptive) {
+        adaptive_close(); // Parked workers resume and drain
+    }
+}
+
+// Stops the whole run the way SIGINT does; called by the --print writer at --max-count or on a write error
+static void stop_run(void) {
+    sigint_received_flag = 1;
+    signal_shutdown();
+}
+
 // Signal handler for SIGINT (Ctrl+C)
 void sigint_handler(int signum) {
     (void)signum; // Unused parameter
@@ -34,49 +227,612 @@ void sigint_handler(int signum) {
     // This is safer than calling non-async-signal-safe functions from handler.
 }
 
-void* worker_function(void* arg) {
-    worker_args_t* args = (worker_args_t*)arg;
-    int worker_id = args->id;
-    int local_matches = 0;
-    char* line_from_buffer;
+// Per-worker scanning state, private to its worker until it exits
+typedef struct {
+    int matches;          // Lines matching (any) search term
+    int *pattern_counts;  // Per-pattern line counts, g_num_patterns entries
+    AcScratch *ac_scratch; // Aho-Corasick scratch, multi-pattern mode only
+    worker_stats_t *stats; // This worker's entry in g_worker_stats, or NULL without --stats
+    worker_counters_t *counters; // This worker's published counters
+    GroupTable *groups;   // This worker's --group-by table, or NULL
+    char *print_buf;      // --print: matching lines of the current slice, each ended by '\n'
+    size_t print_len;
+    size_t print_cap;
+    int print_lines;
+} worker_state_t;
+
+// --print: appends a matching line to the worker's output for the current slice. On allocation
+// failure the run is stopped, like any other worker allocation failure.
+static void print_append(worker_state_t *state, const char *line, size_t line_len) {
+    if (state->print_len + line_len + 1 > state->print_cap) {
+        size_t capacity = state->print_cap ? state->print_cap : 4096;
+        while (capacity < state->print_len + line_len + 1) {
+            capacity *= 2;
+        }
+        char *grown = realloc(state->print_buf, capacity);
+        if (!grown) {
+            perror("realloc for printed lines failed");
+            stop_run();
+            return;
+        }
+        state->print_buf = grown;
+        state->print_cap = capacity;
+    }
+    memcpy(state->print_buf + state->print_len, line, line_len);
+    state->print_len += line_len;
+    state->print_buf[state->print_len++] = '\n';
+    state->print_lines++;
+}
+
+// --print with a single search term and no --where/--group-by: lets search_find skip over the
+// non-matching stretches of the slice, and only then finds the bounds of the line it hit.
+// Returns the number of matching lines.
+static int collect_matching_lines(worker_state_t *state, const char *data, size_t length) {
+    if (length == 0) {
+        if (search_find(data, 0)) { // A single empty line, matched only by the empty term
+            print_append(state, data, 0);
+            return 1;
+        }
+        return 0;
+    }
+    int matches = 0;
+    const char *end = data + length;
+    const char *line = data; // Always the start of a line
+    while (line < end) {
+        const char *hit = search_find(line, (size_t)(end - line));
+        if (!hit) {
+            break;
+        }
+        const char *line_start = hit;
+        while (line_start > line && line_start[-1] != '\n') {
+            line_start--;
+        }
+        const char *newline = memchr(hit, '\n', (size_t)(end - hit));
+        const char *line_end = newline ? newline : end;
+        print_append(state, line_start, (size_t)(line_end - line_start));
+        matches++;
+        line = newline ? newline + 1 : end;
+    }
+    return matches;
+}
+
+// Line-at-a-time path for --where and --group-by: checks the field filter, then the search
+// term(s) on the lines that pass, and counts each matching line under its group.
+// Returns the number of matching lines.
+static int scan_lines_individually(worker_state_t *state, const char *data, size_t length) {
+    int matches = 0;
+    const char *end = data + length;
+    const char *line = data;
+    do {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        size_t line_len = (size_t)((newline ? newline : end) - line);
+        bool matched = false;
+        if (filter_match_line(&g_filter, line, line_len)) {
+            if (g_num_patterns == 0) {
+                matched = true; // Filter or group-by only
+            } else if (g_regex) {
+                matched = regex_match_line(g_regex, line, line_len);
+            } else if (g_automaton) {
+                matched = ac_count_matching_lines(g_automaton, line, line_len, state->pattern_counts, state->ac_scratch) > 0;
+            } else {
+                matched = search_find(line, line_len) != NULL;
+            }
+        }
+        if (matched) {
+            matches++;
+            if (g_output) {
+                print_append(state, line, line_len);
+            }
+            const char *key;
+            size_t key_len;
+            if (state->groups && clf_get_field(line, line_len, (ClfField)g_group_field, &key, &key_len)) {
+                group_table_add(state->groups, key, key_len, 1); // Lines without the field only count in the total
+            }
+        }
+        line = newline ? newline + 1 : end;
+    } while (line < end); // A trailing '\n' does not start another line
+    return matches;
+}
+
+// Merges the per-worker --group-by tables into the first one and prints its top g_group_top groups
+static void print_top_groups(void) {
+    GroupTable *merged = g_group_tables[0];
+    for (int i = 1; i < g_num_workers; i++) {
+        group_table_merge(merged, g_group_tables[i]);
+    }
+    GroupEntry *top = malloc(sizeof(GroupEntry) * g_group_top);
+    if (!top) {
+        perror("malloc for top groups failed");
+        return;
+    }
+    int n = group_table_top(merged, top, g_group_top);
+    fprintf(g_report_out, "Top %d by %s (%zu distinct):\n", n, clf_field_name((ClfField)g_group_field), group_table_size(merged));
+    for (int i = 0; i < n; i++) {
+        fprintf(g_report_out, "  %.*s: %llu\n", (int)top[i].key_len, top[i].key, (unsigned long long)top[i].count);
+    }
+    free(top);
+}
+
+// --max-count/--exists: adds a slice's matches to the run-wide count, and once the limit is
+// reached stops the run through the same path as SIGINT: the manager stops reading and the
+// queues shut down, so the remaining slices are dropped instead of scanned.
+static void count_towards_limit(int new_matches) {
+    if (new_matches == 0) {
+        return;
+    }
+    long total = __atomic_add_fetch(&g_limit_matches, new_matches, __ATOMIC_RELAXED);
+    if (total >= g_max_count && total - new_matches < g_max_count) { // Only the worker crossing the limit
+        sigint_received_flag = 1;
+        signal_shutdown();
+    }
+}
+
+// Searches for the keyword(s) in the line(s) of a slice and accumulates the results
+static void scan_slice(worker_state_t *state, const char *data, size_t length) {
+    int matches_before = state->matches;
+    if (g_filter.count > 0 || state->groups || (g_output && (g_automaton || g_regex))) {
+        state->matches += scan_lines_individually(state, data, length);
+    } else if (g_output) {
+        state->matches += collect_matching_lines(state, data, length);
+    } else if (g_regex) {
+        state->matches += regex_count_matching_lines(g_regex, data, length);
+    } else if (g_automaton) {
+        state->matches += ac_count_matching_lines(g_automaton, data, length, state->pattern_counts, state->ac_scratch);
+    } else {
+        state->matches += search_count_matching_lines(data, length);
+    }
+    if (g_max_count > 0 && !g_output) { // With --print the writer stops the run, so the lines printed are the first ones
+        count_towards_limit(state->matches - matches_before);
+    }
+    worker_counters_t *counters = state->counters;
+    __atomic_store_n(&counters->matches, state->matches, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters->bytes, counters->bytes + length, __ATOMIC_RELAXED); // Single writer: no RMW needed
+    if (state->stats || INSTRUMENT_ENABLED) {
+        __atomic_store_n(&counters->lines, counters->lines + search_count_lines(data, length), __ATOMIC_RELAXED);
+    }
+}
+
+// Scans a slice that came through a queue, recording its queueing + scan latency with --stats
+static void scan_queued_slice(worker_state_t *state, LineSlice slice) {
+    if (sigint_received_flag) {
+        if (g_output) {
+            ordered_output_stop(g_output); // SIGINT only sets the flag; this slice's result will be missing
+        }
+        return; // Stopping (SIGINT, an error or --max-count): drain without scanning
+    }
+    scan_slice(state, slice.data, slice.length);
+    if (g_output) {
+        // Hand a copy to the writer, keeping the buffer for the next slice
+        char *lines = NULL;
+        if (state->print_len > 0 && !(lines = malloc(state->print_len))) {
+            perror("malloc for printed lines failed");
+            stop_run();
+            return;
+        }
+        if (lines) {
+            memcpy(lines, state->print_buf, state->print_len);
+        }
+        ordered_output_submit(g_output, slice.seq, lines, state->print_len, (uint64_t)state->print_lines);
+        state->print_len = 0;
+        state->print_lines = 0;
+    }
+    if (state->stats && slice.enqueued_ns != 0) {
+        latency_record(&state->stats->latency, stats_now_ns() - slice.enqueued_ns);
+    }
+}
+
+// Returns the start of a wait for work, to pass to wait_end; 0 (no clock read) without --stats
+// or instrumentation
+static uint64_t wait_begin(const worker_state_t *state) {
+    return state->stats || INSTRUMENT_ENABLED ? stats_now_ns() : 0;
+}
+
+static void wait_end(worker_state_t *state, uint64_t start_ns) {
+    if (state->stats || INSTRUMENT_ENABLED) {
+        worker_counters_t *counters = state->counters;
+        __atomic_store_n(&counters->wait_ns, counters->wait_ns + (stats_now_ns() - start_ns), __ATOMIC_RELAXED);
+    }
+}
+
+// --adaptive pool: the manager starts workers, and asks running ones to park or parked ones to
+// resume (see adaptive_controller). Workers park themselves between batches, so a parked worker
+// holds no slices and the others keep the queue drained.
+static pthread_mutex_t s_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_pool_cond = PTHREAD_COND_INITIALIZER;
+static int s_pool_park_requests = 0; // Workers asked to park that have not yet (read unlocked as a hint)
+static int s_pool_wakeups = 0;       // Parked workers asked to resume that have not yet
+static int s_pool_parked = 0;
+static bool s_pool_closing = false;  // Input done or shutting down: nobody parks any more
+
+// Parks the calling worker if the manager asked for one to park, until it is asked to resume
+// or the pool closes
+static void adaptive_maybe_park(void) {
+    if (__atomic_load_n(&s_pool_park_requests, __ATOMIC_RELAXED) == 0) {
+        return; // The common case: no lock taken
+    }
+    pthread_mutex_lock(&s_pool_mutex);
+    if (s_pool_park_requests > 0 && !s_pool_closing) {
+        __atomic_store_n(&s_pool_park_requests, s_pool_park_requests - 1, __ATOMIC_RELAXED);
+        s_pool_parked++;
+        while (s_pool_wakeups == 0 && !s_pool_closing) {
+            pthread_cond_wait(&s_pool_cond, &s_pool_mutex);
+        }
+        if (s_pool_wakeups > 0) {
+            s_pool_wakeups--;
+        }
+        s_pool_parked--;
+    }
+    pthread_mutex_unlock(&s_pool_mutex);
+}
+
+// Resumes every parked worker for good: at the end of the input, so that each pops its EOF
+// marker, or when the run stops
+static void adaptive_close(void) {
+    pthread_mutex_lock(&s_pool_mutex);
+    s_pool_closing = true;
+    __atomic_store_n(&s_pool_park_requests, 0, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&s_pool_cond);
+    pthread_mutex_unlock(&s_pool_mutex);
+}
+
+// Worker loop for the default mode: consume slices pushed by the manager until an EOF marker
+static void consume_buffer(worker_state_t *state, Buffer *buffer) {
+    LineSlice *batch = malloc(sizeof(LineSlice) * g_batch_size);
+    if (!batch) {
+        perror("malloc for worker batch failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+
+    bool done = false;
+    while (!done) {
+        if (g_adaptive) {
+            adaptive_maybe_park();
+        }
+        uint64_t wait_start = wait_begin(state);
+        int popped = buffer_pop_batch(buffer, batch, g_batch_size);
+        wait_end(state, wait_start);
+        uint64_t busy_start = g_adaptive ? stats_now_ns() : 0;
 
-    printf("Worker %d started.\n", worker_id);
+        for (int i = 0; i < popped; i++) {
+            LineSlice slice_from_buffer = batch[i];
+            if (slice_from_buffer.data == NULL) {
+                // EOF marker from manager; pop_batch always returns it on its own
+                done = true;
+                break;
+            }
 
-    while (1) {
-        line_from_buffer = buffer_pop(&shared_buffer);
+            scan_queued_slice(state, slice_from_buffer);
+            line_slice_release(slice_from_buffer); // Drop this line's reference on its arena chunk
+        }
 
-        if (line_from_buffer == NULL) {
-            // This means either EOF marker from manager OR buffer is shutting down
+        if (g_adaptive) {
+            worker_counters_t *counters = state->counters;
+            __atomic_store_n(&counters->busy_ns, counters->busy_ns + (stats_now_ns() - busy_start), __ATOMIC_RELAXED);
+        }
+        if (popped == 0) {
+            // Buffer is shutting down and empty
             // printf("Worker %d received NULL, exiting.\n", worker_id); // Debug
+            done = true;
+        }
+    }
+    free(batch);
+}
+
+// Returns the offset just past the first '\n' at or after offset from, or file_size if there is
+// none. A range boundary n is resynchronized to line_start_after(n - 1), so the two ranges
+// meeting there always agree on where one stops and the next begins.
+static off_t line_start_after(int fd, size_t file_size, off_t from, char *scratch, size_t scratch_size) {
+    while (from < (off_t)file_size) {
+        ssize_t n = pread(fd, scratch, scratch_size, from);
+        if (n <= 0) {
             break;
         }
+        char *newline = memchr(scratch, '\n', (size_t)n);
+        if (newline) {
+            return from + (newline - scratch) + 1;
+        }
+        from += n;
+    }
+    return (off_t)file_size;
+}
+
+// Worker loop for --steal: drain this worker's queue, stealing from peers when it runs dry
+static void consume_pool(worker_state_t *state, int worker_id) {
+    LineSlice *batch = malloc(sizeof(LineSlice) * g_batch_size);
+    if (!batch) {
+        perror("malloc for worker batch failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
 
-        // Search for the keyword in the line
-        if (strstr(line_from_buffer, g_search_term) != NULL) {
-            local_matches++;
+    for (;;) {
+        uint64_t wait_start = wait_begin(state);
+        int popped = pool_pop_batch(&g_steal_pool, worker_id, batch, g_batch_size);
+        wait_end(state, wait_start);
+        if (popped == 0) {
+            break; // Pool closed and drained, or shutting down
+        }
+        for (int i = 0; i < popped; i++) {
+            scan_queued_slice(state, batch[i]);
+            line_slice_release(batch[i]);
         }
-        free(line_from_buffer); // Line was allocated by getline in manager, worker frees it
     }
+    free(batch);
+}
 
-    worker_match_counts[worker_id] = local_matches;
-    printf("Worker %d found %d matches.\n", worker_id, local_matches);
+// A worker's reusable read buffer for scanning files itself (--split and multi-file input)
+typedef struct {
+    char *data;
+    size_t capacity;
+} scan_block_t;
 
-    // Synchronize with other workers before printing summary
-    int barrier_rc = pthread_barrier_wait(&barrier);
-    if (barrier_rc == PTHREAD_BARRIER_SERIAL_THREAD) {
-        // This thread is the designated one to calculate and print the summary
-        for (int i = 0; i < g_num_workers; i++) {
-            g_total_matches_summary += worker_match_counts[i];
+// Makes room for at least one more byte after filled bytes, doubling the block when a single
+// line fills it. Returns false on allocation failure.
+static bool scan_block_reserve(scan_block_t *block, size_t filled) {
+    if (block->data && filled < block->capacity) {
+        return true;
+    }
+    size_t capacity = block->data ? block->capacity * 2 : SPLIT_BLOCK_SIZE;
+    char *grown = realloc(block->data, capacity);
+    if (!grown) {
+        perror("realloc for scan block failed");
+        return false;
+    }
+    block->data = grown;
+    block->capacity = capacity;
+    return true;
+}
+
+// Scans the complete lines at the front of the block and moves the partial rest to the front.
+// Returns the number of bytes consumed.
+static size_t scan_block_lines(worker_state_t *state, scan_block_t *block, size_t filled) {
+    char *last_newline = memrchr(block->data, '\n', filled);
+    if (!last_newline) {
+        return 0;
+    }
+    size_t complete = (size_t)(last_newline - block->data) + 1;
+    scan_slice(state, block->data, complete);
+    memmove(block->data, block->data + complete, filled - complete);
+    return complete;
+}
+
+// Reads and scans bytes [start, end) of fd with pread, without going through shared_buffer.
+// start and end must be line starts (or 0 / the file size). Returns false on a read or
+// allocation error; whatever was read before it has been scanned.
+static bool scan_range(worker_state_t *state, int fd, off_t start, off_t end, scan_block_t *block) {
+    off_t pos = start;   // File offset of block->data[0]
+    size_t filled = 0;   // Bytes of block->data holding data
+    bool ok = true;
+    while (pos + (off_t)filled < end && !sigint_received_flag) {
+        if (!scan_block_reserve(block, filled)) {
+            sigint_received_flag = 1;
+            return false;
+        }
+        size_t want = block->capacity - filled;
+        if ((off_t)want > end - pos - (off_t)filled) {
+            want = (size_t)(end - pos - (off_t)filled);
+        }
+        ssize_t n = pread(fd, block->data + filled, want, pos + (off_t)filled);
+        if (n <= 0) {
+            if (n < 0) {
+                perror("pread failed");
+                ok = false;
+            }
+            break; // File shrank or read error: scan whatever is buffered
+        }
+        filled += (size_t)n;
+        if (pos + (off_t)filled >= end) {
+            break; // The whole range is buffered
+        }
+
+        // Scan the complete lines; a trailing partial line waits for the next read
+        size_t consumed = scan_block_lines(state, block, filled);
+        filled -= consumed;
+        pos += (off_t)consumed;
+    }
+    if (filled > 0 && !sigint_received_flag) {
+        scan_slice(state, block->data, filled); // Rest of the range, ending at a line boundary or EOF
+    }
+    return ok;
+}
+
+// Worker loop for --split: scan this worker's own byte range of the file with pread. Ranges
+// are 1/g_num_workers of the file (of its --since/--until range), moved forward to line starts so that every line is
+// scanned by exactly one worker.
+static void scan_own_range(worker_state_t *state, int worker_id, scan_block_t *block) {
+    if (!scan_block_reserve(block, 0)) {
+        sigint_received_flag = 1;
+        return;
+    }
+    off_t first = g_byte_range ? g_range_start : 0;
+    off_t span = (g_byte_range ? g_range_end : (off_t)g_split_file_size) - first;
+    off_t start = first + span * worker_id / g_num_workers;
+    off_t end = first + span * (worker_id + 1) / g_num_workers;
+    if (start > first) {
+        start = line_start_after(g_split_fd, g_split_file_size, start - 1, block->data, block->capacity);
+    }
+    if (end > 0 && worker_id < g_num_workers - 1) {
+        end = line_start_after(g_split_fd, g_split_file_size, end - 1, block->data, block->capacity);
+    }
+    scan_range(state, g_split_fd, start, end, block);
+}
+
+// Scans a whole compressed file through an InputStream. Returns false on an open or read error.
+static bool scan_compressed_file(worker_state_t *state, const char *path, scan_block_t *block) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("open failed");
+        return false;
+    }
+    InputStream *in = input_open_fd(fd);
+    if (!in) {
+        return false;
+    }
+    size_t filled = 0;
+    bool ok = true;
+    while (!sigint_received_flag) {
+        if (!scan_block_reserve(block, filled)) {
+            sigint_received_flag = 1;
+            ok = false;
+            break;
+        }
+        ssize_t n = input_read(in, block->data + filled, block->capacity - filled);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        filled += (size_t)n;
+        filled -= scan_block_lines(state, block, filled);
+    }
+    if (filled > 0 && !sigint_received_flag) {
+        scan_slice(state, block->data, filled); // Last line without a trailing newline
+    }
+    input_close(in);
+    return ok;
+}
+
+// Worker loop for multi-file input: claim work items (a byte range of a plain file, or a whole
+// compressed file) from the shared queue until it is empty, crediting matches to their file.
+static void scan_file_queue(worker_state_t *state, scan_block_t *block) {
+    for (;;) {
+        int next = __atomic_fetch_add(&g_next_file_work, 1, __ATOMIC_RELAXED);
+        if (next >= g_num_file_work || sigint_received_flag) {
+            break;
+        }
+        const file_work_t *work = &g_file_work[next];
+        input_file_t *file = &g_files[work->file];
+        int before = state->matches;
+        bool ok;
+        if (file->compressed) {
+            ok = scan_compressed_file(state, file->path, block);
+        } else {
+            int fd = open(file->path, O_RDONLY);
+            ok = fd != -1 && scan_block_reserve(block, 0);
+            if (fd == -1) {
+                perror("open failed");
+            }
+            if (ok) {
+                off_t start = work->start;
+                off_t end = work->end;
+                if (start > 0 && !work->at_line_starts) {
+                    start = line_start_after(fd, file->size, start - 1, block->data, block->capacity);
+                }
+                if (end < (off_t)file->size && !work->at_line_starts) {
+                    end = line_start_after(fd, file->size, end - 1, block->data, block->capacity);
+                }
+                posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+                ok = scan_range(state, fd, start, end, block);
+            }
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        if (!ok) {
+            __atomic_store_n(&file->failed, true, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(&file->matches, state->matches - before, __ATOMIC_RELAXED);
+    }
+}
+
+static void reduce_release(void);
+
+void* worker_function(void* arg) {
+    worker_args_t* args = (worker_args_t*)arg;
+    int worker_id = args->id;
+    if (g_pin && !affinity_pin_worker(worker_id)) { // Before the worker allocates, so its memory is node-local
+        fprintf(stderr, "Worker %d: could not be pinned to its CPU.\n", worker_id);
+    }
+
+    worker_state_t state = { 0, NULL, NULL, g_worker_stats ? &g_worker_stats[worker_id] : NULL,
+                             &worker_counters[worker_id],
+                             g_group_tables ? g_group_tables[worker_id] : NULL, NULL, 0, 0, 0 };
+    state.pattern_counts = calloc(g_num_patterns, sizeof(int));
+    state.ac_scratch = g_automaton ? ac_scratch_create(g_automaton) : NULL;
+
+    fprintf(g_report_out, "Worker %d started.\n", worker_id);
+
+    if (!state.pattern_counts) {
+        perror("calloc for worker pattern counts failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+    } else if (g_use_split || g_multi_file || g_use_index) {
+        scan_block_t block = { NULL, 0 };
+        if (g_multi_file || g_use_index) {
+            scan_file_queue(&state, &block);
+        } else {
+            scan_own_range(&state, worker_id, &block);
         }
-        printf("Total matches found: %d\n", g_total_matches_summary);
-    } else if (barrier_rc != 0) {
-        fprintf(stderr, "Worker %d: Error waiting on barrier: %d\n", worker_id, barrier_rc);
-        // Potentially exit or handle error
+        free(block.data);
+    } else if (g_use_steal) {
+        consume_pool(&state, worker_id);
+    } else {
+        consume_buffer(&state, shard_buffer(g_num_shards > 1 ? affinity_worker_shard(worker_id) : 0));
+    }
+    ac_scratch_destroy(state.ac_scratch);
+    free(state.print_buf);
+
+    int local_matches = state.matches;
+    int *local_pattern_counts = state.pattern_counts;
+    if (!g_automaton && local_pattern_counts && g_num_patterns > 0) {
+        local_pattern_counts[0] = local_matches; // Single pattern: every match is for g_search_term
+    }
+    for (int p = 0; local_pattern_counts && p < g_num_patterns; p++) {
+        __atomic_fetch_add(&g_pattern_totals[p], local_pattern_counts[p], __ATOMIC_RELAXED);
     }
+    __atomic_fetch_add(&g_total_matches_summary, local_matches, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_workers_finished, 1, __ATOMIC_RELAXED);
+    free(local_pattern_counts);
+    fprintf(g_report_out, "Worker %d found %d matches.\n", worker_id, local_matches);
+
     // printf("Worker %d finished.\n", worker_id); // Debug
+    reduce_release(); // Last, so the summary sees everything this worker found
     return NULL;
 }
 
+// Prints the run's summary from the folded totals. Called once, by reduce_release, after every
+// worker that was started has folded in its counts.
+static void print_summary(void) {
+    for (int p = 0; g_num_patterns > 1 && p < g_num_patterns; p++) {
+        fprintf(g_report_out, "Matches for \"%s\": %d\n", g_patterns[p], g_pattern_totals[p]);
+    }
+    for (int f = 0; g_multi_file && f < g_num_files; f++) {
+        fprintf(g_report_out, "File %s: %d matches%s\n", g_files[f].path, g_files[f].matches,
+               g_files[f].failed ? " (read error)" : "");
+    }
+    if (g_max_count > 0 && g_total_matches_summary >= g_max_count) {
+        // Workers in flight may overshoot; per-file and per-pattern counts above are partial
+        g_total_matches_summary = (int)g_max_count;
+        fprintf(g_report_out, "Stopped after --max-count %ld matches.\n", g_max_count);
+    }
+    if (g_exists_mode) {
+        fprintf(g_report_out, "Match exists: %s\n", g_total_matches_summary > 0 ? "yes" : "no");
+    }
+    fprintf(g_report_out, "Total matches found: %d\n", g_total_matches_summary); // Lines matching any term
+    if (g_group_tables) {
+        print_top_groups();
+    }
+}
+
+// Destroys the queues set up by main: every shard's buffer and the steal pool
+static void destroy_queues(void) {
+    buffer_destroy(&shared_buffer);
+    for (int i = 1; i < g_num_shards; i++) {
+        buffer_destroy(&g_node_buffers[i - 1]);
+    }
+    free(g_node_buffers);
+    g_node_buffers = NULL;
+    g_num_shards = 1;
+    if (g_use_steal) {
+        pool_destroy(&g_steal_pool);
+    }
+}
+
 void cleanup_resources(pthread_t *threads) {
     // Join all worker threads if they were created
     if (threads) {
@@ -93,173 +849,2194 @@ void cleanup_resources(pthread_t *threads) {
         }
     }
 
-    buffer_destroy(&shared_buffer);
-    pthread_barrier_destroy(&barrier);
-    if (worker_match_counts) {
-        free(worker_match_counts);
-        worker_match_counts = NULL;
-    }
+    destroy_queues();
+    free(worker_counters);
+    worker_counters = NULL;
+    free(g_pattern_totals);
+    g_pattern_totals = NULL;
+    ac_destroy(g_automaton);
+    g_automaton = NULL;
 }
 
-
-int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: ./LogAnalyzer <buffer_size> <num_workers> <log_file> <search_term>\n");
-        return EXIT_FAILURE;
+// Starts the next worker. Returns false if the thread could not be created (reported).
+static bool start_worker(void) {
+    int id = g_num_started;
+    g_worker_args[id].id = id;
+    __atomic_add_fetch(&s_reduce_pending, 1, __ATOMIC_RELAXED); // Before it can finish; the manager's hold keeps it above 0
+    if (pthread_create(&g_worker_threads[id], NULL, worker_function, &g_worker_args[id]) != 0) {
+        perror("pthread_create failed");
+        __atomic_sub_fetch(&s_reduce_pending, 1, __ATOMIC_RELAXED);
+        return false;
     }
+    __atomic_store_n(&g_num_started, id + 1, __ATOMIC_RELAXED);
+    return true;
+}
 
-    int buffer_capacity = atoi(argv[1]);
-    g_num_workers = atoi(argv[2]);
-    char *log_file_path = argv[3];
-    g_search_term = argv[4];
+// --adaptive controller thread. Every ADAPTIVE_PERIOD_NS it looks at the average queue
+// occupancy over the period's samples and at the share of the period the running workers
+// spent scanning:
+//   - a queue at least half full while the workers are busy at least half the time means
+//     they fall behind: one more worker runs, a parked one if there is one, else a new one,
+//     up to g_num_workers. A full queue with idle-looking workers means they are starved of
+//     CPU, which more threads would not fix;
+//   - a queue under 1/8 full with workers busy less than half the time, for
+//     ADAPTIVE_QUIET_PERIODS periods in a row, means there are too many: one is parked,
+//     down to ADAPTIVE_MIN_WORKERS.
+#define ADAPTIVE_SAMPLE_NS (5 * 1000000L)
+#define ADAPTIVE_SAMPLES_PER_PERIOD 4
+#define ADAPTIVE_PERIOD_NS (ADAPTIVE_SAMPLE_NS * ADAPTIVE_SAMPLES_PER_PERIOD)
+#define ADAPTIVE_MIN_WORKERS 1
+#define ADAPTIVE_QUIET_PERIODS 3
 
-    if (buffer_capacity <= 0 || g_num_workers <= 0) {
-        fprintf(stderr, "Error: Buffer size and number of workers must be positive integers.\n");
-        fprintf(stderr, "Usage: ./LogAnalyzer <buffer_size> <num_workers> <log_file> <search_term>\n");
-        return EXIT_FAILURE;
-    }
+static pthread_t s_adaptive_thread;
+static bool s_adaptive_started = false;
+static int s_adaptive_capacity; // Capacity of shared_buffer
+static int s_adaptive_peak;     // Most workers running at once
 
-    // Setup SIGINT handler
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = sigint_handler;
-    sigemptyset(&sa.sa_mask); // Do not block other signals during handler execution
-    sa.sa_flags = 0; // No SA_RESTART, so syscalls like getline are interrupted
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
-        perror("sigaction failed");
-        return EXIT_FAILURE;
+// Decides on one period, given the average occupancy and the scan time of all workers.
+// Returns false if the controller should stop.
+static bool adaptive_decide(double occupancy, unsigned long long busy_ns, uint64_t elapsed_ns, int *quiet) {
+    bool start_one = false;
+    pthread_mutex_lock(&s_pool_mutex);
+    if (s_pool_closing) {
+        pthread_mutex_unlock(&s_pool_mutex);
+        return false;
     }
-
-    buffer_init(&shared_buffer, buffer_capacity);
-    if (pthread_barrier_init(&barrier, NULL, g_num_workers) != 0) {
-        perror("pthread_barrier_init failed");
-        buffer_destroy(&shared_buffer);
-        return EXIT_FAILURE;
+    int unparked = g_num_started - s_pool_parked; // Those that scanned during the period, roughly
+    double busy = (double)busy_ns / elapsed_ns / (unparked > 0 ? unparked : 1);
+    int running = g_num_started - s_pool_parked - s_pool_park_requests + s_pool_wakeups;
+    if (occupancy >= 0.5 && busy >= 0.5 && running < g_num_workers) {
+        if (s_pool_park_requests > 0) {
+            __atomic_store_n(&s_pool_park_requests, s_pool_park_requests - 1, __ATOMIC_RELAXED); // Cancel one
+        } else if (s_pool_parked > s_pool_wakeups) {
+            s_pool_wakeups++;
+            pthread_cond_broadcast(&s_pool_cond); // Parked workers share the condition with the closing
+        } else {
+            start_one = true;
+        }
+        running++;
+        *quiet = 0;
+    } else if (occupancy < 0.125 && busy < 0.5 && running > ADAPTIVE_MIN_WORKERS) {
+        if (++*quiet >= ADAPTIVE_QUIET_PERIODS) {
+            if (s_pool_wakeups > 0) {
+                s_pool_wakeups--; // Cancel a pending resume
+            } else {
+                __atomic_store_n(&s_pool_park_requests, s_pool_park_requests + 1, __ATOMIC_RELAXED);
+            }
+            running--;
+            *quiet = 0;
+        }
+    } else {
+        *quiet = 0;
     }
+    pthread_mutex_unlock(&s_pool_mutex);
 
-    worker_match_counts = calloc(g_num_workers, sizeof(int));
-    if (!worker_match_counts) {
-        perror("calloc for worker_match_counts failed");
-        pthread_barrier_destroy(&barrier);
-        buffer_destroy(&shared_buffer);
-        return EXIT_FAILURE;
+    if (start_one && !start_worker()) {
+        running--; // Carry on with the workers there are
     }
-
-    pthread_t *worker_threads = malloc(g_num_workers * sizeof(pthread_t));
-    if (!worker_threads) {
-        perror("malloc for worker_threads failed");
-        free(worker_match_counts);
-        pthread_barrier_destroy(&barrier);
-        buffer_destroy(&shared_buffer);
-        return EXIT_FAILURE;
+    if (running > s_adaptive_peak) {
+        s_adaptive_peak = running;
     }
-    memset(worker_threads, 0, g_num_workers * sizeof(pthread_t)); // Initialize for safer cleanup
+    return true;
+}
 
-    worker_args_t args[g_num_workers];
-    for (int i = 0; i < g_num_workers; i++) {
-        args[i].id = i;
-        if (pthread_create(&worker_threads[i], NULL, worker_function, &args[i]) != 0) {
-            perror("pthread_create failed");
-            sigint_received_flag = 1; // Signal a general shutdown
-            buffer_signal_shutdown(&shared_buffer); // Tell buffer system is shutting down
-            // Join already created threads
-            for (int k = 0; k < i; k++) {
-                pthread_join(worker_threads[k], NULL);
-            }
-            free(worker_threads);
-            cleanup_resources(NULL); // Call with NULL as threads array is locally managed here
-            return EXIT_FAILURE;
+static void *adaptive_controller(void *arg) {
+    (void)arg;
+    uint64_t period_start = stats_now_ns();
+    unsigned long long last_busy_ns = 0;
+    uint64_t occupancy_sum = 0;
+    int samples = 0;
+    int quiet = 0;
+    for (;;) {
+        struct timespec delay = { 0, ADAPTIVE_SAMPLE_NS };
+        nanosleep(&delay, NULL);
+        occupancy_sum += (uint64_t)buffer_count(&shared_buffer);
+        if (++samples < ADAPTIVE_SAMPLES_PER_PERIOD) {
+            continue;
+        }
+        uint64_t now = stats_now_ns();
+        unsigned long long busy_ns = 0;
+        for (int i = 0; i < g_num_started; i++) {
+            busy_ns += __atomic_load_n(&worker_counters[i].busy_ns, __ATOMIC_RELAXED);
         }
+        double occupancy = (double)occupancy_sum / samples / s_adaptive_capacity;
+        if (!adaptive_decide(occupancy, busy_ns - last_busy_ns, now - period_start, &quiet)) {
+            break;
+        }
+        period_start = now;
+        last_busy_ns = busy_ns;
+        occupancy_sum = 0;
+        samples = 0;
     }
+    return NULL;
+}
 
-    // Manager (main thread) logic: read file and push lines to buffer
-    FILE *file = fopen(log_file_path, "r");
-    if (!file) {
-        perror("fopen failed");
-        sigint_received_flag = 1;
-        buffer_signal_shutdown(&shared_buffer);
-        // Fall through to push EOFs and join/cleanup
+// Starts the controller once the first workers run. Without it the pool just keeps its size.
+static void adaptive_start(int capacity) {
+    s_adaptive_capacity = capacity;
+    s_adaptive_peak = g_num_started;
+    s_adaptive_started = pthread_create(&s_adaptive_thread, NULL, adaptive_controller, NULL) == 0;
+    if (!s_adaptive_started) {
+        perror("pthread_create for the adaptive controller failed");
     }
+}
 
-    char *current_line_ptr = NULL; // Buffer for getline
-    size_t line_buffer_size = 0;   // Size of buffer for getline
-    ssize_t read_len;
+// Closes the pool and waits for the controller, after which g_num_started no longer changes
+static void adaptive_stop(void) {
+    adaptive_close();
+    if (s_adaptive_started) {
+        pthread_join(s_adaptive_thread, NULL);
+        s_adaptive_started = false;
+    }
+}
 
-    if (file) { // Proceed only if file was opened successfully
-        while ((read_len = getline(&current_line_ptr, &line_buffer_size, file)) != -1) {
-            if (sigint_received_flag) {
-                // printf("Manager: SIGINT detected, stopping file reading.\n"); // Debug
-                buffer_signal_shutdown(&shared_buffer);
-                break; // Exit file reading loop
-            }
+// --auto-size controller thread. Every AUTO_SIZE_PERIOD_NS it compares how long the producers
+// and the workers blocked on shared_buffer during the period:
+//   - producers blocked on a full buffer for AUTO_SIZE_STALL of the period while the workers,
+//     too, sat on an empty one for AUTO_SIZE_STALL of theirs means the input comes in bursts
+//     the buffer is too small to absorb: the capacity doubles, up to g_auto_size_max. A full
+//     buffer with busy workers means the workers are the bottleneck; more slots would only hold
+//     more lines in memory. Nor does it grow while producers block on the byte budget, which
+//     more slots cannot lift;
+//   - producers not blocking at all while the buffer never got past a quarter full, for
+//     AUTO_SIZE_IDLE_PERIODS periods in a row, means the slots are not needed: the capacity
+//     halves, down to g_auto_size_min, once the queued lines fit.
+// The byte budget is enforced by the buffer itself (buffer_set_byte_budget), whatever the capacity.
+#define AUTO_SIZE_SAMPLE_NS (5 * 1000000L)
+#define AUTO_SIZE_SAMPLES_PER_PERIOD 4
+#define AUTO_SIZE_PERIOD_NS (AUTO_SIZE_SAMPLE_NS * AUTO_SIZE_SAMPLES_PER_PERIOD)
+#define AUTO_SIZE_STALL 0.05
+#define AUTO_SIZE_IDLE_PERIODS 3
 
-            // Remove newline character if present, as strstr might be affected
-            if (read_len > 0 && current_line_ptr[read_len - 1] == '\n') {
-                current_line_ptr[read_len - 1] = '\0';
-            }
-            
-            char *line_to_push = current_line_ptr;
-            current_line_ptr = NULL; // getline will allocate new buffer next time
-            line_buffer_size = 0;    // Reset size too
-
-            if (!buffer_push(&shared_buffer, line_to_push)) {
-                // Push failed, likely because buffer is shutting down
-                // printf("Manager: buffer_push failed (shutting down?), stopping.\n"); // Debug
-                free(line_to_push); // Manager must free this line
-                // buffer_signal_shutdown(&shared_buffer); // Ensure buffer knows (likely already does)
-                break; // Exit file reading loop
-            }
+static pthread_t s_auto_size_thread;
+static bool s_auto_size_started = false;
+static bool s_auto_size_done = false; // Set by auto_size_stop (atomic)
+static int s_auto_size_low;           // Smallest and largest capacity used
+static int s_auto_size_high;
+static int s_auto_size_resizes;
+static BufferPressure s_auto_size_last; // Final snapshot, for the report
 
-            usleep(50000); // Simulate some delay for processing
+// Decides on one period. Returns the new capacity, or the current one to keep it.
+static int auto_size_decide(const BufferPressure *now, const BufferPressure *before, uint64_t elapsed_ns,
+                            int peak, int *idle) {
+    double full = (double)(now->full_wait_ns - before->full_wait_ns) / elapsed_ns;
+    double budget = (double)(now->budget_wait_ns - before->budget_wait_ns) / elapsed_ns;
+    int workers = __atomic_load_n(&g_num_started, __ATOMIC_RELAXED);
+    double empty = (double)(now->empty_wait_ns - before->empty_wait_ns) / elapsed_ns / (workers > 0 ? workers : 1);
+    int capacity = now->capacity;
+    if (full >= AUTO_SIZE_STALL && empty >= AUTO_SIZE_STALL && budget < AUTO_SIZE_STALL) {
+        *idle = 0;
+        return capacity * 2 < g_auto_size_max ? capacity * 2 : g_auto_size_max;
+    }
+    if (full == 0 && budget == 0 && peak < capacity / 4) {
+        if (++*idle >= AUTO_SIZE_IDLE_PERIODS) {
+            *idle = 0;
+            return capacity / 2 > g_auto_size_min ? capacity / 2 : g_auto_size_min;
+        }
+        return capacity;
+    }
+    *idle = 0;
+    return capacity;
+}
 
+static void *auto_size_controller(void *arg) {
+    (void)arg;
+    BufferPressure before;
+    buffer_pressure(&shared_buffer, &before);
+    uint64_t period_start = stats_now_ns();
+    int peak = 0;
+    int samples = 0;
+    int idle = 0;
+    while (!__atomic_load_n(&s_auto_size_done, __ATOMIC_ACQUIRE)) {
+        struct timespec delay = { 0, AUTO_SIZE_SAMPLE_NS };
+        nanosleep(&delay, NULL);
+        int count = buffer_count(&shared_buffer);
+        if (count > peak) {
+            peak = count;
         }
-        if (current_line_ptr != NULL) { // Free last buffer allocated by getline if loop exited
-            free(current_line_ptr);
+        if (++samples < AUTO_SIZE_SAMPLES_PER_PERIOD) {
+            continue;
         }
-        fclose(file);
-    } else { // If file could not be opened
-        // Ensure buffer is signaled for shutdown if not already by sigint_received_flag
-        if (!sigint_received_flag) { // If fopen was the primary error, not SIGINT
-            buffer_signal_shutdown(&shared_buffer);
+        BufferPressure now;
+        buffer_pressure(&shared_buffer, &now);
+        uint64_t now_ns = stats_now_ns();
+        int capacity = auto_size_decide(&now, &before, now_ns - period_start, peak, &idle);
+        if (capacity != now.capacity && buffer_resize(&shared_buffer, capacity)) {
+            s_auto_size_resizes++;
+            if (capacity < s_auto_size_low) {
+                s_auto_size_low = capacity;
+            }
+            if (capacity > s_auto_size_high) {
+                s_auto_size_high = capacity;
+            }
         }
+        before = now;
+        period_start = now_ns;
+        peak = 0;
+        samples = 0;
     }
-    
-    // If SIGINT occurred, ensure buffer is fully in shutdown mode
-    if (sigint_received_flag) {
-        buffer_signal_shutdown(&shared_buffer);
+    return NULL;
+}
+
+// Starts the controller once the workers run. Without it the buffer just keeps its size.
+static void auto_size_start(int capacity) {
+    s_auto_size_low = capacity;
+    s_auto_size_high = capacity;
+    s_auto_size_started = pthread_create(&s_auto_size_thread, NULL, auto_size_controller, NULL) == 0;
+    if (!s_auto_size_started) {
+        perror("pthread_create for the auto-size controller failed");
     }
+}
 
-    // Push EOF markers (NULL pointers) for each worker thread
-    // This signals normal completion. If shutting_down, workers will get NULL from pop anyway.
-    // printf("Manager: Pushing EOF markers to workers.\n"); // Debug
-    for (int i = 0; i < g_num_workers; i++) {
-        if (!buffer_push(&shared_buffer, NULL)) {
-            // If push fails here, it's likely due to shutdown; workers will still terminate correctly.
-            // printf("Manager: Failed to push EOF marker for worker %d (buffer likely shutting down).\n", i); // Debug
-            break;
-        }
+// Stops the controller and takes the final snapshot, once the input is done
+static void auto_size_stop(void) {
+    __atomic_store_n(&s_auto_size_done, true, __ATOMIC_RELEASE);
+    if (s_auto_size_started) {
+        pthread_join(s_auto_size_thread, NULL);
+        s_auto_size_started = false;
     }
+    buffer_pressure(&shared_buffer, &s_auto_size_last);
+}
 
-    // Wait for all worker threads to complete
+// --interval snapshots, printed by a thread of their own so they keep coming in every mode,
+// whatever the manager is blocked on. The final report ends them under s_interval_mutex, so
+// no snapshot can follow the summary.
+static pthread_mutex_t s_interval_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_interval_cond; // Waits on CLOCK_MONOTONIC, so it is set up in interval_report_start
+static bool s_interval_done = false;
+static bool s_interval_started = false;
+static pthread_t s_interval_thread;
+
+// Prints one snapshot of the running counters. Counts cover the slices workers have finished,
+// not those still queued.
+static void interval_report(uint64_t elapsed_ns, int *last_total) {
+    int total = 0;
+    unsigned long long bytes = 0;
     for (int i = 0; i < g_num_workers; i++) {
-        pthread_join(worker_threads[i], NULL);
+        total += __atomic_load_n(&worker_counters[i].matches, __ATOMIC_RELAXED);
+        bytes += __atomic_load_n(&worker_counters[i].bytes, __ATOMIC_RELAXED);
     }
-    free(worker_threads);
-    worker_threads = NULL;
-
-    // printf("Manager thread finished processing and joining workers.\n"); // Debug
+    fprintf(g_report_out, "Interval: %d new matches in %.1fs, %d so far; %.1f MB scanned, %d of %d workers finished\n",
+            total - *last_total, elapsed_ns / 1e9, total, bytes / 1e6,
+            __atomic_load_n(&s_workers_finished, __ATOMIC_RELAXED), __atomic_load_n(&g_num_started, __ATOMIC_RELAXED));
+    fflush(g_report_out); // Reports must show up promptly even when stdout is a pipe
+    *last_total = total;
+}
 
-    // Cleanup all global resources
-    // buffer_destroy, barrier_destroy, free worker_match_counts
+static void *interval_reporter(void *arg) {
+    (void)arg;
+    uint64_t period_ns = (uint64_t)(g_interval_seconds * 1e9);
+    uint64_t last_ns = stats_now_ns();
+    int last_total = 0;
+    pthread_mutex_lock(&s_interval_mutex);
+    while (!s_interval_done) {
+        uint64_t due = last_ns + period_ns;
+        struct timespec deadline = { (time_t)(due / 1000000000), (long)(due % 1000000000) };
+        if (pthread_cond_timedwait(&s_interval_cond, &s_interval_mutex, &deadline) == ETIMEDOUT && !s_interval_done) {
+            uint64_t now = stats_now_ns();
+            interval_report(now - last_ns, &last_total);
+            last_ns = now;
+        }
+    }
+    pthread_mutex_unlock(&s_interval_mutex);
+    return NULL;
+}
+
+// Starts the --interval reporter. Without it the run only reports at the end.
+static void interval_report_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // The clock of stats_now_ns
+    pthread_cond_init(&s_interval_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    s_interval_started = pthread_create(&s_interval_thread, NULL, interval_reporter, NULL) == 0;
+    if (!s_interval_started) {
+        perror("pthread_create for the interval reporter failed");
+    }
+}
+
+// Ends the snapshots; the reporter thread exits at its next wakeup
+static void interval_report_end(void) {
+    pthread_mutex_lock(&s_interval_mutex);
+    s_interval_done = true;
+    if (s_interval_started) {
+        pthread_cond_signal(&s_interval_cond);
+    }
+    pthread_mutex_unlock(&s_interval_mutex);
+}
+
+// Called by main after the joins: the reporter has been told to end by then, unless the run
+// failed before any summary
+static void interval_report_stop(void) {
+    if (s_interval_started) {
+        interval_report_end();
+        pthread_join(s_interval_thread, NULL);
+        pthread_cond_destroy(&s_interval_cond);
+        s_interval_started = false;
+    }
+}
+
+// --shard: sends this run's counts to the coordinator, after print_summary has merged every
+// worker's --group-by table into the first
+static void send_shard_result(void) {
+    ShardResult result = { SHARD_COMPLETE, (uint64_t)g_total_matches_summary, (uint32_t)g_num_patterns, NULL,
+                           g_group_tables ? g_group_tables[0] : NULL };
+    if (sigint_received_flag) {
+        // Stopping at --max-count still answers it; anything else means lines were missed
+        bool limited = g_max_count > 0 && __atomic_load_n(&g_limit_matches, __ATOMIC_RELAXED) >= g_max_count;
+        result.status = limited ? SHARD_LIMITED : SHARD_FAILED;
+    }
+    result.pattern_counts = calloc(g_num_patterns > 0 ? g_num_patterns : 1, sizeof(uint64_t));
+    if (!result.pattern_counts) {
+        perror("calloc for shard result failed"); // The coordinator sees no result and retries
+        return;
+    }
+    for (int p = 0; p < g_num_patterns; p++) {
+        result.pattern_counts[p] = (uint64_t)g_pattern_totals[p];
+    }
+    shard_result_send(STDOUT_FILENO, &result);
+    free(result.pattern_counts);
+}
+
+// Drops one hold on the summary: each worker once it has folded in its counts, and the manager
+// once it has fed everything and no more workers can start. The acquire-release count makes
+// whoever drops the last hold see every fold, so it prints the summary right then, without
+// waiting for the other threads to be joined.
+static void reduce_release(void) {
+    if (__atomic_sub_fetch(&s_reduce_pending, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    interval_report_end();
+    if (g_adaptive) {
+        fprintf(g_report_out, "Adaptive pool: %d of at most %d workers started, at most %d running at once.\n",
+                g_num_started, g_num_workers, s_adaptive_peak);
+    }
+    if (g_auto_size) {
+        fprintf(g_report_out, "Auto-size: buffer capacity between %d and %d slots (bounds %d to %d), resized %d times;"
+                              " producers blocked %.3fs on a full buffer and %.3fs on the %.1f MB byte budget.\n",
+                s_auto_size_low, s_auto_size_high, g_auto_size_min, g_auto_size_max, s_auto_size_resizes,
+                s_auto_size_last.full_wait_ns / 1e9, s_auto_size_last.budget_wait_ns / 1e9, g_byte_budget / 1e6);
+    }
+    print_summary();
+    fflush(g_report_out);
+    if (g_shard_count > 0) {
+        send_shard_result();
+    }
+}
+
+
+// Token bucket pacing the manager when --rate-limit is given. Tokens are lines; the bucket
+// refills at g_rate_limit tokens per second and holds at most one batch worth of burst.
+// It may go negative when a single slice carries more lines than the burst, in which case
+// the manager sleeps off the debt right away.
+static double s_rate_tokens;
+static struct timespec s_rate_last_refill;
+
+static void rate_limit_init(void) {
+    s_rate_tokens = g_batch_size;
+    clock_gettime(CLOCK_MONOTONIC, &s_rate_last_refill);
+}
+
+static void rate_limit_acquire(int lines) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - s_rate_last_refill.tv_sec) + (now.tv_nsec - s_rate_last_refill.tv_nsec) / 1e9;
+    s_rate_last_refill = now;
+
+    s_rate_tokens += elapsed * g_rate_limit;
+    if (s_rate_tokens > g_batch_size) {
+        s_rate_tokens = g_batch_size;
+    }
+    s_rate_tokens -= lines;
+    if (s_rate_tokens < 0) {
+        double wait = -s_rate_tokens / g_rate_limit;
+        struct timespec delay = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+        nanosleep(&delay, NULL); // Interrupted early by SIGINT, which the caller then notices
+    }
+}
+
+// Shard the manager is filling the next batch for; batches are dealt out round-robin
+static int s_push_shard = 0;
+
+// Pushes the pending batch and empties it. Slices that could not be pushed
+// (buffer shutting down) are released here. Returns false if the manager should stop.
+static bool flush_batch(LineSlice *batch, int *batch_len) {
+    if (g_output) {
+        // --print: number the slices in input order, waiting until the last one fits in the window
+        for (int i = 0; i < *batch_len; i++) {
+            batch[i].seq = g_next_seq++;
+        }
+        if (!ordered_output_reserve(g_output, g_next_seq - 1)) {
+            for (int i = 0; i < *batch_len; i++) {
+                line_slice_release(batch[i]);
+            }
+            *batch_len = 0;
+            return false; // Writer stopped
+        }
+    }
+    if (g_report_stats) {
+        uint64_t now = stats_now_ns(); // One clock read per batch, not per line
+        for (int i = 0; i < *batch_len; i++) {
+            batch[i].enqueued_ns = now;
+        }
+    }
+    int pushed = g_use_steal ? pool_push_batch(&g_steal_pool, batch, *batch_len)
+                             : buffer_push_batch(shard_buffer(s_push_shard), batch, *batch_len);
+    if (g_num_shards > 1) { // Never written otherwise, so --readers threads can share it
+        s_push_shard = (s_push_shard + 1) % g_num_shards;
+    }
+    for (int i = pushed; i < *batch_len; i++) {
+        line_slice_release(batch[i]); // Manager must release lines that never reached the buffer
+    }
+    bool all_pushed = pushed == *batch_len;
+    *batch_len = 0;
+    return all_pushed;
+}
+
+// Moves the partial line pending in one arena to another, so that a block read into the second
+// one continues it
+static bool move_pending(LineArena *from, LineArena *to) {
+    size_t partial;
+    char *bytes = arena_pending(from, &partial);
+    if (partial == 0) {
+        return true;
+    }
+    size_t room;
+    char *space = arena_prepare_write(to, partial, &room);
+    if (!space) {
+        return false;
+    }
+    memcpy(space, bytes, partial);
+    arena_wrote(to, partial);
+    LineChunk *chunk;
+    arena_commit(from, partial, &chunk);
+    chunk_release(chunk); // Nothing refers to the old copy
+    return true;
+}
+
+// Manager (or a --readers thread): reads bytes [start, end) of the file in blocks straight into
+// the line arena, finds every newline of a block in one vector pass (see line_split.h) and pushes
+// each line as a slice of its own, without the '\n'. Lines cost no copy or allocation of their
+// own; a partial line at the end of a block stays pending in the arena until the next read
+// completes it. end is -1 to read to the end of the file.
+static void feed_line_range(int fd, off_t start, off_t end, LineSlice *batch) {
+    uint32_t *newlines = malloc(sizeof(uint32_t) * LINE_SPLIT_MAX_LINES);
+    if (!newlines) {
+        perror("malloc for newline offsets failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    int batch_len = 0;
+    LineArena arenas[g_num_shards]; // Lines go into the arena of the shard their batch is for
+    for (int i = 0; i < g_num_shards; i++) {
+        arena_init(&arenas[i], LINE_ARENA_CHUNK_SIZE);
+        if (g_num_shards > 1) {
+            arena_set_node(&arenas[i], affinity_shard_node(i));
+        }
+    }
+    int read_shard = s_push_shard; // Arena the current block is read into
+
+    off_t offset = start;
+    bool stopped = false;
+    while (!stopped && !sigint_received_flag && (end < 0 || offset < end)) {
+        if (read_shard != s_push_shard) { // Only with several shards: follow them at block boundaries
+            if (!move_pending(&arenas[read_shard], &arenas[s_push_shard])) {
+                perror("Failed to allocate line arena chunk");
+                sigint_received_flag = 1;
+                break;
+            }
+            read_shard = s_push_shard;
+        }
+        LineArena *arena = &arenas[read_shard];
+        size_t room;
+        char *space = arena_prepare_write(arena, STREAM_READ_SIZE, &room);
+        if (!space) {
+            perror("Failed to allocate line arena chunk");
+            sigint_received_flag = 1;
+            break;
+        }
+        if (end >= 0 && (off_t)room > end - offset) {
+            room = (size_t)(end - offset);
+        }
+        ssize_t n = pread(fd, space, room, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read failed");
+            sigint_received_flag = 1;
+            break;
+        }
+        if (n == 0) {
+            break; // End of file
+        }
+        arena_wrote(arena, (size_t)n);
+        offset += n;
+
+        // Only the new bytes can hold a newline; anything pending before them is one partial line
+        size_t pending;
+        char *data = arena_pending(arena, &pending);
+        size_t scan = pending - (size_t)n;
+        size_t line_start = 0; // Offset in data of the first line not committed yet
+        while (!stopped && scan < pending) {
+            size_t found = line_split_find(data + scan, pending - scan, newlines, LINE_SPLIT_MAX_LINES);
+            for (size_t k = 0; k < found; k++) {
+                size_t line_end = scan + newlines[k];
+                LineSlice line = { NULL, line_end - line_start, NULL, 0, 0 };
+                line.data = arena_commit(arena, line.length + 1, &line.chunk); // The '\n' goes with it, unused
+                line_start = line_end + 1;
+                batch[batch_len++] = line;
+                if (batch_len == g_batch_size && !flush_batch(batch, &batch_len)) {
+                    stopped = true; // Shutting down; the slices already committed were released
+                    break;
+                }
+                if (g_rate_limit > 0) {
+                    rate_limit_acquire(1); // Simulated pacing, opt-in only
+                }
+            }
+            scan = found < LINE_SPLIT_MAX_LINES ? pending : line_start;
+        }
+    }
+
+    size_t pending;
+    arena_pending(&arenas[read_shard], &pending);
+    if (pending > 0 && !stopped && !sigint_received_flag) { // Batch has room: every full batch was flushed in the loop
+        LineSlice last = { NULL, pending, NULL, 0, 0 }; // Final line without a trailing newline
+        last.data = arena_commit(&arenas[read_shard], pending, &last.chunk);
+        batch[batch_len++] = last;
+    }
+    if (batch_len > 0) { // Push (or release, if shutting down) the last partial batch
+        flush_batch(batch, &batch_len);
+    }
+    if (sigint_received_flag) {
+        signal_shutdown();
+    }
+    for (int i = 0; i < g_num_shards; i++) {
+        arena_destroy(&arenas[i]); // Chunks still referenced by queued lines are freed by their last consumer
+    }
+    free(newlines);
+}
+
+// Manager: streams the plain log file, or its --since/--until range, through feed_line_range
+static void feed_lines_from_stream(const char *log_file_path, LineSlice *batch) {
+    int fd = open(log_file_path, O_RDONLY);
+    if (fd == -1) {
+        perror("open failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    feed_line_range(fd, g_byte_range ? g_range_start : 0, g_byte_range ? g_range_end : -1, batch);
+    close(fd);
+}
+
+// A --readers thread's share of the file
+typedef struct {
+    pthread_t thread;
+    int fd;
+    off_t start;
+    off_t end;
+} reader_args_t;
+
+static void *reader_function(void *arg) {
+    reader_args_t *reader = arg;
+    LineSlice *batch = malloc(sizeof(LineSlice) * g_batch_size);
+    if (!batch) {
+        perror("malloc for reader batch failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+    } else {
+        feed_line_range(reader->fd, reader->start, reader->end, batch);
+        free(batch);
+    }
+    buffer_producer_done(&shared_buffer); // The last reader to finish closes the buffer
+    return NULL;
+}
+
+// Manager (--readers): num_readers threads each feed one byte range of the file (of its
+// --since/--until range) into shared_buffer, as producers of their own. The ranges are moved
+// forward to line starts as in scan_own_range, so every line is pushed by exactly one reader.
+// Returns once all of them are done.
+static void feed_lines_from_readers(const char *log_file_path, int num_readers) {
+    int fd = open(log_file_path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("open failed");
+        if (fd != -1) {
+            close(fd);
+        }
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    size_t file_size = (size_t)st.st_size;
+    reader_args_t *readers = calloc(num_readers, sizeof(reader_args_t));
+    char *scratch = malloc(STREAM_READ_SIZE);
+    if (!readers || !scratch) {
+        perror("malloc for readers failed");
+        free(readers);
+        free(scratch);
+        close(fd);
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+
+    off_t first = g_byte_range ? g_range_start : 0;
+    off_t span = (g_byte_range ? g_range_end : (off_t)file_size) - first;
+    off_t start = first;
+    int started = 0;
+    for (int i = 0; i < num_readers && !sigint_received_flag; i++) {
+        off_t end = first + span * (i + 1) / num_readers;
+        if (end > 0 && i < num_readers - 1) {
+            end = line_start_after(fd, file_size, end - 1, scratch, STREAM_READ_SIZE);
+        }
+        readers[i].fd = fd;
+        readers[i].start = start;
+        readers[i].end = end;
+        start = end;
+        buffer_add_producers(&shared_buffer, 1); // Before it can push; the manager's own registration keeps the buffer open meanwhile
+        if (pthread_create(&readers[i].thread, NULL, reader_function, &readers[i]) != 0) {
+            perror("pthread_create for reader failed");
+            buffer_producer_done(&shared_buffer);
+            sigint_received_flag = 1;
+            signal_shutdown();
+            break;
+        }
+        started++;
+    }
+    free(scratch);
+    for (int i = 0; i < started; i++) {
+        pthread_join(readers[i].thread, NULL);
+    }
+    free(readers);
+    close(fd);
+}
+
+// Manager (--mmap): maps the whole file once and pushes borrowed slices of about
+// MMAP_CHUNK_SIZE bytes, each ending on a newline boundary. Nothing is copied or
+// allocated per line; the mapping is returned through map/map_size and must stay
+// alive until every worker has been joined.
+static void feed_chunks_from_mmap(const char *log_file_path, char **map, size_t *map_size, LineSlice *batch) {
+    *map = NULL;
+    *map_size = 0;
+
+    int fd = open(log_file_path, O_RDONLY);
+    if (fd == -1) {
+        perror("open failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat failed");
+        close(fd);
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    if (st.st_size == 0) {
+        close(fd); // Nothing to map, and mmap rejects zero-length mappings
+        return;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps its own reference to the file
+    if (data == MAP_FAILED) {
+        perror("mmap failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    *map = data;
+    *map_size = size;
+    size_t start = 0;
+    if (g_byte_range && (size_t)g_range_end <= size) { // Only the lines in the --since/--until (or --shard) range are handed out
+        start = (size_t)g_range_start;
+        size = (size_t)g_range_end;
+    }
+    size_t advise_start = start & ~(size_t)(sysconf(_SC_PAGESIZE) - 1); // madvise needs a page-aligned address
+    madvise(data + advise_start, size - advise_start, MADV_SEQUENTIAL);
+
+    int batch_len = 0;
+    while (start < size) {
+        if (sigint_received_flag) {
+            signal_shutdown();
+            break;
+        }
+
+        size_t end = start + MMAP_CHUNK_SIZE;
+        if (end >= size) {
+            end = size;
+        } else {
+            // Extend the slice so it ends right after a newline
+            char *newline = memchr(data + end - 1, '\n', size - end + 1);
+            end = newline ? (size_t)(newline - data) + 1 : size;
+        }
+
+        LineSlice chunk = { data + start, end - start, NULL, 0, 0 };
+        if (g_rate_limit > 0) {
+            rate_limit_acquire(search_count_lines(chunk.data, chunk.length));
+        }
+        batch[batch_len++] = chunk;
+        start = end;
+        if (batch_len == g_batch_size && !flush_batch(batch, &batch_len)) {
+            break; // Shutting down
+        }
+    }
+    if (batch_len > 0) {
+        flush_batch(batch, &batch_len);
+    }
+}
+
+// --follow: waits until *fd has more to read, or the path has been rotated to a new file,
+// the way tail -F does. A truncated file is read again from the start. *fd stays open and
+// owned by the caller (a fresh one after rotation); *restarted is set when reading starts
+// over in new contents, so that the caller ends the old contents' partial line there.
+// Returns false once shutting down, or if the file can no longer be checked.
+static bool follow_wait(const char *path, int *fd, int inotify_fd, int *watch, bool *restarted) {
+    *restarted = false;
+    while (!sigint_received_flag) {
+        struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, FOLLOW_RECHECK_MS) > 0) {
+            char events[4096];
+            while (read(inotify_fd, events, sizeof(events)) > 0) {
+                // Only the wakeup matters; the file itself is checked below
+            }
+        }
+
+        struct stat open_st, path_st;
+        off_t offset = lseek(*fd, 0, SEEK_CUR);
+        if (fstat(*fd, &open_st) == -1 || offset == -1) {
+            perror("fstat failed");
+            return false;
+        }
+        if (open_st.st_size > offset) {
+            return true; // Appended to
+        }
+        if (open_st.st_size < offset) {
+            lseek(*fd, 0, SEEK_SET); // Truncated in place (copytruncate rotation)
+            *restarted = true;
+            return true;
+        }
+        if (stat(path, &path_st) == 0 && (path_st.st_ino != open_st.st_ino || path_st.st_dev != open_st.st_dev)) {
+            // Rotated, and the old file is fully read: switch to the new one
+            int new_fd = open(path, O_RDONLY);
+            if (new_fd == -1) {
+                continue; // Not recreated yet
+            }
+            inotify_rm_watch(inotify_fd, *watch);
+            *watch = inotify_add_watch(inotify_fd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+            close(*fd);
+            *fd = new_fd;
+            *restarted = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hands out the partial line pending in the arena, if any, as a final line without a trailing
+// newline: at the end of the input, or of a followed file's old contents. The batch must have room.
+static void commit_partial_line(LineArena *arena, LineSlice *batch, int *batch_len) {
+    size_t pending;
+    arena_pending(arena, &pending);
+    if (pending > 0) {
+        LineSlice last = { NULL, pending, NULL, 0, 0 };
+        last.data = arena_commit(arena, pending, &last.chunk);
+        batch[(*batch_len)++] = last;
+    }
+}
+
+// Manager for stdin ("-"), --follow and compressed files: reads large blocks straight into the
+// line arena and pushes each run of complete lines as one slice, so there is no per-line copy
+// or allocation and memory stays at a few arena chunks however long the stream runs. A partial
+// line at the end of a block stays pending in the arena until the rest of it is read.
+// Except with --follow the blocks come through an InputStream, which inflates gzip/zstd input:
+// the manager then acts as the decompression thread, overlapping decompression with the
+// workers' searching, and zstd frames are additionally decoded on a pool of threads.
+// With --aio they come from an AsyncReader instead, which has the next blocks of the file
+// (or of its --since/--until range) already being read while the manager splits this one.
+static void feed_blocks_from_fd(const char *log_file_path, LineSlice *batch) {
+    AsyncReader *aio = NULL;
+    if (g_use_aio) {
+        aio = async_reader_open(log_file_path, g_byte_range ? g_range_start : 0, g_byte_range ? g_range_end : -1, g_aio_direct);
+        if (!aio) {
+            sigint_received_flag = 1;
+            signal_shutdown();
+            return;
+        }
+        fprintf(g_report_out, "Async I/O: %s; up to %d blocks of %d KiB read ahead.\n", async_reader_describe(aio),
+                ASYNC_READ_DEPTH, ASYNC_READ_BLOCK_SIZE / 1024);
+    }
+    bool from_stdin = strcmp(log_file_path, "-") == 0;
+    int fd = aio ? -1 : from_stdin ? STDIN_FILENO : open(log_file_path, O_RDONLY);
+    if (fd == -1 && !aio) {
+        perror("open failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+        return;
+    }
+    InputStream *in = NULL;
+    if (!g_follow && !aio) {
+        in = input_open_fd(fd); // Owns fd from here on
+        if (!in) {
+            sigint_received_flag = 1;
+            signal_shutdown();
+            return;
+        }
+    }
+    int inotify_fd = -1;
+    int watch = -1;
+    if (g_follow) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd == -1 ||
+            (watch = inotify_add_watch(inotify_fd, log_file_path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) == -1) {
+            perror("inotify setup failed");
+            if (inotify_fd != -1) {
+                close(inotify_fd);
+            }
+            close(fd);
+            sigint_received_flag = 1;
+            signal_shutdown();
+            return;
+        }
+    }
+
+    LineArena arena;
+    arena_init(&arena, LINE_ARENA_CHUNK_SIZE);
+    int batch_len = 0;
+    while (!sigint_received_flag) {
+        size_t room;
+        char *space = arena_prepare_write(&arena, STREAM_READ_SIZE, &room);
+        if (!space) {
+            perror("Failed to allocate line arena chunk");
+            sigint_received_flag = 1;
+            break;
+        }
+        errno = 0;
+        ssize_t n = aio ? async_reader_read(aio, space, room) : in ? input_read(in, space, room) : read(fd, space, room);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!in && !aio) {
+                perror("read failed"); // input_read and async_reader_read report their own errors
+            }
+            sigint_received_flag = 1;
+            break;
+        }
+        if (n == 0) {
+            if (!g_follow) {
+                break; // End of input
+            }
+            if (batch_len > 0 && !flush_batch(batch, &batch_len)) {
+                break; // Hand out what was read before going idle
+            }
+            bool restarted;
+            if (!follow_wait(log_file_path, &fd, inotify_fd, &watch, &restarted)) {
+                break;
+            }
+            if (restarted) {
+                // The old contents ended with that line; it must not run on into the new ones
+                commit_partial_line(&arena, batch, &batch_len); // The batch was just flushed
+            }
+            continue;
+        }
+        arena_wrote(&arena, (size_t)n);
+
+        // Only the new bytes can hold a newline; anything pending before them is one partial line
+        size_t pending;
+        char *data = arena_pending(&arena, &pending);
+        char *last_newline = memrchr(data + pending - n, '\n', (size_t)n);
+        if (last_newline) {
+            LineSlice slice = { NULL, (size_t)(last_newline - data) + 1, NULL, 0, 0 };
+            slice.data = arena_commit(&arena, slice.length, &slice.chunk);
+            if (g_rate_limit > 0) {
+                rate_limit_acquire(search_count_lines(slice.data, slice.length));
+            }
+            batch[batch_len++] = slice;
+        }
+        // A short read means the input has nothing more right now; don't hold lines back for a full batch
+        if ((batch_len == g_batch_size || (batch_len > 0 && (size_t)n < room)) && !flush_batch(batch, &batch_len)) {
+            break; // Shutting down
+        }
+    }
+
+    if (!sigint_received_flag) {
+        commit_partial_line(&arena, batch, &batch_len); // Batch has room: every full batch was flushed in the loop
+    }
+    if (batch_len > 0) {
+        flush_batch(batch, &batch_len);
+    }
+    if (sigint_received_flag) {
+        signal_shutdown();
+    }
+    arena_destroy(&arena); // Chunks still referenced by queued slices are freed by their last consumer
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+    }
+    async_reader_close(aio);
+    if (in) {
+        input_close(in);
+    } else if (fd != STDIN_FILENO && fd != -1) {
+        close(fd);
+    }
+}
+
+#ifdef LOG_INSTRUMENT
+// Prints the queue instrumentation and the per-worker counters. Runs at exit, and from the
+// SIGUSR1 dumper thread while the run is in progress.
+static void dump_instrumentation(void) {
+    flockfile(stderr); // Keep one dump together
+    buffer_instrument_print(&shared_buffer, "shared", stderr);
+    for (int i = 1; i < g_num_shards; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "shard-%d", i);
+        buffer_instrument_print(&g_node_buffers[i - 1], name, stderr);
+    }
+    for (int i = 0; g_use_steal && i < g_steal_pool.num_queues; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "worker-%d", i);
+        buffer_instrument_print(&g_steal_pool.queues[i], name, stderr);
+    }
+    for (int i = 0; i < g_num_workers; i++) {
+        worker_counters_t *counters = &worker_counters[i];
+        fprintf(stderr, "Worker %d: matches=%d lines=%lu bytes=%llu wait_s=%.6f\n", i,
+                __atomic_load_n(&counters->matches, __ATOMIC_RELAXED),
+                __atomic_load_n(&counters->lines, __ATOMIC_RELAXED),
+                __atomic_load_n(&counters->bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&counters->wait_ns, __ATOMIC_RELAXED) / 1e9);
+    }
+    funlockfile(stderr);
+}
+
+static volatile bool s_dumper_done = false;
+
+// Waits for SIGUSR1, which every other thread blocks, and dumps on each one. main stops it by
+// setting s_dumper_done and sending one last SIGUSR1.
+static void *instrument_dumper(void *arg) {
+    sigset_t *set = arg;
+    int sig;
+    while (sigwait(set, &sig) == 0 && !s_dumper_done) {
+        dump_instrumentation();
+    }
+    return NULL;
+}
+#endif
+
+// Prints the --stats summary as a single key=value line, merging the per-worker counters.
+// Latency is per slice (one line, or one run of lines with --mmap) and is not measured with --split.
+static void print_run_stats(uint64_t elapsed_ns) {
+    unsigned long lines = 0;
+    unsigned long long bytes = 0;
+    unsigned long long wait_ns = 0;
+    LatencyHistogram *latency = calloc(1, sizeof(LatencyHistogram));
+    if (!latency) {
+        perror("calloc for latency histogram failed");
+        return;
+    }
+    for (int i = 0; i < g_num_workers; i++) {
+        lines += worker_counters[i].lines;
+        bytes += worker_counters[i].bytes;
+        wait_ns += worker_counters[i].wait_ns;
+        latency_merge(latency, &g_worker_stats[i].latency);
+    }
+    double seconds = elapsed_ns / 1e9;
+    fprintf(g_report_out, "Stats: lines=%lu bytes=%llu seconds=%.6f lines_per_s=%.0f mb_per_s=%.2f"
+           " p50_latency_us=%.1f p99_latency_us=%.1f worker_wait_s=%.6f\n",
+           lines, bytes, seconds, lines / seconds, bytes / 1e6 / seconds,
+           latency_percentile(latency, 50) / 1e3, latency_percentile(latency, 99) / 1e3, wait_ns / 1e9);
+    free(latency);
+}
+
+// Appends one regular file to g_files. Returns false on allocation failure (reported).
+static bool add_input_file(const char *path, size_t size) {
+    input_file_t *grown = realloc(g_files, sizeof(input_file_t) * (g_num_files + 1));
+    if (!grown) {
+        perror("realloc for input files failed");
+        return false;
+    }
+    g_files = grown;
+    input_file_t file = { strdup(path), size, input_sniff(path) != INPUT_PLAIN, 0, false, 0, (off_t)size };
+    if (!file.path) {
+        perror("strdup for input file failed");
+        return false;
+    }
+    g_files[g_num_files++] = file;
+    return true;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Adds the regular files directly inside a directory, in name order; hidden files and --index
+// sidecar files are skipped
+static bool add_input_directory(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        perror("opendir failed");
+        return false;
+    }
+    char **names = NULL;
+    int num_names = 0;
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char **grown = realloc(names, sizeof(char *) * (num_names + 1));
+        char *name = grown ? malloc(strlen(dir_path) + strlen(entry->d_name) + 2) : NULL;
+        if (grown) {
+            names = grown;
+        }
+        if (!name) {
+            perror("Failed to list directory");
+            ok = false;
+            break;
+        }
+        sprintf(name, "%s/%s", dir_path, entry->d_name);
+        names[num_names++] = name;
+    }
+    closedir(dir);
+    qsort(names, num_names, sizeof(char *), compare_strings);
+    for (int i = 0; i < num_names; i++) {
+        struct stat st;
+        if (ok && stat(names[i], &st) == 0 && S_ISREG(st.st_mode) && !line_index_is_index_file(names[i])) {
+            ok = add_input_file(names[i], (size_t)st.st_size);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+// Expands one input argument (a file, a directory or a glob pattern) into g_files
+static bool add_input_path(const char *arg) {
+    struct stat st;
+    if (stat(arg, &st) == 0) {
+        if (S_ISDIR(st.st_mode)) {
+            return add_input_directory(arg);
+        }
+        return add_input_file(arg, (size_t)st.st_size);
+    }
+    if (!strpbrk(arg, "*?[")) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", arg, strerror(errno));
+        return false;
+    }
+    glob_t matches;
+    int rc = glob(arg, 0, NULL, &matches);
+    if (rc != 0) {
+        fprintf(stderr, "Error: %s %s\n", rc == GLOB_NOMATCH ? "No files match" : "Failed to expand", arg);
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; ok && i < matches.gl_pathc; i++) {
+        if (stat(matches.gl_pathv[i], &st) == 0 && S_ISREG(st.st_mode) && !line_index_is_index_file(matches.gl_pathv[i])) { // glob sorts its matches
+            ok = add_input_file(matches.gl_pathv[i], (size_t)st.st_size);
+        }
+    }
+    globfree(&matches);
+    return ok;
+}
+
+static int compare_work_size(const void *a, const void *b) {
+    off_t size_a = ((const file_work_t *)a)->end - ((const file_work_t *)a)->start;
+    off_t size_b = ((const file_work_t *)b)->end - ((const file_work_t *)b)->start;
+    return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+// --index: tells whether a block of an indexed file may hold a matching line. Every matching
+// line contains one of the terms (with --regex, the literal every match contains), so a block
+// whose filter rules all of them out cannot.
+static bool index_block_may_match(const LineIndex *index, size_t block) {
+    if (g_num_patterns == 0) {
+        return true; // --where/--group-by only
+    }
+    if (g_regex) {
+        const char *literal = regex_required_literal(g_regex);
+        return !literal || line_index_block_may_contain(index, block, literal, strlen(literal));
+    }
+    for (int p = 0; p < g_num_patterns; p++) {
+        if (line_index_block_may_contain(index, block, g_patterns[p], strlen(g_patterns[p]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Index statistics for the --index report line
+static size_t s_index_blocks;
+static size_t s_index_blocks_scanned;
+static uint64_t s_index_lines;
+static uint64_t s_index_lines_scanned;
+
+// Appends the work items of an indexed file: runs of consecutive blocks that may match, cut
+// into items of about FILE_WORK_RANGE_SIZE bytes. The blocks start on lines, so neither do the items.
+static void add_indexed_file_work(int f, const LineIndex *index) {
+    size_t num_blocks = line_index_num_blocks(index);
+    file_work_t run = { f, 0, 0, true };
+    bool in_run = false;
+    for (size_t b = 0; b < num_blocks; b++) {
+        // Clipped to the --since/--until range, whose ends are line starts too
+        off_t start = (off_t)line_index_block_offset(index, b);
+        off_t end = (off_t)line_index_block_offset(index, b + 1);
+        start = start > g_files[f].range_start ? start : g_files[f].range_start;
+        end = end < g_files[f].range_end ? end : g_files[f].range_end;
+        if (start >= end || !index_block_may_match(index, b)) {
+            continue;
+        }
+        s_index_blocks_scanned++;
+        s_index_lines_scanned += line_index_block_first_line(index, b + 1) - line_index_block_first_line(index, b);
+        if (in_run && run.end == start && end - run.start <= FILE_WORK_RANGE_SIZE) {
+            run.end = end; // Extend the current run
+            continue;
+        }
+        if (in_run) {
+            g_file_work[g_num_file_work++] = run;
+        }
+        run.start = start;
+        run.end = end;
+        in_run = true;
+    }
+    if (in_run) {
+        g_file_work[g_num_file_work++] = run;
+    }
+    s_index_blocks += num_blocks;
+    s_index_lines += line_index_block_first_line(index, num_blocks);
+}
+
+// Totals for the --since/--until report line
+static uint64_t s_range_bytes;
+static uint64_t s_range_total_bytes;
+
+// --since/--until: narrows a plain log file to the byte range [start, end) holding the lines
+// in the time range. Returns false on error (reported).
+static bool find_time_range(const char *path, off_t *start, off_t *end) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("open failed");
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    bool ok = time_range_find(fd, st.st_size, g_since, g_until, start, end);
+    close(fd);
+    if (ok) {
+        s_range_bytes += (uint64_t)(*end - *start);
+        s_range_total_bytes += (uint64_t)st.st_size;
+    }
+    return ok;
+}
+
+// Builds the file-level work queue: plain files (or their --since/--until ranges) cut into
+// FILE_WORK_RANGE_SIZE ranges (with --index, into the runs of blocks their index cannot rule
+// out), compressed files whole, largest first so that workers finish at about the same time
+static bool build_file_work(void) {
+    for (int f = 0; g_time_range && f < g_num_files; f++) {
+        if (g_files[f].compressed) {
+            fprintf(stderr, "Error: --since/--until need plain log files to search in; %s is compressed.\n", g_files[f].path);
+            return false;
+        }
+        if (!find_time_range(g_files[f].path, &g_files[f].range_start, &g_files[f].range_end)) {
+            return false;
+        }
+    }
+    LineIndex **indexes = calloc(g_num_files, sizeof(LineIndex *));
+    if (!indexes) {
+        perror("calloc for file indexes failed");
+        return false;
+    }
+    int count = 0;
+    int built = 0;
+    for (int f = 0; f < g_num_files; f++) {
+        bool index_built = false;
+        if (g_use_index && !g_files[f].compressed &&
+            !(indexes[f] = line_index_open(g_files[f].path, &index_built))) {
+            fprintf(stderr, "Warning: No index for %s; scanning all of it.\n", g_files[f].path);
+        }
+        built += index_built ? 1 : 0;
+        if (indexes[f]) {
+            count += (int)line_index_num_blocks(indexes[f]); // At most one item per block
+        } else {
+            off_t size = g_files[f].range_end - g_files[f].range_start;
+            count += g_files[f].compressed || size == 0 ? 1 : (int)((size + FILE_WORK_RANGE_SIZE - 1) / FILE_WORK_RANGE_SIZE);
+        }
+    }
+    g_file_work = malloc(sizeof(file_work_t) * (count > 0 ? count : 1));
+    if (!g_file_work) {
+        perror("malloc for file work queue failed");
+        for (int f = 0; f < g_num_files; f++) {
+            line_index_close(indexes[f]);
+        }
+        free(indexes);
+        return false;
+    }
+    for (int f = 0; f < g_num_files; f++) {
+        if (indexes[f]) {
+            add_indexed_file_work(f, indexes[f]);
+            line_index_close(indexes[f]); // The items hold all the workers need from it
+            continue;
+        }
+        off_t first = g_files[f].range_start;
+        off_t last = g_files[f].range_end;
+        off_t step = g_files[f].compressed || last == first ? (last > first ? last - first : 1) : FILE_WORK_RANGE_SIZE;
+        for (off_t start = first; start == first || start < last; start += step) {
+            file_work_t work = { f, start, start + step < last ? start + step : last, false };
+            g_file_work[g_num_file_work++] = work;
+        }
+    }
+    free(indexes);
+    qsort(g_file_work, g_num_file_work, sizeof(file_work_t), compare_work_size);
+    if (g_use_index) {
+        fprintf(g_report_out, "Index: scanning %zu of %zu blocks (%llu of %llu lines)%s.\n",
+                s_index_blocks_scanned, s_index_blocks, (unsigned long long)s_index_lines_scanned,
+                (unsigned long long)s_index_lines, built > 0 ? "; index built" : "");
+    }
+    return true;
+}
+
+static void free_input_files(void) {
+    for (int f = 0; f < g_num_files; f++) {
+        free(g_files[f].path);
+    }
+    free(g_files);
+    g_files = NULL;
+    g_num_files = 0;
+    free(g_file_work);
+    g_file_work = NULL;
+    g_num_file_work = 0;
+}
+
+// Appends a copy of a search term to g_patterns. Returns false on allocation failure.
+static bool add_pattern(const char *pattern) {
+    char **grown = realloc(g_patterns, sizeof(char *) * (g_num_patterns + 1));
+    if (!grown) {
+        return false;
+    }
+    g_patterns = grown;
+    g_patterns[g_num_patterns] = strdup(pattern);
+    if (!g_patterns[g_num_patterns]) {
+        return false;
+    }
+    g_num_patterns++;
+    return true;
+}
+
+// Reads one search term per line from a file; empty lines are ignored.
+static bool load_patterns_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("fopen for patterns file failed");
+        return false;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t read_len;
+    bool ok = true;
+    while (ok && (read_len = getline(&line, &line_size, file)) != -1) {
+        if (read_len > 0 && line[read_len - 1] == '\n') {
+            line[--read_len] = '\0';
+        }
+        if (read_len > 0) {
+            ok = add_pattern(line);
+        }
+    }
+    free(line);
+    fclose(file);
+    if (!ok) {
+        perror("Failed to store search terms");
+    }
+    return ok;
+}
+
+static void free_patterns(void) {
+    for (int p = 0; p < g_num_patterns; p++) {
+        free(g_patterns[p]);
+    }
+    free(g_patterns);
+    g_patterns = NULL;
+    g_num_patterns = 0;
+}
+
+// --shard I/N: the coordinator closes the connection when it gives up on the run (SIGINT, or
+// the host retired), so a shard run stops on hangup as it would on SIGINT instead of scanning
+// the rest of its range for nobody. Only the flag is set, like the handler, which keeps a late
+// hangup during teardown harmless.
+static void *watch_coordinator(void *arg) {
+    (void)arg;
+    struct pollfd connection = { .fd = STDOUT_FILENO, .events = POLLRDHUP };
+    while (poll(&connection, 1, -1) == -1 && errno == EINTR) {
+    }
+    sigint_received_flag = 1;
+    return NULL;
+}
+
+// --shard I/N: narrows the range to read (the whole file, or its --since/--until range) to
+// its I-th of N parts, moved forward to line starts as in scan_own_range, so the N runs of a
+// --coordinate job scan every line exactly once between them
+static bool select_shard_range(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    char *scratch = malloc(STREAM_READ_SIZE);
+    if (fd == -1 || fstat(fd, &st) == -1 || !scratch) {
+        perror("Failed to open the shard's log file");
+        if (fd != -1) {
+            close(fd);
+        }
+        free(scratch);
+        return false;
+    }
+    size_t file_size = (size_t)st.st_size;
+    off_t first = g_byte_range ? g_range_start : 0;
+    off_t span = (g_byte_range ? g_range_end : (off_t)file_size) - first;
+    off_t start = first + span * g_shard_index / g_shard_count;
+    off_t end = first + span * (g_shard_index + 1) / g_shard_count;
+    if (start > first) {
+        start = line_start_after(fd, file_size, start - 1, scratch, STREAM_READ_SIZE);
+    }
+    if (end > 0 && g_shard_index < g_shard_count - 1) {
+        end = line_start_after(fd, file_size, end - 1, scratch, STREAM_READ_SIZE);
+    }
+    free(scratch);
+    close(fd);
+    g_range_start = start;
+    g_range_end = end;
+    g_byte_range = true;
+    fprintf(g_report_out, "Shard %d/%d: bytes %lld to %lld of %s.\n", g_shard_index, g_shard_count,
+            (long long)start, (long long)end, path);
+    return true;
+}
+
+// --coordinate: adds one shard's counts to the totals. Called by one host thread at a time.
+static void merge_shard_result(const ShardResult *result, void *ctx) {
+    (void)ctx;
+    g_total_matches_summary += (int)result->matches;
+    for (int p = 0; p < g_num_patterns; p++) {
+        g_pattern_totals[p] += (int)result->pattern_counts[p];
+    }
+    if (result->groups) {
+        group_table_merge(g_group_tables[0], result->groups);
+    }
+}
+
+// --coordinate: has the hosts run the shards of this command line (args, without the
+// coordinator's own options), then prints the merged summary. Returns the exit status.
+static int run_coordinator(int num_args, char **args) {
+    int num_hosts = 1;
+    for (const char *p = g_coordinate_hosts; *p; p++) {
+        num_hosts += *p == ',';
+    }
+    int num_shards = g_num_dist_shards > 0 ? g_num_dist_shards : num_hosts * DIST_SHARDS_PER_HOST;
+    g_pattern_totals = calloc(g_num_patterns > 0 ? g_num_patterns : 1, sizeof(int));
+    if (g_group_field >= 0) {
+        g_num_workers = 1; // Workers run on the hosts; the coordinator merges into a single table
+        g_group_tables = malloc(sizeof(GroupTable *));
+        if (g_group_tables) {
+            g_group_tables[0] = group_table_create();
+        }
+    }
+    if (!g_pattern_totals || (g_group_field >= 0 && !g_group_tables)) {
+        perror("Allocation of coordinator totals failed");
+        free(g_pattern_totals);
+        free(g_group_tables);
+        return EXIT_FAILURE;
+    }
+
+    DistJob job = { g_coordinate_hosts, num_shards, g_shard_timeout_s > 0 ? g_shard_timeout_s : DIST_DEFAULT_SHARD_TIMEOUT_S,
+                    num_args, args, (uint32_t)g_num_patterns, g_group_field >= 0,
+                    merge_shard_result, NULL, &sigint_received_flag, g_report_out };
+    DistStats stats;
+    bool complete = dist_coordinate(&job, &stats);
+    if (stats.hosts > 0) {
+        fprintf(g_report_out, "Distributed: %d of %d shards merged from %d host%s, %d runs retried%s.\n",
+                stats.completed, num_shards, stats.hosts, stats.hosts == 1 ? "" : "s", stats.retried,
+                complete ? "" : "; the totals below are partial");
+        print_summary();
+    }
+    if (g_group_tables) {
+        group_table_destroy(g_group_tables[0]);
+        free(g_group_tables);
+        g_group_tables = NULL;
+    }
+    free(g_pattern_totals);
+    g_pattern_totals = NULL;
+    if (!complete) {
+        return EXIT_FAILURE;
+    }
+    if (g_exists_mode && g_total_matches_summary == 0) {
+        return EXIT_FAILURE; // Like grep -q: a non-zero status means nothing matched
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        { "mmap", no_argument, NULL, 'm' },
+        { "batch", required_argument, NULL, 'b' },
+        { "lockfree", no_argument, NULL, 'l' },
+        { "rate-limit", required_argument, NULL, 'r' },
+        { "patterns-file", required_argument, NULL, 'p' },
+        { "split", no_argument, NULL, 's' },
+        { "steal", no_argument, NULL, 't' },
+        { "adaptive", no_argument, NULL, 'a' },
+        { "stats", no_argument, NULL, 'S' },
+        { "file", required_argument, NULL, 'F' },
+        { "max-count", required_argument, NULL, 'n' },
+        { "exists", no_argument, NULL, 'e' },
+        { "index", no_argument, NULL, 'X' },
+        { "since", required_argument, NULL, 'A' },
+        { "until", required_argument, NULL, 'U' },
+        { "print", no_argument, NULL, 'P' },
+        { "aio", no_argument, NULL, 'o' },
+        { "direct", no_argument, NULL, 'D' },
+        { "readers", required_argument, NULL, 'R' },
+        { "auto-size", required_argument, NULL, 'Z' },
+        { "memory-budget", required_argument, NULL, 'M' },
+        { "serve", required_argument, NULL, 'V' },
+        { "bind", required_argument, NULL, 'B' },
+        { "serve-root", required_argument, NULL, 'T' },
+        { "coordinate", required_argument, NULL, 'C' },
+        { "shards", required_argument, NULL, 'N' },
+        { "shard-timeout", required_argument, NULL, 'O' },
+        { "shard", required_argument, NULL, 'H' },
+        { "pin", no_argument, NULL, 'c' },
+        { "follow", no_argument, NULL, 'f' },
+        { "interval", required_argument, NULL, 'I' },
+        { "ignore-case", no_argument, NULL, 'i' },
+        { "regex", no_argument, NULL, 'x' },
+        { "where", required_argument, NULL, 'w' },
+        { "group-by", required_argument, NULL, 'g' },
+        { "top", required_argument, NULL, 'k' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *patterns_file_path = NULL;
+    const char *extra_inputs[argc]; // --file paths, in addition to <log_file>
+    int num_extra_inputs = 0;
+    int serve_port = 0;
+    const char *serve_bind = NULL;
+    const char *serve_root = NULL;
+    // --coordinate: the command line for the hosts, built as the options are parsed
+    char *forwarded[2 * argc + 1];
+    char forwarded_names[argc][32];
+    int num_forwarded = 0;
+    int num_forwarded_names = 0;
+    bool only_serve_options = true; // Nothing but --serve, --bind and --serve-root given
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                g_use_mmap = true;
+                break;
+            case 'l':
+                g_use_lockfree = true;
+                break;
+            case 'r':
+                g_rate_limit = strtod(optarg, NULL);
+                if (g_rate_limit <= 0) {
+                    fprintf(stderr, "Error: Rate limit must be a positive number of lines per second.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                patterns_file_path = optarg;
+                break;
+            case 's':
+                g_use_split = true;
+                break;
+            case 't':
+                g_use_steal = true;
+                break;
+            case 'a':
+                g_adaptive = true;
+                break;
+            case 'S':
+                g_report_stats = true;
+                break;
+            case 'n':
+                g_max_count = atol(optarg);
+                if (g_max_count <= 0) {
+                    fprintf(stderr, "Error: --max-count must be a positive integer.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'e':
+                g_exists_mode = true;
+                break;
+            case 'X':
+                g_use_index = true;
+                break;
+            case 'A':
+            case 'U':
+                if (!time_parse_arg(optarg, opt == 'A' ? &g_since : &g_until)) {
+                    fprintf(stderr, "Error: Invalid time \"%s\" (use e.g. 12/May/2023:14:00:01 +0000 or 2023-05-12T14:00:01Z).\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                g_time_range = true;
+                break;
+            case 'P':
+                g_print = true;
+                break;
+            case 'o':
+                g_use_aio = true;
+                break;
+            case 'D':
+                g_use_aio = true; // --direct implies --aio
+                g_aio_direct = true;
+                break;
+            case 'R':
+                g_num_readers = atoi(optarg);
+                if (g_num_readers <= 0) {
+                    fprintf(stderr, "Error: --readers must be a positive integer.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'Z':
+                if (sscanf(optarg, "%d:%d", &g_auto_size_min, &g_auto_size_max) != 2
+                        || g_auto_size_min <= 0 || g_auto_size_max < g_auto_size_min) {
+                    fprintf(stderr, "Error: --auto-size takes MIN:MAX, two positive slot counts with MIN <= MAX.\n");
+                    return EXIT_FAILURE;
+                }
+                g_auto_size = true;
+                break;
+            case 'M': {
+                double megabytes = strtod(optarg, NULL);
+                if (megabytes <= 0) {
+                    fprintf(stderr, "Error: --memory-budget must be a positive number of megabytes.\n");
+                    return EXIT_FAILURE;
+                }
+                g_byte_budget = (size_t)(megabytes * 1e6);
+                break;
+            }
+            case 'V':
+                serve_port = atoi(optarg);
+                if (serve_port <= 0 || serve_port > 65535) {
+                    fprintf(stderr, "Error: --serve takes a TCP port number.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'C':
+            case 'N':
+                if (opt == 'C') {
+                    g_coordinate_hosts = optarg;
+                } else if ((g_num_dist_shards = atoi(optarg)) <= 0) {
+                    fprintf(stderr, "Error: --shards must be a positive integer.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'O':
+                g_shard_timeout_s = atoi(optarg);
+                if (g_shard_timeout_s <= 0) {
+                    fprintf(stderr, "Error: --shard-timeout must be a positive number of seconds.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'B':
+                serve_bind = optarg;
+                break;
+            case 'T':
+                serve_root = optarg;
+                break;
+            case 'H':
+                if (sscanf(optarg, "%d/%d", &g_shard_index, &g_shard_count) != 2
+                        || g_shard_count <= 0 || g_shard_index < 0 || g_shard_index >= g_shard_count) {
+                    fprintf(stderr, "Error: --shard takes I/N with 0 <= I < N.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                g_pin = true;
+                break;
+            case 'F':
+                extra_inputs[num_extra_inputs++] = optarg;
+                break;
+            case 'f':
+                g_follow = true;
+                break;
+            case 'i':
+                g_nocase = true;
+                break;
+            case 'x':
+                g_use_regex = true;
+                break;
+            case 'I':
+                g_interval_seconds = strtod(optarg, NULL);
+                if (g_interval_seconds <= 0) {
+                    fprintf(stderr, "Error: Interval must be a positive number of seconds.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'w':
+                if (!filter_add(&g_filter, optarg)) {
+                    fprintf(stderr, "Error: Invalid --where expression \"%s\" (fields: ip ident user time method path protocol status bytes).\n", optarg);
+                    filter_destroy(&g_filter);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'g':
+                g_group_field = clf_field_from_name(optarg, strlen(optarg));
+                if (g_group_field < 0) {
+                    fprintf(stderr, "Error: Unknown --group-by field \"%s\" (fields: ip ident user time method path protocol status bytes).\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'k':
+                g_group_top = atoi(optarg);
+                if (g_group_top <= 0) {
+                    fprintf(stderr, "Error: --top must be a positive integer.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                g_batch_size = atoi(optarg);
+                if (g_batch_size <= 0) {
+                    fprintf(stderr, "Error: Batch size must be a positive integer.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, USAGE);
+                return EXIT_FAILURE;
+        }
+        if (opt == 'V' || opt == 'B' || opt == 'T') {
+            continue;
+        }
+        only_serve_options = false;
+        if (opt != 'C' && opt != 'N' && opt != 'O') {
+            // Everything but the coordinator's own options goes to the hosts, by its full name
+            // whichever form was typed (-i, an abbreviation, --name=value), as servers take no other
+            for (const struct option *o = long_options; o->name; o++) {
+                if (o->val == opt) {
+                    char *name = forwarded_names[num_forwarded_names++];
+                    snprintf(name, sizeof(forwarded_names[0]), "--%s", o->name);
+                    forwarded[num_forwarded++] = name;
+                    if (o->has_arg == required_argument) {
+                        forwarded[num_forwarded++] = optarg;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    if (serve_port > 0) {
+        if (optind < argc || !only_serve_options) {
+            fprintf(stderr, "Error: --serve takes only --bind and --serve-root; the coordinator sends each shard's arguments.\n");
+            return EXIT_FAILURE;
+        }
+        return dist_serve(serve_bind ? serve_bind : DIST_DEFAULT_BIND, serve_port, serve_root ? serve_root : ".")
+                ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (serve_bind || serve_root) {
+        fprintf(stderr, "Error: --bind and --serve-root need --serve.\n");
+        return EXIT_FAILURE;
+    }
+
+    // The search term is optional when the terms come from --patterns-file, or --where/--group-by select the lines
+    bool terms_optional = patterns_file_path || g_filter.count > 0 || g_group_field >= 0;
+    if (argc - optind < (terms_optional ? 3 : 4)) {
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+
+    int buffer_capacity = atoi(argv[optind]);
+    g_num_workers = atoi(argv[optind + 1]);
+    char *log_file_path = argv[optind + 2];
+
+    if (buffer_capacity <= 0 || g_num_workers <= 0) {
+        fprintf(stderr, "Error: Buffer size and number of workers must be positive integers.\n");
+        fprintf(stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    if (g_use_split && (g_use_mmap || g_use_steal)) {
+        fprintf(stderr, "Error: --split reads the file directly and cannot be combined with --mmap or --steal.\n");
+        return EXIT_FAILURE;
+    }
+    bool from_stdin = strcmp(log_file_path, "-") == 0;
+    // More than one input, a directory or a glob pattern switch to multi-file mode
+    struct stat input_st;
+    if (stat(log_file_path, &input_st) == 0) {
+        g_multi_file = num_extra_inputs > 0 || S_ISDIR(input_st.st_mode);
+    } else {
+        g_multi_file = num_extra_inputs > 0 || (!from_stdin && strpbrk(log_file_path, "*?[") != NULL);
+    }
+    if (g_multi_file && (from_stdin || g_use_mmap || g_use_split || g_use_steal || g_follow || g_rate_limit > 0)) {
+        fprintf(stderr, "Error: Multiple input files are read by the workers themselves and cannot be combined with"
+                        " stdin, --mmap, --split, --steal, --follow or --rate-limit.\n");
+        return EXIT_FAILURE;
+    }
+    bool compressed = !from_stdin && !g_multi_file && input_sniff(log_file_path) != INPUT_PLAIN;
+    if (g_use_index && (from_stdin || g_use_mmap || g_use_split || g_use_steal || g_follow || g_rate_limit > 0 || compressed)) {
+        fprintf(stderr, "Error: --index has the workers read plain log files themselves and cannot be combined with"
+                        " stdin, compressed input, --mmap, --split, --steal, --follow or --rate-limit.\n");
+        return EXIT_FAILURE;
+    }
+    if ((from_stdin || g_follow || compressed) && (g_use_split || g_use_mmap)) {
+        fprintf(stderr, "Error: stdin, --follow and compressed files are read as a stream and cannot be combined with --split or --mmap.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_use_aio && (from_stdin || g_follow || compressed || g_use_mmap || g_use_split || g_multi_file || g_use_index)) {
+        fprintf(stderr, "Error: --aio and --direct have the manager read one plain log file in blocks, so they cannot be"
+                        " combined with stdin, --follow, compressed input, --mmap, --split, --index or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_num_readers > 0 && (from_stdin || g_follow || compressed || g_use_mmap || g_use_split || g_multi_file
+                              || g_use_index || g_use_aio || g_use_steal || g_print || g_rate_limit > 0)) {
+        fprintf(stderr, "Error: --readers splits one plain log file among reader threads feeding the shared buffer, so it"
+                        " cannot be combined with stdin, --follow, compressed input, --mmap, --split, --index, --aio,"
+                        " --steal, --print, --rate-limit or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_time_range && (from_stdin || g_follow || compressed)) {
+        fprintf(stderr, "Error: --since/--until binary-search the log file, so they cannot be combined with stdin, --follow or compressed input.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_follow && compressed) {
+        fprintf(stderr, "Error: --follow cannot tail a compressed file.\n");
+        return EXIT_FAILURE;
+    }
+    if (from_stdin && g_follow) {
+        fprintf(stderr, "Error: --follow needs a log file path, not stdin.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_print && (g_use_split || g_multi_file || g_use_index)) {
+        fprintf(stderr, "Error: --print needs the manager to read the input, so it cannot be combined with --split, --index or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_shard_count > 0 && (from_stdin || g_follow || compressed || g_multi_file || g_use_index || g_print || g_coordinate_hosts)) {
+        fprintf(stderr, "Error: --shard scans a byte range of one plain log file, so it cannot be combined with stdin,"
+                        " --follow, compressed input, --index, --print, --coordinate or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_coordinate_hosts && (from_stdin || g_follow || g_multi_file || g_use_index || g_print
+                               || g_interval_seconds > 0 || g_report_stats)) {
+        fprintf(stderr, "Error: --coordinate splits one log file into byte ranges and merges their counts, so it cannot be"
+                        " combined with stdin, --follow, --index, --print, --interval, --stats or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if (!g_coordinate_hosts && (g_num_dist_shards > 0 || g_shard_timeout_s > 0)) {
+        fprintf(stderr, "Error: --shards and --shard-timeout need --coordinate.\n");
+        return EXIT_FAILURE;
+    }
+    // With --print stdout carries only the lines, and with --shard the result for the coordinator
+    g_report_out = g_print || g_shard_count > 0 ? stderr : stdout;
+    if (g_exists_mode) {
+        g_max_count = 1; // The first match answers the question
+    }
+    if (g_follow && g_interval_seconds <= 0) {
+        g_interval_seconds = FOLLOW_DEFAULT_INTERVAL;
+    }
+    if (g_adaptive && (g_use_split || g_use_steal || g_multi_file || g_use_index)) {
+        fprintf(stderr, "Error: --adaptive sizes the pool of workers fed through the shared buffer, so it cannot be"
+                        " combined with --split, --steal, --index or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if ((g_auto_size || g_byte_budget > 0) && (g_use_lockfree || g_use_steal || g_use_split || g_multi_file || g_use_index)) {
+        fprintf(stderr, "Error: --auto-size and --memory-budget size the mutex-based shared buffer, so they cannot be"
+                        " combined with --lockfree, --steal, --split, --index or multiple input files.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_auto_size && g_adaptive) {
+        fprintf(stderr, "Error: --auto-size and --adaptive would both react to the same queue pressure; use one of them.\n");
+        return EXIT_FAILURE;
+    }
+    if (g_auto_size) {
+        // <buffer_size> is where the capacity starts
+        buffer_capacity = buffer_capacity < g_auto_size_min ? g_auto_size_min
+                        : buffer_capacity > g_auto_size_max ? g_auto_size_max : buffer_capacity;
+        if (g_byte_budget == 0) {
+            g_byte_budget = AUTO_SIZE_DEFAULT_BUDGET;
+        }
+    }
+    if (g_use_steal && g_use_lockfree) {
+        fprintf(stderr, "Error: --steal uses its own per-worker queues and cannot be combined with --lockfree.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind + 3; i < argc; i++) {
+        if (!add_pattern(argv[i])) {
+            perror("Failed to store search terms");
+            free_patterns();
+            return EXIT_FAILURE;
+        }
+    }
+    if (patterns_file_path && !load_patterns_file(patterns_file_path)) {
+        free_patterns();
+        return EXIT_FAILURE;
+    }
+    if (g_num_patterns == 0 && g_filter.count == 0 && g_group_field < 0) {
+        fprintf(stderr, "Error: No search terms given.\n");
+        free_patterns();
+        return EXIT_FAILURE;
+    }
+    g_search_term = g_num_patterns > 0 ? g_patterns[0] : "";
+    if (g_use_regex) {
+        if (g_num_patterns != 1) {
+            fprintf(stderr, "Error: --regex takes exactly one pattern; use | to combine alternatives.\n");
+            free_patterns();
+            return EXIT_FAILURE;
+        }
+        char regex_error[128];
+        g_regex = regex_compile(g_search_term, g_nocase, regex_error, sizeof(regex_error));
+        if (!g_regex) {
+            fprintf(stderr, "Error: Invalid regex \"%s\": %s\n", g_search_term, regex_error);
+            free_patterns();
+            return EXIT_FAILURE;
+        }
+        // The search kernels look for the literal every match contains; the DFA only sees those lines
+        const char *literal = regex_required_literal(g_regex);
+        if (literal && g_nocase) {
+            search_init_nocase(literal);
+        } else {
+            search_init(literal ? literal : "");
+        }
+    } else if (g_nocase) {
+        search_init_nocase(g_search_term);
+    } else {
+        search_init(g_search_term);
+    }
+    line_split_init();
+    if (g_num_patterns > 1) {
+        g_automaton = ac_build(g_patterns, g_num_patterns, g_nocase); // One automaton answers every term in a single pass
+    }
+    // Setup SIGINT handler
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sigemptyset(&sa.sa_mask); // Do not block other signals during handler execution
+    sa.sa_flags = 0; // No SA_RESTART, so syscalls like getline are interrupted
+    if (sigaction(SIGINT, &sa, NULL) == -1) {
+        perror("sigaction failed");
+        return EXIT_FAILURE;
+    }
+
+    if (g_coordinate_hosts) {
+        // Then the positional arguments, after "--" so that no search term reads as an option
+        forwarded[num_forwarded++] = "--";
+        for (int i = optind; i < argc; i++) {
+            forwarded[num_forwarded++] = argv[i];
+        }
+        int status = run_coordinator(num_forwarded, forwarded);
+        ac_destroy(g_automaton);
+        regex_destroy(g_regex);
+        free_patterns();
+        filter_destroy(&g_filter);
+        return status;
+    }
+    if (g_multi_file || g_use_index) {
+        // After the terms are set up: with --index, which blocks are worth reading depends on them
+        bool inputs_ok = add_input_path(log_file_path);
+        for (int i = 0; inputs_ok && i < num_extra_inputs; i++) {
+            inputs_ok = add_input_path(extra_inputs[i]);
+        }
+        if (!inputs_ok || !build_file_work()) {
+            free_input_files();
+            filter_destroy(&g_filter);
+            ac_destroy(g_automaton);
+            regex_destroy(g_regex);
+            free_patterns();
+            return EXIT_FAILURE;
+        }
+    }
+    if (g_time_range) {
+        // Found before the workers start, so the manager (or the workers) read only this range
+        if (!g_multi_file && !g_use_index && !find_time_range(log_file_path, &g_range_start, &g_range_end)) {
+            ac_destroy(g_automaton);
+            regex_destroy(g_regex);
+            free_patterns();
+            return EXIT_FAILURE;
+        }
+        g_byte_range = !g_multi_file && !g_use_index;
+        fprintf(g_report_out, "Time range: scanning %llu of %llu bytes.\n",
+                (unsigned long long)s_range_bytes, (unsigned long long)s_range_total_bytes);
+    }
+    if (g_shard_count > 0 && !select_shard_range(log_file_path)) {
+        ac_destroy(g_automaton);
+        regex_destroy(g_regex);
+        free_patterns();
+        return EXIT_FAILURE;
+    }
+    if (g_shard_count > 0) {
+        signal(SIGPIPE, SIG_IGN); // A write to a closed connection fails with EPIPE instead
+        pthread_t watcher;
+        if (pthread_create(&watcher, NULL, watch_coordinator, NULL) == 0) {
+            pthread_detach(watcher);
+        }
+    }
+
+    if (g_use_split) {
+        // Workers pread the file themselves, so open it before they start
+        g_split_fd = open(log_file_path, O_RDONLY);
+        struct stat st;
+        if (g_split_fd == -1 || fstat(g_split_fd, &st) == -1) {
+            perror("open failed");
+            if (g_split_fd != -1) {
+                close(g_split_fd);
+            }
+            free_patterns();
+            return EXIT_FAILURE;
+        }
+        g_split_file_size = (size_t)st.st_size;
+        posix_fadvise(g_split_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (g_pin && !affinity_init(g_num_workers)) {
+        free_patterns();
+        return EXIT_FAILURE;
+    }
+    // With --pin on a multi-node host each node's workers get a queue of their own; the
+    // steal pool, --adaptive, --readers, --auto-size and the modes where workers read the input themselves only pin threads
+    int shards = g_pin && !g_use_steal && !g_use_split && !g_multi_file && !g_use_index && !g_adaptive && g_num_readers == 0
+                 && !g_auto_size ? affinity_num_shards() : 1;
+    if (shards > 1 && !(g_node_buffers = malloc(sizeof(Buffer) * (shards - 1)))) {
+        perror("malloc for per-node buffers failed");
+        free_patterns();
+        return EXIT_FAILURE;
+    }
+    g_num_shards = shards;
+    int shard_capacity = (buffer_capacity + g_num_shards - 1) / g_num_shards; // buffer_size is the total over all shards
+    for (int i = 0; i < g_num_shards; i++) {
+        if (g_use_lockfree) {
+            buffer_init_lockfree(shard_buffer(i), shard_capacity);
+        } else {
+            buffer_init(shard_buffer(i), shard_capacity);
+            if (g_byte_budget > 0) {
+                buffer_set_byte_budget(shard_buffer(i), (g_byte_budget + g_num_shards - 1) / g_num_shards); // Also a total
+            }
+        }
+        buffer_add_producers(shard_buffer(i), 1); // The manager, until the input is done (see below)
+    }
+    if (g_use_steal) {
+        pool_init(&g_steal_pool, g_num_workers, buffer_capacity); // Each worker's queue gets buffer_size slots
+    }
+    if (posix_memalign((void **)&worker_counters, CACHE_LINE_SIZE, sizeof(worker_counters_t) * g_num_workers) != 0) {
+        worker_counters = NULL;
+    } else {
+        memset(worker_counters, 0, sizeof(worker_counters_t) * g_num_workers);
+    }
+    g_pattern_totals = calloc(g_num_patterns, sizeof(int));
+    if (!worker_counters || !g_pattern_totals) {
+        perror("Allocation of worker counters failed");
+        free(worker_counters);
+        free(g_pattern_totals);
+        destroy_queues();
+        return EXIT_FAILURE;
+    }
+    if (g_group_field >= 0) {
+        g_group_tables = malloc(sizeof(GroupTable *) * g_num_workers);
+        if (!g_group_tables) {
+            perror("malloc for group-by tables failed");
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < g_num_workers; i++) {
+            g_group_tables[i] = group_table_create();
+        }
+    }
+    if (g_report_stats) {
+        g_worker_stats = calloc(g_num_workers, sizeof(worker_stats_t));
+        if (!g_worker_stats) {
+            perror("calloc for worker stats failed");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (g_print) {
+        // Room for everything the queues and the workers' batches can hold, so the window only
+        // holds the manager back when one slow slice keeps the lines after it from being written
+        size_t window = (size_t)(g_auto_size ? g_auto_size_max : buffer_capacity) * (g_use_steal ? g_num_workers : 1)
+                        + (size_t)(g_num_workers + 1) * g_batch_size;
+        g_output = ordered_output_create(STDOUT_FILENO, window, (uint64_t)g_max_count, stop_run);
+        if (!g_output) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    g_worker_threads = calloc(g_num_workers, sizeof(pthread_t));
+    g_worker_args = calloc(g_num_workers, sizeof(worker_args_t));
+    if (!g_worker_threads || !g_worker_args) {
+        perror("calloc for worker threads failed");
+        free(g_worker_threads);
+        free(g_worker_args);
+        free(worker_counters);
+        free(g_pattern_totals);
+        destroy_queues();
+        return EXIT_FAILURE;
+    }
+
+#ifdef LOG_INSTRUMENT
+    // Block SIGUSR1 before any thread exists, so only the dumper thread ever receives it
+    sigset_t dump_signals;
+    sigemptyset(&dump_signals);
+    sigaddset(&dump_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &dump_signals, NULL);
+    pthread_t dumper_thread;
+    bool dumper_started = pthread_create(&dumper_thread, NULL, instrument_dumper, &dump_signals) == 0;
+    if (!dumper_started) {
+        perror("pthread_create for instrumentation dumper failed"); // Still dumped at exit
+    }
+#endif
+
+    uint64_t run_start_ns = stats_now_ns();
+    if (g_interval_seconds > 0) {
+        interval_report_start();
+    }
+    // --adaptive starts small and lets the manager start the rest as the queue fills up
+    int initial_workers = g_adaptive ? ADAPTIVE_MIN_WORKERS : g_num_workers;
+    while (g_num_started < initial_workers) {
+        if (!start_worker()) {
+            sigint_received_flag = 1; // Signal a general shutdown
+            signal_shutdown(); // Tell buffer system is shutting down
+            // Join already created threads
+            for (int k = 0; k < g_num_started; k++) {
+                pthread_join(g_worker_threads[k], NULL);
+            }
+            interval_report_stop();
+            free(g_worker_threads);
+            free(g_worker_args);
+            cleanup_resources(NULL); // Call with NULL as threads array is locally managed here
+            return EXIT_FAILURE;
+        }
+    }
+    if (g_adaptive) {
+        adaptive_start(shard_capacity);
+    }
+    if (g_auto_size) {
+        auto_size_start(shard_capacity);
+    }
+
+    // Pinned only now, since threads inherit their creator's affinity. Compressed input is not
+    // pinned: the zstd decoder threads the manager starts would all end up on its CPU.
+    if (g_pin && !compressed && !affinity_pin_manager()) {
+        fprintf(stderr, "Manager could not be pinned to its CPU.\n");
+    }
+
+    // Manager (main thread) logic: read file and push lines to buffer.
+    // With --split, --index or multiple input files the workers read the input themselves and the
+    // manager only waits for them.
+    bool workers_read_input = g_use_split || g_multi_file || g_use_index;
+    if (g_rate_limit > 0) {
+        rate_limit_init();
+    }
+    char *file_map = NULL;
+    size_t file_map_size = 0;
+    LineSlice *manager_batch = workers_read_input ? NULL : malloc(sizeof(LineSlice) * g_batch_size);
+    if (workers_read_input) {
+        // Nothing to feed
+    } else if (!manager_batch) {
+        perror("malloc for manager batch failed");
+        sigint_received_flag = 1;
+        signal_shutdown();
+    } else if (g_use_mmap) {
+        feed_chunks_from_mmap(log_file_path, &file_map, &file_map_size, manager_batch);
+    } else if (from_stdin || g_follow || compressed || g_use_aio) {
+        feed_blocks_from_fd(log_file_path, manager_batch);
+    } else if (g_num_readers > 0) {
+        feed_lines_from_readers(log_file_path, g_num_readers);
+    } else {
+        feed_lines_from_stream(log_file_path, manager_batch);
+    }
+    free(manager_batch);
+
+    // If SIGINT occurred, ensure buffer is fully in shutdown mode
+    if (sigint_received_flag) {
+        signal_shutdown();
+    }
+
+    // The manager is done producing. Once every producer (the --readers threads too) is done,
+    // each worker popping from a shard gets an EOF marker after the last line, which signals
+    // normal completion. If shutting_down, workers will get NULL from pop anyway.
+    // With --steal, closing the pool plays that role instead.
+    if (g_use_steal) {
+        pool_close(&g_steal_pool);
+    }
+    if (g_adaptive) {
+        adaptive_stop(); // No more parking; parked workers resume to pop their markers
+    }
+    if (g_auto_size) {
+        auto_size_stop();
+    }
+    for (int shard = 0; shard < g_num_shards; shard++) {
+        buffer_producer_done(shard_buffer(shard));
+    }
+
+    reduce_release(); // No more workers can start; the last one to finish prints the summary
+
+    // Wait for all worker threads to complete
+    for (int i = 0; i < g_num_started; i++) {
+        pthread_join(g_worker_threads[i], NULL);
+    }
+    interval_report_stop();
+    free(g_worker_threads);
+    g_worker_threads = NULL;
+    free(g_worker_args);
+    g_worker_args = NULL;
+    if (g_output) {
+        if (sigint_received_flag) {
+            ordered_output_stop(g_output); // Some slices were dropped; their results never arrive
+        }
+        ordered_output_finish(g_output, g_next_seq); // Everything else has been submitted by now
+        g_output = NULL;
+    }
+    if (file_map) {
+        munmap(file_map, file_map_size); // Workers are done with their slices
+    }
+    if (g_split_fd != -1) {
+        close(g_split_fd);
+        g_split_fd = -1;
+    }
+
+#ifdef LOG_INSTRUMENT
+    if (dumper_started) {
+        s_dumper_done = true;
+        pthread_kill(dumper_thread, SIGUSR1);
+        pthread_join(dumper_thread, NULL);
+    }
+    dump_instrumentation();
+#endif
+
+    if (g_worker_stats) {
+        print_run_stats(stats_now_ns() - run_start_ns);
+        free(g_worker_stats);
+        g_worker_stats = NULL;
+    }
+
+    // printf("Manager thread finished processing and joining workers.\n"); // Debug
+
+    // Cleanup all global resources
+    // buffer_destroy, free worker_counters
     // Note: cleanup_resources expects threads array to be passed, but we free it above.
     // For this structure, it's better to call components of cleanup directly.
-    buffer_destroy(&shared_buffer);
-    pthread_barrier_destroy(&barrier);
-    if (worker_match_counts) {
-        free(worker_match_counts);
-        worker_match_counts = NULL;
+    destroy_queues();
+    free(worker_counters);
+    worker_counters = NULL;
+    free(g_pattern_totals);
+    g_pattern_totals = NULL;
+    ac_destroy(g_automaton);
+    g_automaton = NULL;
+    regex_destroy(g_regex);
+    g_regex = NULL;
+    free_patterns();
+    filter_destroy(&g_filter);
+    free_input_files();
+    affinity_destroy();
+    for (int i = 0; g_group_tables && i < g_num_workers; i++) {
+        group_table_destroy(g_group_tables[i]);
     }
+    free(g_group_tables);
+    g_group_tables = NULL;
     
     // printf("All resources cleaned up.\n"); // Debug
+    if (g_exists_mode && g_total_matches_summary == 0) {
+        return EXIT_FAILURE; // Like grep -q: a non-zero status means nothing matched
+    }
     return EXIT_SUCCESS;
 }
\ No newline at end of file
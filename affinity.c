@@ -0,0 +1,140 @@
+#define _GNU_SOURCE // For CPU_SET, sched_getaffinity and pthread_setaffinity_np
+#include "affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+
+static int *s_cpus;        // Allowed CPUs grouped by shard: shard s owns s_cpus[s_shard_first[s]] .. s_cpus[s_shard_first[s + 1] - 1]
+static int *s_shard_first; // s_num_shards + 1 entries
+static int *s_shard_node;  // NUMA node of each shard, -1 without libnuma
+static int s_num_shards = 1;
+static int s_num_workers = 0;
+
+// NUMA node of a CPU; every CPU is on node -1 without libnuma
+static int node_of_cpu(int cpu) {
+#ifdef HAVE_NUMA
+    if (numa_available() != -1) {
+        return numa_node_of_cpu(cpu);
+    }
+#endif
+    (void)cpu;
+    return -1;
+}
+
+bool affinity_init(int num_workers) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("sched_getaffinity failed");
+        return false;
+    }
+    int num_cpus = CPU_COUNT(&allowed);
+    int *cpus = malloc(sizeof(int) * num_cpus);
+    int *nodes = malloc(sizeof(int) * num_cpus);
+    s_cpus = malloc(sizeof(int) * num_cpus);
+    s_shard_first = malloc(sizeof(int) * (num_cpus + 1)); // At most one shard per CPU
+    s_shard_node = malloc(sizeof(int) * num_cpus);
+    if (!cpus || !nodes || !s_cpus || !s_shard_first || !s_shard_node) {
+        perror("Failed to allocate CPU placement");
+        free(cpus);
+        free(nodes);
+        affinity_destroy();
+        return false;
+    }
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < num_cpus; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[n] = cpu;
+            nodes[n] = node_of_cpu(cpu);
+            n++;
+        }
+    }
+
+    // One shard per node that has allowed CPUs, in node order, but no more shards than workers
+    // (a shard without workers would leave its queue undrained)
+    s_num_shards = 0;
+    int used = 0;
+    while (used < n && s_num_shards < num_workers) {
+        int node = -2;
+        for (int i = 0; i < n; i++) { // Lowest node not taken yet
+            if (nodes[i] != -2 && (node == -2 || nodes[i] < node)) {
+                node = nodes[i];
+            }
+        }
+        s_shard_first[s_num_shards] = used;
+        s_shard_node[s_num_shards] = node;
+        for (int i = 0; i < n; i++) {
+            if (nodes[i] == node && nodes[i] != -2) {
+                s_cpus[used++] = cpus[i];
+                nodes[i] = -2; // Taken
+            }
+        }
+        s_num_shards++;
+    }
+    if (s_num_shards == 0) {
+        s_num_shards = 1; // No workers: keep the single shard the callers expect
+        s_shard_node[0] = -1;
+        s_shard_first[0] = 0;
+    }
+    s_shard_first[s_num_shards] = used;
+    s_num_workers = num_workers;
+    free(cpus);
+    free(nodes);
+    return true;
+}
+
+int affinity_num_shards(void) {
+    return s_num_shards;
+}
+
+int affinity_shard_node(int shard) {
+    return s_shard_node ? s_shard_node[shard] : -1;
+}
+
+int affinity_worker_shard(int worker_id) {
+    return worker_id % s_num_shards;
+}
+
+int affinity_shard_workers(int shard) {
+    return s_num_workers / s_num_shards + (shard < s_num_workers % s_num_shards ? 1 : 0);
+}
+
+static bool pin_to(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool affinity_pin_worker(int worker_id) {
+    int shard = affinity_worker_shard(worker_id);
+    int first = s_shard_first[shard];
+    int count = s_shard_first[shard + 1] - first;
+    if (count == 0) {
+        return false;
+    }
+    // Leave the manager's CPU to it if the first node has one to spare
+    int skip = shard == 0 && count > affinity_shard_workers(0) ? 1 : 0;
+    return pin_to(s_cpus[first + (skip + worker_id / s_num_shards) % count]);
+}
+
+bool affinity_pin_manager(void) {
+    if (s_shard_first[1] == 0) {
+        return false; // No CPUs recorded
+    }
+    return pin_to(s_cpus[0]);
+}
+
+void affinity_destroy(void) {
+    free(s_cpus);
+    free(s_shard_first);
+    free(s_shard_node);
+    s_cpus = NULL;
+    s_shard_first = NULL;
+    s_shard_node = NULL;
+    s_num_shards = 1;
+}
@@ -0,0 +1,59 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdbool.h>
+
+/*
+ * Thread placement for --pin. The CPUs this process may run on are grouped by NUMA node
+ * (through libnuma when built with make NUMA=1; otherwise all CPUs count as one node), and
+ * workers are spread over the nodes round-robin: worker i belongs to shard i % affinity_num_shards()
+ * and is pinned to a CPU of that shard's node. The manager gets the first CPU of the first node,
+ * which workers only share when there are not enough CPUs to go round.
+ */
+
+/**
+ * @brief Discovers the CPUs and nodes available and plans the placement of num_workers workers.
+ *        Call once from the main thread before any worker starts.
+ * @return false if the process's CPU set could not be read (reported with perror).
+ */
+bool affinity_init(int num_workers);
+
+/**
+ * @brief Returns the number of shards, i.e. the NUMA nodes in use: at most one per worker.
+ *        1 on a single-node host or without libnuma.
+ */
+int affinity_num_shards(void);
+
+/**
+ * @brief Returns the NUMA node id of a shard, for memory placement; -1 without libnuma.
+ */
+int affinity_shard_node(int shard);
+
+/**
+ * @brief Returns the shard a worker belongs to.
+ */
+int affinity_worker_shard(int worker_id);
+
+/**
+ * @brief Returns the number of workers in a shard.
+ */
+int affinity_shard_workers(int shard);
+
+/**
+ * @brief Pins the calling thread to the CPU planned for a worker.
+ * @return false if the kernel refused (the thread keeps running unpinned).
+ */
+bool affinity_pin_worker(int worker_id);
+
+/**
+ * @brief Pins the calling thread to the manager's CPU.
+ * @return false if the kernel refused (the thread keeps running unpinned).
+ */
+bool affinity_pin_manager(void);
+
+/**
+ * @brief Releases what affinity_init allocated.
+ */
+void affinity_destroy(void);
+
+#endif // AFFINITY_H
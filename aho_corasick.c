@@ -0,0 +1,212 @@
+#include "aho_corasick.h"
+#include "search.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#define AC_ALPHABET 256
+#define AC_ROOT 0
+
+/*
+ * The automaton is stored as a dense DFA: after construction every state has a transition
+ * for every byte, so the scan loop is a single table lookup per byte with no failure-link
+ * walking. States where patterns end keep the ids of those patterns in a chain threaded
+ * through pattern_next; output_link points at the nearest state on the failure path that
+ * also ends a pattern, so all patterns ending at a position can be listed quickly.
+ * '\n' always leads back to the root, so matches can never span two lines.
+ */
+// Per-thread state that lets a line be counted only once per pattern
+struct AcScratch {
+    unsigned long *last_line; // Per pattern: stamp of the last line counted for it
+    unsigned long line;       // Stamp of the line being scanned
+};
+
+struct AcAutomaton {
+    int num_states;
+    int num_patterns;
+    int *delta;            // num_states * AC_ALPHABET transitions
+    int *first_pattern;    // Per state: first pattern ending exactly here, or -1
+    int *output_link;      // Per state: nearest proper suffix state that ends a pattern, or -1
+    int *pattern_next;     // Per pattern: next pattern ending at the same state, or -1
+    int *empty_patterns;   // Ids of empty patterns, which match every line
+    int num_empty_patterns;
+};
+
+static void *ac_alloc(size_t size) {
+    void *p = malloc(size > 0 ? size : 1);
+    if (!p) {
+        perror("Failed to allocate Aho-Corasick automaton");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+AcAutomaton *ac_build(char **patterns, int num_patterns, bool nocase) {
+    AcAutomaton *ac = ac_alloc(sizeof(AcAutomaton));
+
+    // The trie has at most one state per pattern byte plus the root
+    size_t max_states = 1;
+    for (int i = 0; i < num_patterns; i++) {
+        max_states += strlen(patterns[i]);
+    }
+    ac->delta = ac_alloc(sizeof(int) * AC_ALPHABET * max_states);
+    ac->first_pattern = ac_alloc(sizeof(int) * max_states);
+    ac->output_link = ac_alloc(sizeof(int) * max_states);
+    ac->pattern_next = ac_alloc(sizeof(int) * num_patterns);
+    ac->empty_patterns = ac_alloc(sizeof(int) * num_patterns);
+    ac->num_patterns = num_patterns;
+    ac->num_empty_patterns = 0;
+    ac->num_states = 1;
+    memset(ac->delta, -1, sizeof(int) * AC_ALPHABET);
+    ac->first_pattern[AC_ROOT] = -1;
+
+    // Phase 1: insert the patterns into a trie (-1 = no edge yet)
+    for (int i = 0; i < num_patterns; i++) {
+        const unsigned char *p = (const unsigned char *)patterns[i];
+        ac->pattern_next[i] = -1;
+        if (*p == '\0') {
+            ac->empty_patterns[ac->num_empty_patterns++] = i;
+            continue;
+        }
+        if (strchr(patterns[i], '\n') != NULL) {
+            continue; // Lines never contain '\n'; this pattern can never match
+        }
+        int state = AC_ROOT;
+        for (; *p; p++) {
+            int *edge = &ac->delta[state * AC_ALPHABET + (nocase ? tolower(*p) : *p)];
+            if (*edge == -1) {
+                int next = ac->num_states++;
+                memset(&ac->delta[next * AC_ALPHABET], -1, sizeof(int) * AC_ALPHABET);
+                ac->first_pattern[next] = -1;
+                *edge = next;
+            }
+            state = *edge;
+        }
+        ac->pattern_next[i] = ac->first_pattern[state];
+        ac->first_pattern[state] = i;
+    }
+
+    // Phase 2: breadth-first search computing failure links and filling in missing edges
+    int *fail = ac_alloc(sizeof(int) * ac->num_states);
+    int *queue = ac_alloc(sizeof(int) * ac->num_states);
+    int queue_head = 0, queue_tail = 0;
+
+    fail[AC_ROOT] = AC_ROOT;
+    ac->output_link[AC_ROOT] = -1;
+    for (int c = 0; c < AC_ALPHABET; c++) {
+        int *edge = &ac->delta[AC_ROOT * AC_ALPHABET + c];
+        if (*edge == -1 || c == '\n') {
+            *edge = AC_ROOT;
+        } else {
+            fail[*edge] = AC_ROOT;
+            ac->output_link[*edge] = -1;
+            queue[queue_tail++] = *edge;
+        }
+    }
+    while (queue_head < queue_tail) {
+        int state = queue[queue_head++];
+        for (int c = 0; c < AC_ALPHABET; c++) {
+            int *edge = &ac->delta[state * AC_ALPHABET + c];
+            int via_fail = ac->delta[fail[state] * AC_ALPHABET + c];
+            if (c == '\n') {
+                *edge = AC_ROOT;
+            } else if (*edge == -1) {
+                *edge = via_fail;
+            } else {
+                int child = *edge;
+                fail[child] = via_fail;
+                ac->output_link[child] = ac->first_pattern[via_fail] != -1 ? via_fail : ac->output_link[via_fail];
+                queue[queue_tail++] = child;
+            }
+        }
+    }
+    free(queue);
+    free(fail);
+
+    // Caseless: the trie only holds lower case, so upper case letters take the same edges
+    for (int state = 0; nocase && state < ac->num_states; state++) {
+        int *row = &ac->delta[state * AC_ALPHABET];
+        for (int c = 'A'; c <= 'Z'; c++) {
+            row[c] = row[tolower(c)];
+        }
+    }
+    return ac;
+}
+
+void ac_destroy(AcAutomaton *ac) {
+    if (!ac) {
+        return;
+    }
+    free(ac->delta);
+    free(ac->first_pattern);
+    free(ac->output_link);
+    free(ac->pattern_next);
+    free(ac->empty_patterns);
+    free(ac);
+}
+
+AcScratch *ac_scratch_create(const AcAutomaton *ac) {
+    AcScratch *scratch = ac_alloc(sizeof(AcScratch));
+    scratch->last_line = calloc(ac->num_patterns > 0 ? ac->num_patterns : 1, sizeof(unsigned long));
+    if (!scratch->last_line) {
+        perror("Failed to allocate Aho-Corasick scratch");
+        exit(EXIT_FAILURE);
+    }
+    scratch->line = 0;
+    return scratch;
+}
+
+void ac_scratch_destroy(AcScratch *scratch) {
+    if (scratch) {
+        free(scratch->last_line);
+        free(scratch);
+    }
+}
+
+int ac_count_matching_lines(const AcAutomaton *ac, const char *data, size_t length,
+                            int *pattern_counts, AcScratch *scratch) {
+    // Empty patterns match every line, which also makes every line a match
+    if (ac->num_empty_patterns > 0) {
+        int lines = search_count_lines(data, length);
+        for (int i = 0; i < ac->num_empty_patterns; i++) {
+            pattern_counts[ac->empty_patterns[i]] += lines;
+        }
+    }
+
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + length;
+    unsigned long line = ++scratch->line; // Every line scanned by this thread gets a fresh stamp
+    int matching_lines = 0;
+    bool line_matched = false;
+    int state = AC_ROOT;
+
+    for (; p < end; p++) {
+        if (*p == '\n') {
+            line = ++scratch->line;
+            line_matched = false;
+            state = AC_ROOT;
+            continue;
+        }
+        state = ac->delta[state * AC_ALPHABET + *p];
+        int out = ac->first_pattern[state] != -1 ? state : ac->output_link[state];
+        for (; out != -1; out = ac->output_link[out]) {
+            for (int id = ac->first_pattern[out]; id != -1; id = ac->pattern_next[id]) {
+                if (scratch->last_line[id] != line) {
+                    scratch->last_line[id] = line; // Count each pattern at most once per line
+                    pattern_counts[id]++;
+                    if (!line_matched) {
+                        line_matched = true;
+                        matching_lines++;
+                    }
+                }
+            }
+        }
+    }
+
+    if (ac->num_empty_patterns > 0) {
+        return search_count_lines(data, length);
+    }
+    return matching_lines;
+}
@@ -0,0 +1,53 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Aho-Corasick automaton for multi-pattern search. It is built once by the main thread
+ * and then shared read-only by all workers, so one pass over a slice answers every pattern.
+ */
+typedef struct AcAutomaton AcAutomaton;
+typedef struct AcScratch AcScratch;
+
+/**
+ * @brief Builds an automaton for a list of patterns. Exits on allocation failure, like buffer_init.
+ * @param patterns The NUL-terminated patterns. Duplicates are allowed and counted separately.
+ * @param num_patterns Number of patterns.
+ * @param nocase Match the patterns ignoring ASCII case (-i).
+ * @return The automaton; release it with ac_destroy.
+ */
+AcAutomaton *ac_build(char **patterns, int num_patterns, bool nocase);
+
+/**
+ * @brief Frees an automaton built by ac_build.
+ */
+void ac_destroy(AcAutomaton *ac);
+
+/**
+ * @brief Creates the per-thread scratch state used by ac_count_matching_lines.
+ *        Each worker needs its own; it must not be shared between threads.
+ */
+AcScratch *ac_scratch_create(const AcAutomaton *ac);
+
+/**
+ * @brief Frees scratch state created by ac_scratch_create.
+ */
+void ac_scratch_destroy(AcScratch *scratch);
+
+/**
+ * @brief Counts, for a slice of lines, how many lines contain each pattern.
+ *        Uses the same line conventions as search_count_matching_lines, and a pattern
+ *        matches a line exactly when strstr(line, pattern) would.
+ * @param ac The automaton.
+ * @param data Start of the slice. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the slice.
+ * @param pattern_counts Per-pattern line counts; each matching line adds 1 to its patterns' entries.
+ * @param scratch The calling thread's scratch state.
+ * @return The number of lines that contain at least one pattern.
+ */
+int ac_count_matching_lines(const AcAutomaton *ac, const char *data, size_t length,
+                            int *pattern_counts, AcScratch *scratch);
+
+#endif // AHO_CORASICK_H
@@ -0,0 +1,367 @@
+#define _GNU_SOURCE // For O_DIRECT and posix_fadvise
+#include "async_read.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define ASYNC_ALIGN 4096 // O_DIRECT alignment of offsets, lengths and buffers; covers 512-byte sectors too
+
+// One block of the file, read into a buffer of its own
+typedef struct {
+    char *data;       // ASYNC_READ_BLOCK_SIZE bytes, ASYNC_ALIGN-aligned
+    off_t offset;     // File offset of data[0]
+    size_t length;    // Bytes asked for
+    size_t filled;    // Bytes read so far
+    bool in_flight;   // A read into the block is submitted and has not completed
+    bool done;        // filled is final: the block is full, or the range or the file ended in it
+    struct iovec iov; // The part still to read, for IORING_OP_READV
+} AsyncBlock;
+
+// The parts of an io_uring the reader uses, mapped from the kernel
+typedef struct {
+    int fd;             // -1 without a ring
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;       // The same mapping as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail; // Next submission entry to fill; published through sq_tail
+} Ring;
+
+struct AsyncReader {
+    int fd;
+    bool direct;        // fd is open with O_DIRECT
+    bool uring;         // Reads go through ring; otherwise through pread
+    bool closing;       // Completions are only collected, not continued
+    Ring ring;
+    off_t end;          // Reading stops here
+    off_t next_offset;  // Where the next block to start begins
+    AsyncBlock blocks[ASYNC_READ_DEPTH]; // Used as a ring, in file order from head
+    int head;
+    int queued;         // Blocks from head on that were started and not yet copied out
+    size_t consumed;    // Bytes of blocks[head] already copied out
+    int in_flight;      // Reads submitted to the ring and not completed
+};
+
+static void ring_destroy(Ring *ring) {
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd != -1) {
+        close(ring->fd);
+    }
+    ring->fd = -1;
+    ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+}
+
+// Sets up an io_uring with room for entries submissions. Returns false, with nothing to clean
+// up, if the kernel has no io_uring or it is disabled (sysctl, seccomp); the caller falls back.
+static bool ring_setup(Ring *ring, unsigned entries) {
+    ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return false;
+    }
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map && ring->cq_map_size > ring->sq_map_size) {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single_map ? ring->sq_map
+                              : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        ring_destroy(ring);
+        return false;
+    }
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+    return true;
+}
+
+// Queues a read of the rest of a block; ring_enter submits it. There is always a free
+// submission entry: the ring has one per block and a block has at most one read in flight.
+static void ring_queue_read(Ring *ring, int fd, AsyncBlock *block, int slot) {
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    block->iov.iov_base = block->data + block->filled;
+    block->iov.iov_len = block->length - block->filled;
+    sqe->opcode = IORING_OP_READV; // Rather than IORING_OP_READ, which needs Linux 5.6
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&block->iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t)(block->offset + (off_t)block->filled);
+    sqe->user_data = (uint64_t)slot;
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+// Submits every queued read and, with wait, waits for at least one completion. Entries the
+// kernel did not take (after EINTR, say) are submitted by the next call.
+static int ring_enter(Ring *ring, bool wait) {
+    unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void start_read(AsyncReader *reader, int slot) {
+    reader->blocks[slot].in_flight = true;
+    reader->in_flight++;
+    ring_queue_read(&reader->ring, reader->fd, &reader->blocks[slot], slot);
+}
+
+// Accounts for n more bytes read into a block: it is done once full, or once the range or
+// the file (n == 0) ends in it
+static void block_read(AsyncReader *reader, AsyncBlock *block, size_t n) {
+    block->filled += n;
+    block->done = n == 0 || block->filled == block->length || block->offset + (off_t)block->filled >= reader->end;
+}
+
+// Applies one completion to its block. Returns false on a read error (reported).
+static bool complete(AsyncReader *reader, int slot, int res) {
+    AsyncBlock *block = &reader->blocks[slot];
+    block->in_flight = false;
+    reader->in_flight--;
+    if (reader->closing) {
+        return true;
+    }
+    if (res == -EINTR || res == -EAGAIN) {
+        start_read(reader, slot); // Retried as is
+        return true;
+    }
+    if (res < 0) {
+        errno = -res;
+        perror("io_uring read failed");
+        return false;
+    }
+    block_read(reader, block, (size_t)res);
+    if (!block->done) {
+        start_read(reader, slot); // Short read: ask for the rest
+    }
+    return true;
+}
+
+// Collects every completion posted so far. Returns false if a read failed.
+static bool reap(AsyncReader *reader) {
+    Ring *ring = &reader->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    bool ok = true;
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        ok = complete(reader, (int)cqe->user_data, cqe->res) && ok;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return ok;
+}
+
+// Starts the blocks that fit in the window: submitting their reads, or, without a ring,
+// asking the kernel to read them ahead. Returns false on error (reported).
+static bool start_blocks(AsyncReader *reader) {
+    bool submitted = false;
+    while (reader->queued < ASYNC_READ_DEPTH && reader->next_offset < reader->end) {
+        int slot = (reader->head + reader->queued) % ASYNC_READ_DEPTH;
+        AsyncBlock *block = &reader->blocks[slot];
+        off_t left = reader->end - reader->next_offset;
+        block->offset = reader->next_offset;
+        block->length = left < ASYNC_READ_BLOCK_SIZE ? (size_t)left : ASYNC_READ_BLOCK_SIZE;
+        if (reader->direct) {
+            block->length = (block->length + ASYNC_ALIGN - 1) / ASYNC_ALIGN * ASYNC_ALIGN;
+        }
+        block->filled = 0;
+        block->done = false;
+        reader->next_offset += (off_t)block->length;
+        reader->queued++;
+        if (reader->uring) {
+            start_read(reader, slot);
+            submitted = true;
+        } else if (!reader->direct) {
+            posix_fadvise(reader->fd, block->offset, (off_t)block->length, POSIX_FADV_WILLNEED);
+        }
+    }
+    if (submitted && ring_enter(&reader->ring, false) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter failed");
+        return false;
+    }
+    return true;
+}
+
+// Waits until the head block is done: for its completion, or by reading it with pread.
+// Returns false on error (reported), or with errno EINTR if a signal came first.
+static bool wait_block(AsyncReader *reader, AsyncBlock *block) {
+    if (reader->uring) {
+        if (ring_enter(&reader->ring, true) == -1) {
+            if (errno == EINTR) {
+                return false;
+            }
+            perror("io_uring_enter failed");
+            return false;
+        }
+        return reap(reader);
+    }
+    while (!block->done) {
+        ssize_t n = pread(reader->fd, block->data + block->filled, block->length - block->filled,
+                          block->offset + (off_t)block->filled);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("pread failed");
+            }
+            return false;
+        }
+        block_read(reader, block, (size_t)n);
+    }
+    return true;
+}
+
+AsyncReader *async_reader_open(const char *path, off_t start, off_t end, bool direct) {
+    AsyncReader *reader = calloc(1, sizeof(AsyncReader));
+    if (!reader) {
+        perror("calloc for async reader failed");
+        return NULL;
+    }
+    reader->ring.fd = -1;
+    reader->ring.sq_map = reader->ring.cq_map = reader->ring.sqes = MAP_FAILED;
+    reader->fd = direct ? open(path, O_RDONLY | O_DIRECT) : -1;
+    reader->direct = reader->fd != -1;
+    if (reader->fd == -1) {
+        reader->fd = open(path, O_RDONLY); // Also when the filesystem refuses O_DIRECT (EINVAL)
+    }
+    struct stat st;
+    if (reader->fd == -1 || fstat(reader->fd, &st) == -1) {
+        perror("open failed");
+        async_reader_close(reader);
+        return NULL;
+    }
+    reader->end = end < 0 || end > st.st_size ? st.st_size : end;
+    off_t aligned_start = reader->direct ? start - start % ASYNC_ALIGN : start;
+    reader->next_offset = aligned_start;
+    reader->consumed = (size_t)(start - aligned_start); // Skipped in the first block
+    for (int i = 0; i < ASYNC_READ_DEPTH; i++) {
+        if (posix_memalign((void **)&reader->blocks[i].data, ASYNC_ALIGN, ASYNC_READ_BLOCK_SIZE) != 0) {
+            reader->blocks[i].data = NULL;
+            perror("posix_memalign for async read blocks failed");
+            async_reader_close(reader);
+            return NULL;
+        }
+    }
+    reader->uring = ring_setup(&reader->ring, ASYNC_READ_DEPTH);
+    if (!reader->uring && !reader->direct) {
+        posix_fadvise(reader->fd, start, reader->end - start, POSIX_FADV_SEQUENTIAL);
+    }
+    if (!start_blocks(reader)) {
+        async_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+ssize_t async_reader_read(AsyncReader *reader, char *buf, size_t length) {
+    size_t copied = 0;
+    while (copied < length) {
+        if (!start_blocks(reader)) {
+            return -1;
+        }
+        if (reader->queued == 0) {
+            break; // End of the range
+        }
+        AsyncBlock *block = &reader->blocks[reader->head];
+        if (!block->done) {
+            if (copied > 0) {
+                break; // Hand over what has been read rather than wait
+            }
+            if (!wait_block(reader, block)) {
+                return -1;
+            }
+            continue;
+        }
+        size_t usable = block->offset >= reader->end ? 0 : block->filled;
+        if (block->offset + (off_t)usable > reader->end) {
+            usable = (size_t)(reader->end - block->offset); // O_DIRECT reads past the range
+        }
+        if (reader->consumed < usable) {
+            size_t take = usable - reader->consumed < length - copied ? usable - reader->consumed : length - copied;
+            memcpy(buf + copied, block->data + reader->consumed, take);
+            copied += take;
+            reader->consumed += take;
+        }
+        if (reader->consumed >= usable) {
+            if (block->filled < block->length && block->offset + (off_t)block->filled < reader->end) {
+                reader->end = block->offset + (off_t)block->filled; // The file ended early
+            }
+            reader->head = (reader->head + 1) % ASYNC_READ_DEPTH;
+            reader->queued--;
+            reader->consumed = 0;
+        }
+    }
+    return (ssize_t)copied;
+}
+
+const char *async_reader_describe(const AsyncReader *reader) {
+    if (reader->uring) {
+        return reader->direct ? "io_uring, O_DIRECT" : "io_uring";
+    }
+    return reader->direct ? "pread, O_DIRECT" : "pread with readahead";
+}
+
+void async_reader_close(AsyncReader *reader) {
+    if (!reader) {
+        return;
+    }
+    reader->closing = true;
+    bool drained = true;
+    while (reader->uring && reader->in_flight > 0) { // The kernel may still write into the blocks
+        if (ring_enter(&reader->ring, true) == -1 && errno != EINTR) {
+            drained = false;
+            break;
+        }
+        reap(reader);
+    }
+    ring_destroy(&reader->ring);
+    for (int i = 0; drained && i < ASYNC_READ_DEPTH; i++) { // Left allocated if reads may be pending
+        free(reader->blocks[i].data);
+    }
+    if (reader->fd != -1) {
+        close(reader->fd);
+    }
+    free(reader);
+}
@@ -0,0 +1,54 @@
+#ifndef ASYNC_READ_H
+#define ASYNC_READ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Sequential reader for --aio that keeps up to ASYNC_READ_DEPTH reads of ASYNC_READ_BLOCK_SIZE
+ * bytes of a plain file in flight at once, so the disk sees real queue depth while the caller
+ * splits and hands out the blocks already read. Reads are submitted through io_uring (raw
+ * system calls, no liburing needed) when the kernel allows it. Otherwise each block is read
+ * with pread after posix_fadvise(WILLNEED) has asked the kernel to read the following blocks
+ * ahead, which overlaps the disk with the caller too, with less control over queue depth.
+ *
+ * With direct set the file is opened O_DIRECT, bypassing the page cache, and the blocks are
+ * aligned for it. Filesystems that refuse O_DIRECT (tmpfs, some FUSE) get buffered reads.
+ */
+typedef struct AsyncReader AsyncReader;
+
+#define ASYNC_READ_BLOCK_SIZE (1024 * 1024) // Bytes per read; also the O_DIRECT-aligned buffer size
+#define ASYNC_READ_DEPTH 8                  // Reads kept in flight
+
+/**
+ * @brief Opens a file and starts reading bytes [start, end) of it.
+ * @param path Path of the plain file.
+ * @param start First byte to read.
+ * @param end Byte to stop at, or -1 for the end of the file.
+ * @param direct Open with O_DIRECT if the filesystem supports it.
+ * @return The reader, or NULL on error (reported with perror).
+ */
+AsyncReader *async_reader_open(const char *path, off_t start, off_t end, bool direct);
+
+/**
+ * @brief Copies the next bytes of the file, like read(2). Blocks only while nothing at all
+ *        has been read yet; otherwise it returns what the completed reads hold, which may be
+ *        less than length.
+ * @return Number of bytes copied, 0 at the end, or -1 on error. Errors are reported, except
+ *         that -1 with errno EINTR means a signal arrived while waiting; it can be called again.
+ */
+ssize_t async_reader_read(AsyncReader *reader, char *buf, size_t length);
+
+/**
+ * @brief Describes how the reader reads, e.g. "io_uring, O_DIRECT", for the run's report.
+ */
+const char *async_reader_describe(const AsyncReader *reader);
+
+/**
+ * @brief Waits for the reads still in flight, then closes the file and frees the reader.
+ *        NULL is ignored.
+ */
+void async_reader_close(AsyncReader *reader);
+
+#endif // ASYNC_READ_H
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Synthetic Common Log Format generator for benchmarks, producing lines shaped like
+// logs/large.log. Timestamps increase monotonically, like a real access log.
+// Usage: ./gen_log <size_mb> <output_file> [seed]
+
+static uint64_t s_rng_state;
+
+static uint32_t next_random(void) {
+    // xorshift64*: fast, and reproducible for a given seed
+    s_rng_state ^= s_rng_state >> 12;
+    s_rng_state ^= s_rng_state << 25;
+    s_rng_state ^= s_rng_state >> 27;
+    return (uint32_t)((s_rng_state * 2685821657736338717ull) >> 32);
+}
+
+static const char *s_methods[] = { "GET", "GET", "GET", "GET", "POST", "PUT", "DELETE" };
+static const char *s_paths[] = {
+    "/index.html", "/images/logo.png", "/about.html", "/styles/main.css", "/favicon.ico",
+    "/api/submit", "/api/v1/users/findme", "/api/data/1", "/products/item123", "/search?q=test",
+    "/js/app.js", "/static/vendor.js", "/downloads/document.pdf", "/admin/login", "/robots.txt",
+    "/nonexistent_page.html", "/old_link.php", "/video/stream.m3u8", "/wp-admin/", "/contact",
+};
+static const char *s_months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// Roughly 80% 200, 10% 404, 1% 500, the rest spread over redirects and auth errors
+static int pick_status(void) {
+    uint32_t r = next_random() % 1000;
+    if (r < 800) return 200;
+    if (r < 900) return 404;
+    if (r < 910) return 500;
+    if (r < 940) return 301;
+    if (r < 960) return 201;
+    if (r < 980) return 401;
+    return 403;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: ./gen_log <size_mb> <output_file> [seed]\n");
+        return EXIT_FAILURE;
+    }
+    unsigned long long target = strtoull(argv[1], NULL, 10) * 1024ull * 1024ull;
+    s_rng_state = argc > 3 ? strtoull(argv[3], NULL, 10) : 42;
+    if (s_rng_state == 0) {
+        s_rng_state = 42; // xorshift must not start at 0
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        perror("fopen failed");
+        return EXIT_FAILURE;
+    }
+    static char out_buffer[1 << 20];
+    setvbuf(out, out_buffer, _IOFBF, sizeof(out_buffer));
+
+    time_t timestamp = 1683900000; // 12/May/2023:14:00:00 +0000
+    unsigned long long written = 0;
+    while (written < target) {
+        timestamp += next_random() % 3 == 0; // Several lines per second
+        struct tm tm;
+        gmtime_r(&timestamp, &tm);
+        int n = fprintf(out, "%u.%u.%u.%u - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"%s %s HTTP/1.1\" %d %u\n",
+                        next_random() % 2 ? 192u : 10u, next_random() % 256, next_random() % 16, 1 + next_random() % 254,
+                        tm.tm_mday, s_months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                        s_methods[next_random() % (sizeof(s_methods) / sizeof(s_methods[0]))],
+                        s_paths[next_random() % (sizeof(s_paths) / sizeof(s_paths[0]))],
+                        pick_status(), 50 + next_random() % 200000);
+        if (n < 0) {
+            perror("write failed");
+            fclose(out);
+            return EXIT_FAILURE;
+        }
+        written += (unsigned long long)n;
+    }
+    if (fclose(out) != 0) {
+        perror("fclose failed");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Benchmark driver for LogAnalyzer. Generates a synthetic access log, then sweeps
+# buffer size x worker count x search term selectivity and prints one CSV row per run.
+#
+# Configuration (environment variables):
+#   BENCH_SIZE_MB   size of the generated log              (default 256)
+#   BENCH_BUFFERS   buffer sizes to sweep                  (default "16 256 4096")
+#   BENCH_WORKERS   worker counts to sweep                 (default "1 2 4 8")
+#   BENCH_FLAGS     extra LogAnalyzer options, e.g. --mmap (default none)
+#   BENCH_LOG       path of the generated log              (default /tmp/loganalyzer_bench.log)
+set -e
+
+BIN=${BIN:-./LogAnalyzer}
+GEN=${GEN:-./bench/gen_log}
+BENCH_SIZE_MB=${BENCH_SIZE_MB:-256}
+BENCH_BUFFERS=${BENCH_BUFFERS:-"16 256 4096"}
+BENCH_WORKERS=${BENCH_WORKERS:-"1 2 4 8"}
+BENCH_FLAGS=${BENCH_FLAGS:-}
+BENCH_LOG=${BENCH_LOG:-/tmp/loganalyzer_bench.log}
+
+# Terms from every line matching down to no line matching (see pick_status in gen_log.c)
+TERMS='HTTP/1.1|" 404 |" 500 |no-such-needle'
+
+if [ ! -f "$BENCH_LOG" ] || [ "$(($(wc -c < "$BENCH_LOG") / 1048576))" -ne "$BENCH_SIZE_MB" ]; then
+    "$GEN" "$BENCH_SIZE_MB" "$BENCH_LOG"
+fi
+
+echo "buffer_size,workers,flags,term,matches,selectivity,lines,seconds,lines_per_s,mb_per_s,p50_latency_us,p99_latency_us"
+for buffer_size in $BENCH_BUFFERS; do
+    for workers in $BENCH_WORKERS; do
+        echo "$TERMS" | tr '|' '\n' | while IFS= read -r term; do
+            # shellcheck disable=SC2086 # BENCH_FLAGS is a list of options
+            output=$("$BIN" --stats $BENCH_FLAGS "$buffer_size" "$workers" "$BENCH_LOG" "$term")
+            matches=$(echo "$output" | sed -n 's/^Total matches found: //p')
+            echo "$output" | sed -n 's/^Stats: //p' | tr ' ' '\n' | {
+                while IFS='=' read -r key value; do
+                    eval "stat_$key=\$value"
+                done
+                selectivity=$(awk -v m="$matches" -v l="$stat_lines" 'BEGIN { printf "%.4f", l ? m / l : 0 }')
+                printf '%s,%s,"%s","%s",%s,%s,%s,%s,%s,%s,%s,%s\n' "$buffer_size" "$workers" "$BENCH_FLAGS" \
+                    "$(echo "$term" | sed 's/"/""/g')" "$matches" "$selectivity" "$stat_lines" "$stat_seconds" \
+                    "$stat_lines_per_s" "$stat_mb_per_s" "$stat_p50_latency_us" "$stat_p99_latency_us"
+            }
+        done
+    done
+done
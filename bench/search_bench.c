@@ -0,0 +1,116 @@
+#define _GNU_SOURCE // For getline
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../search.h"
+
+// Microbenchmark: SIMD search kernels vs. per-line strstr on logs/large.log-style input.
+// Usage: ./search_bench [template_log] [size_mb]
+// The template file is repeated until the input reaches size_mb. Output is one
+// key=value record per (term, engine) pair so results can be diffed between versions.
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *build_input(const char *template_path, size_t target_size, size_t *out_size) {
+    FILE *file = fopen(template_path, "r");
+    if (!file) {
+        perror("fopen failed");
+        exit(EXIT_FAILURE);
+    }
+    char *template_data = NULL;
+    size_t template_size = 0;
+    FILE *mem = open_memstream(&template_data, &template_size);
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        fwrite(chunk, 1, n, mem);
+    }
+    fputc('\n', mem); // Template files may lack a trailing newline
+    fclose(mem);
+    fclose(file);
+    if (template_size <= 1) {
+        fprintf(stderr, "Error: Template log %s is empty.\n", template_path);
+        exit(EXIT_FAILURE);
+    }
+
+    char *data = malloc(target_size + template_size + 1);
+    if (!data) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = 0;
+    while (size < target_size) {
+        memcpy(data + size, template_data, template_size);
+        size += template_size;
+    }
+    data[size] = '\0';
+    free(template_data);
+    *out_size = size;
+    return data;
+}
+
+// Reference: what worker_function did before the search kernels, one strstr per line
+static int count_with_strstr(char *data, size_t size, const char *term) {
+    int matches = 0;
+    char *line = data;
+    char *end = data + size;
+    while (line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        if (newline) {
+            *newline = '\0';
+        }
+        if (strstr(line, term) != NULL) {
+            matches++;
+        }
+        if (!newline) {
+            break;
+        }
+        *newline = '\n';
+        line = newline + 1;
+    }
+    return matches;
+}
+
+int main(int argc, char *argv[]) {
+    const char *template_path = argc > 1 ? argv[1] : "logs/large.log";
+    size_t size_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+    const char *terms[] = { "404", "HTTP/1.1", "GET /api/", "definitely_missing_file", "no-such-needle" };
+    const char *kernels[] = { "scalar", "sse2", "avx2", "neon" };
+
+    size_t size;
+    char *data = build_input(template_path, size_mb * 1024 * 1024, &size);
+    int failures = 0;
+
+    for (size_t t = 0; t < sizeof(terms) / sizeof(terms[0]); t++) {
+        double start = now_seconds();
+        int expected = count_with_strstr(data, size, terms[t]);
+        double elapsed = now_seconds() - start;
+        printf("engine=strstr term=\"%s\" matches=%d seconds=%.4f mb_per_s=%.1f\n",
+               terms[t], expected, elapsed, size / 1e6 / elapsed);
+
+        search_init(terms[t]);
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            if (!search_set_kernel(kernels[k])) {
+                continue; // Not available on this machine
+            }
+            start = now_seconds();
+            int matches = search_count_matching_lines(data, size);
+            elapsed = now_seconds() - start;
+            printf("engine=%s term=\"%s\" matches=%d seconds=%.4f mb_per_s=%.1f%s\n",
+                   kernels[k], terms[t], matches, elapsed, size / 1e6 / elapsed,
+                   matches == expected ? "" : " MISMATCH");
+            if (matches != expected) {
+                failures++;
+            }
+        }
+    }
+
+    free(data);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE // For getline and fmemopen
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../line_split.h"
+
+// Microbenchmark: the manager's line splitting, getline per line vs. the newline kernels over
+// whole blocks, on logs/large.log-style input.
+// Usage: ./split_bench [template_log] [size_mb]
+// The template file is repeated until the input reaches size_mb. Both paths copy every line
+// out, as the manager does into its line arena; output is one key=value record per engine.
+
+#define BLOCK_SIZE (256 * 1024) // As STREAM_READ_SIZE in the manager
+#define MAX_LINES 4096          // As LINE_SPLIT_MAX_LINES
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *build_input(const char *template_path, size_t target_size, size_t *out_size) {
+    FILE *file = fopen(template_path, "r");
+    if (!file) {
+        perror("fopen failed");
+        exit(EXIT_FAILURE);
+    }
+    char *template_data = NULL;
+    size_t template_size = 0;
+    FILE *mem = open_memstream(&template_data, &template_size);
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        fwrite(chunk, 1, n, mem);
+    }
+    fputc('\n', mem); // Template files may lack a trailing newline
+    fclose(mem);
+    fclose(file);
+    if (template_size <= 1) {
+        fprintf(stderr, "Error: Template log %s is empty.\n", template_path);
+        exit(EXIT_FAILURE);
+    }
+
+    char *data = malloc(target_size + template_size + 1);
+    if (!data) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = 0;
+    while (size < target_size) {
+        memcpy(data + size, template_data, template_size);
+        size += template_size;
+    }
+    data[size] = '\0';
+    free(template_data);
+    *out_size = size;
+    return data;
+}
+
+// Stand-in for the line arena: lines are copied back to back and the space reused when full
+static char s_arena[1024 * 1024];
+static size_t s_arena_used;
+
+static void keep_line(const char *line, size_t length) {
+    if (length > sizeof(s_arena)) {
+        return;
+    }
+    if (s_arena_used + length > sizeof(s_arena)) {
+        s_arena_used = 0;
+    }
+    memcpy(s_arena + s_arena_used, line, length);
+    s_arena_used += length;
+}
+
+// Reference: what the manager did before the splitter, getline and a terminator patch per line
+static size_t split_with_getline(char *data, size_t size, unsigned long long *bytes) {
+    FILE *file = fmemopen(data, size, "r");
+    if (!file) {
+        perror("fmemopen failed");
+        exit(EXIT_FAILURE);
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t lines = 0;
+    while ((length = getline(&line, &capacity, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        keep_line(line, (size_t)length);
+        *bytes += (size_t)length;
+        lines++;
+    }
+    free(line);
+    fclose(file);
+    return lines;
+}
+
+// The manager's splitter: blocks of BLOCK_SIZE, a partial line carried into the next block
+static size_t split_with_kernel(const char *data, size_t size, unsigned long long *bytes) {
+    static uint32_t newlines[MAX_LINES];
+    size_t lines = 0;
+    size_t line_start = 0;
+    for (size_t block = 0; block < size; block += BLOCK_SIZE) {
+        size_t end = block + BLOCK_SIZE < size ? block + BLOCK_SIZE : size;
+        size_t scan = block;
+        while (scan < end) {
+            size_t found = line_split_find(data + scan, end - scan, newlines, MAX_LINES);
+            for (size_t k = 0; k < found; k++) {
+                size_t line_end = scan + newlines[k];
+                keep_line(data + line_start, line_end - line_start);
+                *bytes += line_end - line_start;
+                line_start = line_end + 1;
+                lines++;
+            }
+            scan = found < MAX_LINES ? end : line_start;
+        }
+    }
+    if (line_start < size) {
+        keep_line(data + line_start, size - line_start);
+        *bytes += size - line_start;
+        lines++;
+    }
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    const char *template_path = argc > 1 ? argv[1] : "logs/large.log";
+    size_t size_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+    const char *kernels[] = { "scalar", "sse2", "avx2", "neon" };
+
+    size_t size;
+    char *data = build_input(template_path, size_mb * 1024 * 1024, &size);
+    int failures = 0;
+
+    unsigned long long expected_bytes = 0;
+    double start = now_seconds();
+    size_t expected = split_with_getline(data, size, &expected_bytes);
+    double elapsed = now_seconds() - start;
+    printf("engine=getline lines=%zu bytes=%llu seconds=%.4f mb_per_s=%.1f\n",
+           expected, expected_bytes, elapsed, size / 1e6 / elapsed);
+
+    line_split_init();
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!line_split_set_kernel(kernels[k])) {
+            continue; // Not available on this machine
+        }
+        unsigned long long bytes = 0;
+        start = now_seconds();
+        size_t lines = split_with_kernel(data, size, &bytes);
+        elapsed = now_seconds() - start;
+        bool same = lines == expected && bytes == expected_bytes;
+        printf("engine=%s lines=%zu bytes=%llu seconds=%.4f mb_per_s=%.1f%s\n",
+               kernels[k], lines, bytes, elapsed, size / 1e6 / elapsed, same ? "" : " MISMATCH");
+        if (!same) {
+            failures++;
+        }
+    }
+
+    free(data);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,9 +1,19 @@
 #include "buffer.h"
+#include "buffer_mpmc.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+void line_slice_release(LineSlice line) {
+    if (line.chunk) {
+        chunk_release(line.chunk);
+    }
+}
 
 void buffer_init(Buffer *buffer, int capacity) {
-    buffer->lines = malloc(sizeof(char*) * capacity);
+    buffer->mpmc = NULL;
+    buffer->lines = malloc(sizeof(LineSlice) * capacity);
     if (!buffer->lines) {
         perror("Failed to allocate buffer lines array");
         exit(EXIT_FAILURE);
@@ -13,20 +23,53 @@ void buffer_init(Buffer *buffer, int capacity) {
     buffer->head = 0;
     buffer->tail = 0;
     buffer->shutting_down = false;
+    buffer->bytes = 0;
+    buffer->byte_budget = 0;
+    buffer->full_wait_ns = 0;
+    buffer->budget_wait_ns = 0;
+    buffer->empty_wait_ns = 0;
+    buffer->producers = 0;
+    buffer->closed = false;
     pthread_mutex_init(&buffer->mutex, NULL);
     pthread_cond_init(&buffer->cond_full, NULL);
     pthread_cond_init(&buffer->cond_empty, NULL);
+#ifdef LOG_INSTRUMENT
+    memset(&buffer->instrument, 0, sizeof(buffer->instrument));
+#endif
+}
+
+void buffer_init_lockfree(Buffer *buffer, int capacity) {
+    if (capacity < MPMC_MIN_CAPACITY) {
+        capacity = MPMC_MIN_CAPACITY; // As the ring rounds it, so reports show the real size
+    }
+    buffer->mpmc = mpmc_create(capacity);
+    buffer->lines = NULL;
+    buffer->capacity = capacity;
+    buffer->count = 0;
+    buffer->head = 0;
+    buffer->tail = 0;
+    buffer->shutting_down = false;
+    buffer->bytes = 0;
+    buffer->byte_budget = 0;
+    buffer->full_wait_ns = 0;
+    buffer->budget_wait_ns = 0;
+    buffer->empty_wait_ns = 0;
+    buffer->producers = 0;
+    buffer->closed = false;
 }
 
 void buffer_destroy(Buffer *buffer) {
+    if (buffer->mpmc) {
+        mpmc_destroy(buffer->mpmc);
+        buffer->mpmc = NULL;
+        return;
+    }
     if (buffer->lines) {
-        // Free any remaining lines in the buffer if they were dynamically allocated
+        // Release any remaining lines in the buffer, returning their arena chunks
         // This handles cases where workers might not have consumed all lines during a shutdown.
         for (int i = 0; i < buffer->count; i++) {
             int current_idx = (buffer->head + i) % buffer->capacity;
-            if (buffer->lines[current_idx] != NULL) {
-                free(buffer->lines[current_idx]);
-            }
+            line_slice_release(buffer->lines[current_idx]);
         }
         free(buffer->lines);
         buffer->lines = NULL;
@@ -37,6 +80,10 @@ void buffer_destroy(Buffer *buffer) {
 }
 
 void buffer_signal_shutdown(Buffer *buffer) {
+    if (buffer->mpmc) {
+        mpmc_signal_shutdown(buffer->mpmc);
+        return;
+    }
     pthread_mutex_lock(&buffer->mutex);
     buffer->shutting_down = true;
     // Wake up any threads waiting on condition variables
@@ -45,14 +92,68 @@ void buffer_signal_shutdown(Buffer *buffer) {
     pthread_mutex_unlock(&buffer->mutex);
 }
 
-bool buffer_push(Buffer *buffer, char *line) {
+void buffer_add_producers(Buffer *buffer, int n) {
+    if (buffer->mpmc) {
+        mpmc_add_producers(buffer->mpmc, n);
+        return;
+    }
     pthread_mutex_lock(&buffer->mutex);
-    while (buffer->count == buffer->capacity) {
+    buffer->producers += n;
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+void buffer_producer_done(Buffer *buffer) {
+    if (buffer->mpmc) {
+        mpmc_producer_done(buffer->mpmc);
+        return;
+    }
+    pthread_mutex_lock(&buffer->mutex);
+    if (--buffer->producers == 0) {
+        buffer->closed = true;
+        pthread_cond_broadcast(&buffer->cond_empty); // Every waiting worker gets its EOF marker
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+// Whether a producer may add a slice now. Called with the mutex held.
+static bool has_room(const Buffer *buffer) {
+    if (buffer->count == buffer->capacity) {
+        return false;
+    }
+    // An empty buffer takes any slice, so one longer than the budget cannot block forever
+    return buffer->byte_budget == 0 || buffer->count == 0 || buffer->bytes < buffer->byte_budget;
+}
+
+// Producer side: waits once on cond_full, charging the time to whichever limit it waited on.
+// Called with the mutex held.
+static void wait_for_room(Buffer *buffer) {
+    uint64_t *waited = buffer->count < buffer->capacity ? &buffer->budget_wait_ns : &buffer->full_wait_ns;
+    uint64_t wait_start = stats_now_ns();
+    pthread_cond_wait(&buffer->cond_full, &buffer->mutex);
+    *waited += stats_now_ns() - wait_start;
+    INSTRUMENT_PUSH_WAIT_DONE(&buffer->instrument, wait_start);
+}
+
+// Consumer side: waits once on cond_empty. Called with the mutex held.
+static void wait_for_lines(Buffer *buffer) {
+    uint64_t wait_start = stats_now_ns();
+    pthread_cond_wait(&buffer->cond_empty, &buffer->mutex);
+    buffer->empty_wait_ns += stats_now_ns() - wait_start;
+    INSTRUMENT_POP_WAIT_DONE(&buffer->instrument, wait_start);
+}
+
+bool buffer_push(Buffer *buffer, LineSlice line) {
+    if (buffer->mpmc) {
+        return mpmc_push_batch(buffer->mpmc, &line, 1) == 1;
+    }
+    pthread_mutex_lock(&buffer->mutex);
+    INSTRUMENT_OCCUPANCY(&buffer->instrument, buffer->count, buffer->capacity);
+    while (!has_room(buffer)) {
         if (buffer->shutting_down) {
             pthread_mutex_unlock(&buffer->mutex);
             return false; // Cannot push, system is shutting down
         }
-        pthread_cond_wait(&buffer->cond_full, &buffer->mutex);
+        wait_for_room(buffer);
         // Re-check condition after waking up
         if (buffer->shutting_down) {
             pthread_mutex_unlock(&buffer->mutex);
@@ -63,34 +164,242 @@ bool buffer_push(Buffer *buffer, char *line) {
     buffer->lines[buffer->tail] = line;
     buffer->tail = (buffer->tail + 1) % buffer->capacity;
     buffer->count++;
+    buffer->bytes += line.length;
 
     pthread_cond_signal(&buffer->cond_empty); // Signal one waiting worker
     pthread_mutex_unlock(&buffer->mutex);
     return true;
 }
 
-char* buffer_pop(Buffer *buffer) {
+LineSlice buffer_pop(Buffer *buffer) {
+    const LineSlice eof = { NULL, 0, NULL, 0, 0 };
+    if (buffer->mpmc) {
+        LineSlice line;
+        return mpmc_pop_batch(buffer->mpmc, &line, 1) == 1 ? line : eof;
+    }
     pthread_mutex_lock(&buffer->mutex);
+    INSTRUMENT_OCCUPANCY(&buffer->instrument, buffer->count, buffer->capacity);
     while (buffer->count == 0) {
         if (buffer->shutting_down) {
             // If shutting down and buffer is empty, worker should terminate
             pthread_mutex_unlock(&buffer->mutex);
-            return NULL;
+            return eof;
         }
-        pthread_cond_wait(&buffer->cond_empty, &buffer->mutex);
+        if (buffer->closed) {
+            pthread_mutex_unlock(&buffer->mutex);
+            return eof; // Every producer is done
+        }
+        wait_for_lines(buffer);
         // Re-check condition after waking up
-        if (buffer->shutting_down && buffer->count == 0) {
+        if ((buffer->shutting_down || buffer->closed) && buffer->count == 0) {
             pthread_mutex_unlock(&buffer->mutex);
-            return NULL;
+            return eof;
         }
     }
 
-    char *line = buffer->lines[buffer->head];
-    buffer->lines[buffer->head] = NULL; // Optional: Clear the slot after popping
+    LineSlice line = buffer->lines[buffer->head];
+    buffer->lines[buffer->head] = eof; // Optional: Clear the slot after popping
     buffer->head = (buffer->head + 1) % buffer->capacity;
     buffer->count--;
+    buffer->bytes -= line.length;
 
     pthread_cond_signal(&buffer->cond_full); // Signal manager if it was waiting
     pthread_mutex_unlock(&buffer->mutex);
     return line;
-}
\ No newline at end of file
+}
+int buffer_push_batch(Buffer *buffer, LineSlice *lines, int n) {
+    if (buffer->mpmc) {
+        return mpmc_push_batch(buffer->mpmc, lines, n);
+    }
+    int pushed = 0;
+    pthread_mutex_lock(&buffer->mutex);
+    INSTRUMENT_OCCUPANCY(&buffer->instrument, buffer->count, buffer->capacity);
+    while (pushed < n) {
+        while (!has_room(buffer)) {
+            if (buffer->shutting_down) {
+                pthread_mutex_unlock(&buffer->mutex);
+                return pushed; // Cannot push the rest, system is shutting down
+            }
+            wait_for_room(buffer);
+        }
+
+        // Move as much of the run as currently fits
+        int run = 0;
+        while (pushed < n && has_room(buffer)) {
+            buffer->lines[buffer->tail] = lines[pushed];
+            buffer->tail = (buffer->tail + 1) % buffer->capacity;
+            buffer->count++;
+            buffer->bytes += lines[pushed].length;
+            pushed++;
+            run++;
+        }
+
+        // Several workers may be able to make progress now
+        if (run > 1) {
+            pthread_cond_broadcast(&buffer->cond_empty);
+        } else {
+            pthread_cond_signal(&buffer->cond_empty);
+        }
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return pushed;
+}
+
+int buffer_pop_batch(Buffer *buffer, LineSlice *lines, int max) {
+    if (buffer->mpmc) {
+        return mpmc_pop_batch(buffer->mpmc, lines, max);
+    }
+    const LineSlice eof = { NULL, 0, NULL, 0, 0 };
+    pthread_mutex_lock(&buffer->mutex);
+    INSTRUMENT_OCCUPANCY(&buffer->instrument, buffer->count, buffer->capacity);
+    while (buffer->count == 0) {
+        if (buffer->shutting_down) {
+            pthread_mutex_unlock(&buffer->mutex);
+            return 0;
+        }
+        if (buffer->closed) {
+            pthread_mutex_unlock(&buffer->mutex);
+            lines[0] = eof; // Every producer is done; each consumer that asks gets a marker
+            return 1;
+        }
+        wait_for_lines(buffer);
+    }
+
+    int popped = 0;
+    while (popped < max && buffer->count > 0) {
+        LineSlice line = buffer->lines[buffer->head];
+        if (line.data == NULL && popped > 0) {
+            break; // Leave the EOF marker for the next pop
+        }
+        lines[popped++] = line;
+        buffer->lines[buffer->head] = eof;
+        buffer->head = (buffer->head + 1) % buffer->capacity;
+        buffer->count--;
+        buffer->bytes -= line.length;
+        if (line.data == NULL) {
+            break; // An EOF marker always ends the run
+        }
+    }
+
+    // Several producers may be able to make progress now
+    if (popped > 1) {
+        pthread_cond_broadcast(&buffer->cond_full);
+    } else {
+        pthread_cond_signal(&buffer->cond_full);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return popped;
+}
+
+int buffer_try_push_batch(Buffer *buffer, LineSlice *lines, int n) {
+    pthread_mutex_lock(&buffer->mutex);
+    INSTRUMENT_OCCUPANCY(&buffer->instrument, buffer->count, buffer->capacity);
+    int run = buffer->capacity - buffer->count;
+    if (run > n) {
+        run = n;
+    }
+    for (int i = 0; i < run; i++) {
+        buffer->lines[buffer->tail] = lines[i];
+        buffer->tail = (buffer->tail + 1) % buffer->capacity;
+        buffer->bytes += lines[i].length;
+    }
+    buffer->count += run;
+    if (run > 0) {
+        pthread_cond_broadcast(&buffer->cond_empty);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return run;
+}
+
+int buffer_try_pop_batch(Buffer *buffer, LineSlice *lines, int max, bool steal_half) {
+    const LineSlice eof = { NULL, 0, NULL, 0, 0 };
+    pthread_mutex_lock(&buffer->mutex);
+    INSTRUMENT_OCCUPANCY(&buffer->instrument, buffer->count, buffer->capacity);
+    int run = steal_half ? (buffer->count + 1) / 2 : buffer->count;
+    if (run > max) {
+        run = max;
+    }
+    for (int i = 0; i < run; i++) {
+        lines[i] = buffer->lines[buffer->head];
+        buffer->bytes -= lines[i].length;
+        buffer->lines[buffer->head] = eof;
+        buffer->head = (buffer->head + 1) % buffer->capacity;
+    }
+    buffer->count -= run;
+    if (run > 0) {
+        pthread_cond_signal(&buffer->cond_full);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return run;
+}
+
+void buffer_set_byte_budget(Buffer *buffer, size_t budget) {
+    pthread_mutex_lock(&buffer->mutex);
+    buffer->byte_budget = budget;
+    pthread_cond_broadcast(&buffer->cond_full); // A larger budget may let producers in
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+bool buffer_resize(Buffer *buffer, int capacity) {
+    pthread_mutex_lock(&buffer->mutex);
+    if (capacity < buffer->count) {
+        pthread_mutex_unlock(&buffer->mutex);
+        return false; // Shrink later, once the workers have drained it
+    }
+    LineSlice *lines = malloc(sizeof(LineSlice) * capacity);
+    if (!lines) {
+        pthread_mutex_unlock(&buffer->mutex);
+        return false;
+    }
+    for (int i = 0; i < buffer->count; i++) {
+        lines[i] = buffer->lines[(buffer->head + i) % buffer->capacity];
+    }
+    free(buffer->lines);
+    buffer->lines = lines;
+    buffer->capacity = capacity;
+    buffer->head = 0;
+    buffer->tail = buffer->count % capacity;
+    pthread_cond_broadcast(&buffer->cond_full); // Growing may let several producers in
+    pthread_mutex_unlock(&buffer->mutex);
+    return true;
+}
+
+void buffer_pressure(Buffer *buffer, BufferPressure *pressure) {
+    pthread_mutex_lock(&buffer->mutex);
+    pressure->full_wait_ns = buffer->full_wait_ns;
+    pressure->budget_wait_ns = buffer->budget_wait_ns;
+    pressure->empty_wait_ns = buffer->empty_wait_ns;
+    pressure->count = buffer->count;
+    pressure->capacity = buffer->capacity;
+    pressure->bytes = buffer->bytes;
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+int buffer_count(Buffer *buffer) {
+    if (buffer->mpmc) {
+        return mpmc_count(buffer->mpmc);
+    }
+    return __atomic_load_n(&buffer->count, __ATOMIC_RELAXED); // Unlocked peek, see buffer.h
+}
+
+#ifdef LOG_INSTRUMENT
+void buffer_instrument_print(Buffer *buffer, const char *name, FILE *out) {
+    const BufferInstrument *instrument = buffer->mpmc ? mpmc_instrument(buffer->mpmc) : &buffer->instrument;
+    uint64_t samples = 0;
+    uint64_t occupancy[OCCUPANCY_BUCKETS];
+    for (int i = 0; i < OCCUPANCY_BUCKETS; i++) {
+        occupancy[i] = __atomic_load_n(&instrument->occupancy[i], __ATOMIC_RELAXED);
+        samples += occupancy[i];
+    }
+    fprintf(out, "Buffer %s: push_waits=%llu push_wait_s=%.6f pop_waits=%llu pop_wait_s=%.6f\n", name,
+            (unsigned long long)__atomic_load_n(&instrument->push_waits, __ATOMIC_RELAXED),
+            __atomic_load_n(&instrument->push_wait_ns, __ATOMIC_RELAXED) / 1e9,
+            (unsigned long long)__atomic_load_n(&instrument->pop_waits, __ATOMIC_RELAXED),
+            __atomic_load_n(&instrument->pop_wait_ns, __ATOMIC_RELAXED) / 1e9);
+    fprintf(out, "Buffer %s occupancy (%% of capacity: %% of %llu samples):", name, (unsigned long long)samples);
+    for (int i = 0; i < OCCUPANCY_BUCKETS; i++) {
+        fprintf(out, " %d:%.1f", i * 100 / (OCCUPANCY_BUCKETS - 1), samples ? 100.0 * occupancy[i] / samples : 0.0);
+    }
+    fprintf(out, "\n");
+}
+#endif
@@ -3,19 +3,72 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "line_arena.h"
+#include "instrument.h"
+
+/**
+ * @brief A view of one or more newline-separated log lines.
+ *        A slice holding a single line read by getline carries no '\n' (it was stripped);
+ *        a slice cut from a memory-mapped file may span many lines, each ended by '\n'
+ *        except possibly the last one. The data is not guaranteed to be NUL-terminated.
+ *        A slice whose data is NULL is the EOF marker.
+ */
+typedef struct {
+    char *data;            // Start of the slice inside its backing storage (NULL is the EOF marker)
+    size_t length;         // Number of bytes in the slice
+    LineChunk *chunk;      // Arena chunk holding data, whose reference the slice owns; NULL if data is borrowed
+    uint64_t enqueued_ns;  // When the manager pushed the slice (only with --stats, else 0)
+    uint64_t seq;          // Position of the slice in the input (only with --print, else 0)
+} LineSlice;
+
+struct MpmcRing; // Lock-free backend, see buffer_mpmc.c
 
 typedef struct {
-    char **lines;          // Array of strings (lines from the file)
+    struct MpmcRing *mpmc; // Non-NULL if the buffer uses the lock-free backend; the fields below are then unused
+    LineSlice *lines;      // Array of slices (lines or line runs from the file)
     int capacity;          // Max number of items in buffer
     int count;             // Current number of items in buffer
     int head;              // Index to pop from
     int tail;              // Index to push to
     bool shutting_down;    // Flag to indicate if the system is shutting down (e.g., due to SIGINT)
+    size_t bytes;          // Sum of the lengths of the queued slices
+    size_t byte_budget;    // Producers wait while bytes reaches this (0: no budget); see buffer_set_byte_budget
+    uint64_t full_wait_ns;   // Time producers blocked because every slot was taken
+    uint64_t budget_wait_ns; // Time producers blocked because bytes reached byte_budget
+    uint64_t empty_wait_ns;  // Time consumers blocked on an empty buffer
+    int producers;         // Registered producers that have not called buffer_producer_done yet
+    bool closed;           // Set when the last registered producer is done: pops then return EOF markers once empty
     pthread_mutex_t mutex; // Mutex for buffer access
     pthread_cond_t cond_full; // Condition variable: buffer is full, producer waits
     pthread_cond_t cond_empty; // Condition variable: buffer is empty, consumer waits
+#ifdef LOG_INSTRUMENT
+    BufferInstrument instrument; // Wait times and occupancy of the mutex-based backend
+#endif
 } Buffer;
 
+/**
+ * @brief Where the threads using a buffer (mutex-based backend) have been blocking, for sizing it.
+ *        The wait times only grow; rates come from the difference between two snapshots.
+ */
+typedef struct {
+    uint64_t full_wait_ns;   // Total time producers blocked because every slot was taken
+    uint64_t budget_wait_ns; // Total time producers blocked on the byte budget
+    uint64_t empty_wait_ns;  // Total time consumers blocked on an empty buffer (summed over consumers)
+    int count;               // Slices queued now
+    int capacity;            // Current capacity
+    size_t bytes;            // Bytes queued now
+} BufferPressure;
+
+/**
+ * @brief Releases whatever storage a slice owns (its reference on an arena chunk, if any).
+ *        Consumers call this once they are done with a slice.
+ * @param line The slice.
+ */
+void line_slice_release(LineSlice line);
+
 /**
  * @brief Initializes the buffer.
  * @param buffer Pointer to the Buffer struct.
@@ -23,31 +76,138 @@ typedef struct {
  */
 void buffer_init(Buffer *buffer, int capacity);
 
+/**
+ * @brief Initializes the buffer with the lock-free backend: a bounded multi-producer/multi-consumer
+ *        ring with per-slot sequence numbers and spin-then-futex waiting. It honours the same contract
+ *        as the mutex-based buffer (blocking, EOF markers, producer registration, shutdown). Producers
+ *        only contend on one CAS per run they push, not on a lock held while the run is copied in.
+ * @param buffer Pointer to the Buffer struct.
+ * @param capacity The maximum capacity of the buffer, rounded up to 2 (see MPMC_MIN_CAPACITY).
+ */
+void buffer_init_lockfree(Buffer *buffer, int capacity);
+
 /**
  * @brief Destroys the buffer, freeing allocated resources.
- *          IMPORTANT: This function assumes that any dynamically allocated strings
- *          (lines) remaining in the buffer will be freed. This is crucial if
- *          the buffer is destroyed while containing unprocessed lines, e.g. during shutdown.
+ *          IMPORTANT: Any slices remaining in the buffer are released (see line_slice_release),
+ *          so arena chunks are returned even if the buffer is destroyed while containing
+ *          unprocessed lines, e.g. during shutdown. Borrowed slices (e.g. into a mapped file) are left alone.
  * @param buffer Pointer to the Buffer struct.
  */
 void buffer_destroy(Buffer *buffer);
 
 /**
- * @brief Pushes a line into the buffer. Blocks if the buffer is full, unless shutting down.
+ * @brief Registers producers. Once every registered producer has called buffer_producer_done,
+ *        the buffer is closed: consumers drain what is queued, then every pop returns an EOF
+ *        marker, so no marker per consumer has to be pushed and consumers started late get one too.
+ *        Register a producer before it can push, and before any other registered producer may
+ *        finish, or the buffer may close early.
+ * @param buffer Pointer to the Buffer struct.
+ * @param n Number of producers to add.
+ */
+void buffer_add_producers(Buffer *buffer, int n);
+
+/**
+ * @brief Tells the buffer a registered producer will push no more. The last one closes the buffer
+ *        and wakes the consumers waiting on it.
+ * @param buffer Pointer to the Buffer struct.
+ */
+void buffer_producer_done(Buffer *buffer);
+
+/**
+ * @brief Pushes a slice into the buffer. Blocks if the buffer is full, unless shutting down.
  * @param buffer Pointer to the Buffer struct.
- * @param line The line (string) to push. Ownership of the string is transferred to the buffer.
- *             NULL can be pushed as an EOF marker.
- * @return true if the line was pushed successfully, false if shutting down and line was not pushed.
+ * @param line The slice to push. The storage it owns (if any) is transferred to the buffer.
+ *             A slice with NULL data can be pushed as an EOF marker.
+ * @return true if the slice was pushed successfully, false if shutting down and it was not pushed.
  */
-bool buffer_push(Buffer *buffer, char *line);
+bool buffer_push(Buffer *buffer, LineSlice line);
 
 /**
- * @brief Pops a line from the buffer. Blocks if the buffer is empty, unless shutting down.
+ * @brief Pops a slice from the buffer. Blocks if the buffer is empty, unless shutting down.
  * @param buffer Pointer to the Buffer struct.
- * @return The popped line (string). The caller is responsible for freeing this string if it's not NULL.
- *         Returns NULL if an EOF marker is popped or if the system is shutting down and the buffer is empty.
+ * @return The popped slice. The caller must release it with line_slice_release if it is not an EOF marker.
+ *         Returns a slice with NULL data if an EOF marker is popped, or if the buffer is empty and
+ *         either shutting down or closed (see buffer_add_producers).
  */
-char* buffer_pop(Buffer *buffer);
+LineSlice buffer_pop(Buffer *buffer);
+
+/**
+ * @brief Pushes a run of slices under a single lock acquisition, waking consumers once per run
+ *        instead of once per slice. Blocks while the buffer is full, unless shutting down.
+ *        If n exceeds the free space, the slices are moved in as many runs as needed.
+ * @param buffer Pointer to the Buffer struct.
+ * @param lines The slices to push, in order. Ownership of each pushed slice's storage is transferred.
+ * @param n Number of slices in lines.
+ * @return The number of slices pushed. Less than n only if the buffer is shutting down; the caller
+ *         keeps ownership of lines[return value .. n-1].
+ */
+int buffer_push_batch(Buffer *buffer, LineSlice *lines, int n);
+
+/**
+ * @brief Pops up to max slices under a single lock acquisition. Blocks while the buffer is empty,
+ *        unless shutting down. A run never extends past an EOF marker: if the next slot holds an
+ *        EOF marker it is returned on its own, so each consumer still receives exactly one marker.
+ * @param buffer Pointer to the Buffer struct.
+ * @param lines Output array receiving the popped slices. The caller owns them afterwards.
+ * @param max Capacity of lines (must be positive).
+ * @return The number of slices popped (at least 1), or 0 if the system is shutting down and
+ *         the buffer is empty. Once the buffer is closed and empty, 1 with an EOF marker.
+ */
+int buffer_pop_batch(Buffer *buffer, LineSlice *lines, int max);
+
+/**
+ * @brief Non-blocking variant of buffer_push_batch: pushes as many slices as currently fit.
+ * @param buffer Pointer to the Buffer struct (mutex-based backend only).
+ * @param lines The slices to push, in order. Ownership of each pushed slice's storage is transferred.
+ * @param n Number of slices in lines.
+ * @return The number of slices pushed, possibly 0 if the buffer is full.
+ */
+int buffer_try_push_batch(Buffer *buffer, LineSlice *lines, int n);
+
+/**
+ * @brief Non-blocking variant of buffer_pop_batch, used for work stealing. EOF markers are not
+ *        expected in buffers used this way.
+ * @param buffer Pointer to the Buffer struct (mutex-based backend only).
+ * @param lines Output array receiving the taken slices. The caller owns them afterwards.
+ * @param max Capacity of lines.
+ * @param steal_half true to take at most half of the queued slices, false to take up to max.
+ * @return The number of slices taken, 0 if the buffer was empty.
+ */
+int buffer_try_pop_batch(Buffer *buffer, LineSlice *lines, int max, bool steal_half);
+
+/**
+ * @brief Returns the number of slices currently queued. The value may be stale as soon as
+ *        it is returned; it is meant for heuristics such as picking a victim to steal from or
+ *        sizing the --adaptive worker pool.
+ * @param buffer Pointer to the Buffer struct (either backend).
+ */
+int buffer_count(Buffer *buffer);
+
+/**
+ * @brief Limits the bytes queued (the sum of the slice lengths), on top of the slot count:
+ *        producers wait while the queued bytes reach the budget. A buffer holding nothing
+ *        always takes one more slice, so a single slice larger than the budget still gets
+ *        through. Mutex-based backend only.
+ * @param buffer Pointer to the Buffer struct.
+ * @param budget The limit in bytes, or 0 for none.
+ */
+void buffer_set_byte_budget(Buffer *buffer, size_t budget);
+
+/**
+ * @brief Changes the capacity of a buffer in use (mutex-based backend only). The queued slices
+ *        are moved into new storage of the new size, in order; producers waiting for space are woken.
+ * @param buffer Pointer to the Buffer struct.
+ * @param capacity The new capacity (must be positive).
+ * @return false, with nothing changed, if more than capacity slices are queued or allocation fails.
+ */
+bool buffer_resize(Buffer *buffer, int capacity);
+
+/**
+ * @brief Takes a consistent snapshot of the buffer's wait times and fill level (mutex-based backend only).
+ * @param buffer Pointer to the Buffer struct.
+ * @param pressure Receives the snapshot.
+ */
+void buffer_pressure(Buffer *buffer, BufferPressure *pressure);
 
 /**
  * @brief Signals the buffer (and waiting threads) that the system is shutting down.
@@ -56,4 +216,15 @@ char* buffer_pop(Buffer *buffer);
  */
 void buffer_signal_shutdown(Buffer *buffer);
 
+#ifdef LOG_INSTRUMENT
+/**
+ * @brief Prints the buffer's instrumentation counters (either backend). Safe to call while
+ *        the buffer is in use; counters are read with relaxed atomic loads.
+ * @param buffer Pointer to the Buffer struct.
+ * @param name Label for the report, e.g. "shared".
+ * @param out Stream to print to.
+ */
+void buffer_instrument_print(Buffer *buffer, const char *name, FILE *out);
+#endif
+
 #endif // BUFFER_H
\ No newline at end of file
@@ -0,0 +1,366 @@
+#define _GNU_SOURCE // For syscall
+#include "buffer_mpmc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define CACHE_LINE_SIZE 64
+#define SPIN_ITERATIONS 200 // Polls before a waiting thread falls back to a futex sleep (or a yield)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+/*
+ * Positions are 64-bit counters that only ever grow; slot = position % capacity. Every slot
+ * carries a sequence number saying what it holds: pos while it is free for the push of
+ * position pos, pos + 1 once that push has been published.
+ *
+ * Producers reserve a run of positions by CAS-ing tail forward, after checking against head
+ * that the run fits. They then fill and publish their slots independently of each other, so
+ * producers never wait on one another except for the CAS itself. A reserved slot may still be
+ * in the hands of the consumer that claimed its previous occupant; the producer spins until
+ * that consumer has freed it, which it does right after its copy.
+ *
+ * Consumers claim the run of consecutive published slots from head by CAS-ing head forward,
+ * after copying the slots out, then free each slot by setting its sequence number to
+ * pos + capacity. A copy made by a consumer whose CAS then fails may be stale; it is simply
+ * discarded. A successful CAS proves no overwrite happened, since a slot is only reused once
+ * head has moved past it. Slot fields are accessed with relaxed atomics so those discarded
+ * racy reads stay well-defined.
+ *
+ * Each hot counter sits on its own cache line so producers and consumers do not
+ * invalidate each other's lines on every operation.
+ */
+typedef struct {
+    uint64_t seq;   // pos while free for position pos, pos + 1 once published
+    LineSlice line;
+} MpmcSlot;
+
+struct MpmcRing {
+    uint64_t head __attribute__((aligned(CACHE_LINE_SIZE)));            // Next position to pop (consumers)
+    uint64_t tail __attribute__((aligned(CACHE_LINE_SIZE)));            // Next position to reserve (producers)
+    uint32_t items_futex __attribute__((aligned(CACHE_LINE_SIZE)));     // Bumped when items are published to sleepers
+    int consumers_waiting;                                              // Consumers about to sleep or asleep on items_futex
+    uint32_t space_futex __attribute__((aligned(CACHE_LINE_SIZE)));     // Bumped when slots are freed for sleeping producers
+    int producers_waiting;                                              // Producers about to sleep or asleep on space_futex
+    int shutting_down __attribute__((aligned(CACHE_LINE_SIZE)));
+    int producers;  // Registered producers that have not finished yet
+    int closed;     // Set when the last registered producer finished
+    int capacity;
+    MpmcSlot *slots;
+#ifdef LOG_INSTRUMENT
+    BufferInstrument instrument __attribute__((aligned(CACHE_LINE_SIZE))); // Futex sleeps only; spinning is not counted
+#endif
+};
+
+// What a consumer found after waiting
+typedef enum {
+    RING_READY,    // The slot at head is published
+    RING_SHUTDOWN, // Shutting down
+    RING_CLOSED    // Every producer is done and the ring is empty
+} RingWait;
+
+static void futex_wait(uint32_t *addr, uint32_t expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static uint64_t load_acquire(uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static bool is_shutting_down(MpmcRing *ring) {
+    return __atomic_load_n(&ring->shutting_down, __ATOMIC_ACQUIRE);
+}
+
+static bool is_closed(MpmcRing *ring) {
+    return __atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST);
+}
+
+static void store_slot(LineSlice *slot, LineSlice value) {
+    __atomic_store_n(&slot->data, value.data, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->length, value.length, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->chunk, value.chunk, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->enqueued_ns, value.enqueued_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, value.seq, __ATOMIC_RELAXED);
+}
+
+static LineSlice load_slot(LineSlice *slot) {
+    LineSlice value;
+    value.data = __atomic_load_n(&slot->data, __ATOMIC_RELAXED);
+    value.length = __atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+    value.chunk = __atomic_load_n(&slot->chunk, __ATOMIC_RELAXED);
+    value.enqueued_ns = __atomic_load_n(&slot->enqueued_ns, __ATOMIC_RELAXED);
+    value.seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    return value;
+}
+
+MpmcRing *mpmc_create(int capacity) {
+    if (capacity < MPMC_MIN_CAPACITY) {
+        capacity = MPMC_MIN_CAPACITY; // See MPMC_MIN_CAPACITY
+    }
+    MpmcRing *ring;
+    if (posix_memalign((void **)&ring, CACHE_LINE_SIZE, sizeof(MpmcRing)) != 0) {
+        perror("Failed to allocate lock-free ring");
+        exit(EXIT_FAILURE);
+    }
+    ring->slots = calloc(capacity, sizeof(MpmcSlot));
+    if (!ring->slots) {
+        perror("Failed to allocate lock-free ring slots");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < capacity; i++) {
+        ring->slots[i].seq = (uint64_t)i; // Free for the first lap
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->items_futex = 0;
+    ring->consumers_waiting = 0;
+    ring->space_futex = 0;
+    ring->producers_waiting = 0;
+    ring->shutting_down = 0;
+    ring->producers = 0;
+    ring->closed = 0;
+    ring->capacity = capacity;
+#ifdef LOG_INSTRUMENT
+    memset(&ring->instrument, 0, sizeof(ring->instrument));
+#endif
+    return ring;
+}
+
+void mpmc_destroy(MpmcRing *ring) {
+    // Called after all threads are joined, so plain reads are fine here
+    for (uint64_t pos = ring->head; pos < ring->tail; pos++) {
+        MpmcSlot *slot = &ring->slots[pos % ring->capacity];
+        if (slot->seq == pos + 1) {
+            line_slice_release(slot->line);
+        }
+    }
+    free(ring->slots);
+    free(ring);
+}
+
+// Wakes every sleeper on both sides, after one of the flags they re-check has been set
+static void wake_everyone(MpmcRing *ring) {
+    __atomic_fetch_add(&ring->items_futex, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&ring->space_futex, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->items_futex, INT_MAX); // Wake up workers
+    futex_wake(&ring->space_futex, INT_MAX); // Wake up producers
+}
+
+void mpmc_signal_shutdown(MpmcRing *ring) {
+    __atomic_store_n(&ring->shutting_down, 1, __ATOMIC_SEQ_CST);
+    wake_everyone(ring);
+}
+
+void mpmc_add_producers(MpmcRing *ring, int n) {
+    __atomic_fetch_add(&ring->producers, n, __ATOMIC_RELAXED);
+}
+
+void mpmc_producer_done(MpmcRing *ring) {
+    // acq_rel: the last producer to finish sees every other producer's pushes before closing
+    if (__atomic_sub_fetch(&ring->producers, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+        wake_everyone(ring);
+    }
+}
+
+// Producer side: blocks until at least one slot is free. Returns false if shutting down first.
+static bool wait_for_space(MpmcRing *ring) {
+    for (int spin = 0; ; spin++) {
+        // Head first: it never passes tail, so a tail read after it cannot be smaller
+        uint64_t head = load_acquire(&ring->head);
+        if (load_acquire(&ring->tail) - head < (uint64_t)ring->capacity) {
+            return true;
+        }
+        if (is_shutting_down(ring)) {
+            return false;
+        }
+        if (spin < SPIN_ITERATIONS) {
+            cpu_relax();
+            continue;
+        }
+        uint32_t seq = __atomic_load_n(&ring->space_futex, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&ring->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        // Re-check after announcing ourselves, so a consumer that frees a slot now will wake us
+        head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) - head >= (uint64_t)ring->capacity
+                && !is_shutting_down(ring)) {
+            uint64_t wait_start = INSTRUMENT_NOW();
+            futex_wait(&ring->space_futex, seq);
+            INSTRUMENT_PUSH_WAIT_DONE(&ring->instrument, wait_start);
+        }
+        __atomic_fetch_sub(&ring->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        spin = 0;
+    }
+}
+
+// Producer side: waits until the consumer of a reserved slot's previous occupant has freed it.
+// That consumer claimed the slot already and frees it right after copying it out, so this does
+// not wait long; it yields rather than sleeps in case that consumer was preempted.
+static void wait_for_slot(MpmcSlot *slot, uint64_t pos) {
+    for (int spin = 0; __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos; spin++) {
+        if (spin < SPIN_ITERATIONS) {
+            cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+int mpmc_push_batch(MpmcRing *ring, LineSlice *lines, int n) {
+    int pushed = 0;
+    while (pushed < n) {
+        uint64_t head = load_acquire(&ring->head);
+        uint64_t tail = load_acquire(&ring->tail);
+        uint64_t used = tail - head;
+        if (used >= (uint64_t)ring->capacity) {
+            if (!wait_for_space(ring)) {
+                return pushed; // Cannot push the rest, system is shutting down
+            }
+            continue;
+        }
+        int run = n - pushed;
+        if ((uint64_t)run > ring->capacity - used) {
+            run = (int)(ring->capacity - used);
+        }
+        if (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + run, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            continue; // Another producer reserved these positions first
+        }
+        INSTRUMENT_OCCUPANCY(&ring->instrument, used, (uint64_t)ring->capacity);
+
+        // The positions are ours now: nothing below waits for another producer
+        for (int i = 0; i < run; i++) {
+            uint64_t pos = tail + i;
+            MpmcSlot *slot = &ring->slots[pos % ring->capacity];
+            wait_for_slot(slot, pos);
+            store_slot(&slot->line, lines[pushed + i]);
+            __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST); // Publish
+        }
+        pushed += run;
+
+        if (__atomic_load_n(&ring->consumers_waiting, __ATOMIC_SEQ_CST) > 0) {
+            __atomic_fetch_add(&ring->items_futex, 1, __ATOMIC_SEQ_CST);
+            futex_wake(&ring->items_futex, run);
+        }
+    }
+    return pushed;
+}
+
+// Whether the slot at head holds a published push
+static bool head_published(MpmcRing *ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->slots[head % ring->capacity].seq, __ATOMIC_SEQ_CST) == head + 1;
+}
+
+// Consumer side: blocks until the slot at head is published, the ring is shutting down, or it
+// is closed and empty
+static RingWait wait_for_items(MpmcRing *ring) {
+    for (int spin = 0; ; spin++) {
+        if (head_published(ring)) {
+            return RING_READY;
+        }
+        if (is_shutting_down(ring)) {
+            return RING_SHUTDOWN;
+        }
+        if (is_closed(ring)) {
+            // Every push happened before the close, so one not seen now never comes
+            return head_published(ring) ? RING_READY : RING_CLOSED;
+        }
+        if (spin < SPIN_ITERATIONS) {
+            cpu_relax();
+            continue;
+        }
+        uint32_t seq = __atomic_load_n(&ring->items_futex, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&ring->consumers_waiting, 1, __ATOMIC_SEQ_CST);
+        // Re-check after announcing ourselves, so a producer that publishes now will wake us
+        if (!head_published(ring) && !is_shutting_down(ring) && !is_closed(ring)) {
+            uint64_t wait_start = INSTRUMENT_NOW();
+            futex_wait(&ring->items_futex, seq);
+            INSTRUMENT_POP_WAIT_DONE(&ring->instrument, wait_start);
+        }
+        __atomic_fetch_sub(&ring->consumers_waiting, 1, __ATOMIC_SEQ_CST);
+        spin = 0;
+    }
+}
+
+int mpmc_pop_batch(MpmcRing *ring, LineSlice *lines, int max) {
+    while (1) {
+        RingWait state = wait_for_items(ring);
+        if (state == RING_SHUTDOWN) {
+            return 0;
+        }
+        if (state == RING_CLOSED) {
+            const LineSlice eof = { NULL, 0, NULL, 0, 0 };
+            lines[0] = eof; // Every consumer gets one, however many ask
+            return 1;
+        }
+        uint64_t head = load_acquire(&ring->head);
+
+        // The run ends at the first slot not published yet, which may be followed by slots
+        // other producers already published
+        int popped = 0;
+        while (popped < max) {
+            MpmcSlot *slot = &ring->slots[(head + popped) % ring->capacity];
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + popped + 1) {
+                break;
+            }
+            LineSlice line = load_slot(&slot->line);
+            if (line.data == NULL && popped > 0) {
+                break; // Leave the EOF marker for the next pop
+            }
+            lines[popped++] = line;
+            if (line.data == NULL) {
+                break; // An EOF marker always ends the run
+            }
+        }
+        if (popped == 0) {
+            continue; // Another consumer took the items first
+        }
+
+        if (__atomic_compare_exchange_n(&ring->head, &head, head + popped, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            INSTRUMENT_OCCUPANCY(&ring->instrument, __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) - head,
+                                 (uint64_t)ring->capacity);
+            for (int i = 0; i < popped; i++) {
+                uint64_t pos = head + i;
+                __atomic_store_n(&ring->slots[pos % ring->capacity].seq, pos + ring->capacity, __ATOMIC_RELEASE);
+            }
+            if (__atomic_load_n(&ring->producers_waiting, __ATOMIC_SEQ_CST) > 0) {
+                __atomic_fetch_add(&ring->space_futex, 1, __ATOMIC_SEQ_CST);
+                futex_wake(&ring->space_futex, INT_MAX); // Any of them may fit now
+            }
+            return popped;
+        }
+        // Lost the race for these slots; the copies may be stale, so retry from the new head
+    }
+}
+
+int mpmc_count(MpmcRing *ring) {
+    // Head first: it never passes tail, so a tail read after it cannot be smaller. Reserved
+    // slots not published yet are counted too.
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return (int)(tail - head);
+}
+
+#ifdef LOG_INSTRUMENT
+const BufferInstrument *mpmc_instrument(MpmcRing *ring) {
+    return &ring->instrument;
+}
+#endif
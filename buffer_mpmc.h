@@ -0,0 +1,34 @@
+#ifndef BUFFER_MPMC_H
+#define BUFFER_MPMC_H
+
+#include "buffer.h"
+
+/*
+ * Lock-free multi-producer/multi-consumer ring used as the lock-free Buffer backend.
+ * Only buffer.c should use these functions directly; everything else goes through
+ * the buffer_* API, which dispatches here when the buffer was built with buffer_init_lockfree.
+ */
+
+typedef struct MpmcRing MpmcRing;
+
+// A consumer frees a slot by storing pos + capacity after its head CAS, when producers can
+// already reach the slot. At capacity 1 that is also the seq the next producer publishes, so a
+// late free would overwrite a published line; from 2 slots on the two values always differ.
+#define MPMC_MIN_CAPACITY 2
+
+/**
+ * @brief Creates a ring of capacity slots, rounded up to MPMC_MIN_CAPACITY.
+ */
+MpmcRing *mpmc_create(int capacity);
+void mpmc_destroy(MpmcRing *ring);
+int mpmc_push_batch(MpmcRing *ring, LineSlice *lines, int n);
+int mpmc_pop_batch(MpmcRing *ring, LineSlice *lines, int max);
+void mpmc_add_producers(MpmcRing *ring, int n);
+void mpmc_producer_done(MpmcRing *ring);
+void mpmc_signal_shutdown(MpmcRing *ring);
+int mpmc_count(MpmcRing *ring);
+#ifdef LOG_INSTRUMENT
+const BufferInstrument *mpmc_instrument(MpmcRing *ring);
+#endif
+
+#endif // BUFFER_MPMC_H
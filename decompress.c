@@ -0,0 +1,583 @@
+#define _GNU_SOURCE // For madvise and _SC_NPROCESSORS_ONLN
+#include "decompress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zstd.h>
+#endif
+
+#define INPUT_READ_SIZE (256 * 1024) // Compressed bytes per read()
+#define SNIFF_SIZE 4                 // Enough for the gzip and zstd magic numbers
+#define ZSTD_MAX_DECODERS 8          // Upper bound on frame decoder threads (and frames in flight)
+
+static const unsigned char s_gzip_magic[2] = { 0x1f, 0x8b };
+static const unsigned char s_zstd_magic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+#ifdef HAVE_ZSTD
+typedef struct ZstdFrames ZstdFrames;
+#endif
+
+struct InputStream {
+    int fd;
+    InputFormat format;
+    unsigned char *in_buf; // Raw input; starts out holding the sniffed prefix
+    size_t in_pos;         // Bytes of in_buf already consumed
+    size_t in_len;         // Bytes of in_buf holding data
+#ifdef HAVE_ZLIB
+    z_stream z;
+    bool z_ready;          // inflateInit2 succeeded
+    bool z_end;            // Last gzip member fully inflated
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zs;      // Sequential decoding (stdin, pipes, single-frame files)
+    size_t zs_hint;        // Last ZSTD_decompressStream result; 0 means a frame just ended
+    ZstdFrames *frames;    // Parallel decoding of a mapped multi-frame file, or NULL
+#endif
+};
+
+static InputFormat format_of(const unsigned char *prefix, size_t length) {
+    if (length >= sizeof(s_gzip_magic) && memcmp(prefix, s_gzip_magic, sizeof(s_gzip_magic)) == 0) {
+        return INPUT_GZIP;
+    }
+    if (length >= sizeof(s_zstd_magic) && memcmp(prefix, s_zstd_magic, sizeof(s_zstd_magic)) == 0) {
+        return INPUT_ZSTD;
+    }
+    return INPUT_PLAIN;
+}
+
+// Reads up to length bytes, retrying short reads, so the sniffed prefix is complete even on pipes
+static ssize_t read_fully(int fd, unsigned char *buf, size_t length) {
+    size_t got = 0;
+    while (got < length) {
+        ssize_t n = read(fd, buf + got, length - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+InputFormat input_sniff(const char *path) {
+    unsigned char prefix[SNIFF_SIZE];
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return INPUT_PLAIN;
+    }
+    ssize_t n = read_fully(fd, prefix, sizeof(prefix));
+    close(fd);
+    return n > 0 ? format_of(prefix, (size_t)n) : INPUT_PLAIN;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+// Makes raw input available in in_buf. Returns 1 if there is some, 0 at end of input,
+// -1 on error; EINTR is passed up (errno set, nothing printed) so the caller can check for SIGINT.
+static int refill(InputStream *in) {
+    if (in->in_pos < in->in_len) {
+        return 1;
+    }
+    ssize_t n = read(in->fd, in->in_buf, INPUT_READ_SIZE);
+    if (n < 0) {
+        if (errno != EINTR) {
+            perror("read failed");
+        }
+        return -1;
+    }
+    in->in_pos = 0;
+    in->in_len = (size_t)n;
+    return n > 0;
+}
+#endif
+
+static ssize_t plain_read(InputStream *in, char *buf, size_t length) {
+    if (in->in_pos < in->in_len) { // Hand back the sniffed prefix first
+        size_t n = in->in_len - in->in_pos;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(buf, in->in_buf + in->in_pos, n);
+        in->in_pos += n;
+        return (ssize_t)n;
+    }
+    ssize_t n = read(in->fd, buf, length);
+    if (n < 0 && errno != EINTR) {
+        perror("read failed");
+    }
+    return n;
+}
+
+#ifdef HAVE_ZLIB
+// Inflates until buf is full or the input ends. Concatenated gzip members are read as one stream.
+static ssize_t gzip_read(InputStream *in, char *buf, size_t length) {
+    z_stream *z = &in->z;
+    z->next_out = (Bytef *)buf;
+    z->avail_out = (uInt)(length > UINT32_MAX ? UINT32_MAX : length);
+    uInt want = z->avail_out;
+    while (z->avail_out > 0 && !in->z_end) {
+        if (z->avail_in == 0) {
+            int r = refill(in);
+            if (r <= 0) {
+                if (want - z->avail_out > 0) {
+                    break; // Return what was inflated; the next call reports the problem
+                }
+                if (r == 0) {
+                    fprintf(stderr, "gzip: unexpected end of compressed input\n");
+                }
+                return -1;
+            }
+            z->next_in = in->in_buf + in->in_pos;
+            z->avail_in = (uInt)(in->in_len - in->in_pos);
+            in->in_pos = in->in_len; // z owns these bytes now
+        }
+        int rc = inflate(z, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            // End of one member; another may follow (e.g. cat a.gz b.gz)
+            if (z->avail_in == 0) {
+                int r = refill(in);
+                if (r < 0) {
+                    return want - z->avail_out > 0 ? (ssize_t)(want - z->avail_out) : -1;
+                }
+                if (r == 0) {
+                    in->z_end = true;
+                    break;
+                }
+                z->next_in = in->in_buf + in->in_pos;
+                z->avail_in = (uInt)(in->in_len - in->in_pos);
+                in->in_pos = in->in_len;
+            }
+            inflateReset(z);
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            fprintf(stderr, "gzip: %s\n", z->msg ? z->msg : "corrupt compressed data");
+            return -1;
+        }
+    }
+    return (ssize_t)(want - z->avail_out);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/*
+ * Parallel zstd decoding. Frames are independent, so each decoder thread claims the next
+ * frame and decodes it on its own. Frame f is parked in slot f % num_slots until the
+ * reader has consumed it, which bounds memory at num_slots decoded frames and keeps the
+ * output in file order. Lines may span frames; the reader's consumer stitches them.
+ */
+typedef struct {
+    char *data;     // Decoded frame, owned by the slot
+    size_t length;
+    long frame;     // Frame held, or -1 when the slot is free
+    bool ready;     // Decoding finished
+} FrameSlot;
+
+struct ZstdFrames {
+    const unsigned char *map;
+    size_t map_size;
+    size_t *offsets;      // Start of each frame; offsets[num_frames] is the end of the file
+    long num_frames;
+    long next_to_claim;   // Next frame a decoder takes (protected by mutex)
+    long next_to_read;    // Frame the reader is consuming (protected by mutex)
+    size_t read_pos;      // Reader's position inside that frame (reader only)
+    FrameSlot *slots;
+    int num_slots;
+    pthread_t *threads;
+    int num_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;  // Broadcast on every slot state change
+    bool stop;
+    bool failed;
+};
+
+// Decodes one frame into a new malloc'd buffer. Returns false on error (reported).
+static bool decode_frame(ZSTD_DCtx *dctx, const unsigned char *src, size_t src_len, char **out, size_t *out_len) {
+    unsigned long long size = ZSTD_getFrameContentSize(src, src_len);
+    if (size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR) {
+        char *buf = malloc(size > 0 ? (size_t)size : 1);
+        if (!buf) {
+            perror("malloc for zstd frame failed");
+            return false;
+        }
+        size_t ret = ZSTD_decompressDCtx(dctx, buf, (size_t)size, src, src_len);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+            free(buf);
+            return false;
+        }
+        *out = buf;
+        *out_len = ret;
+        return true;
+    }
+
+    // Content size not recorded in the header: stream into a growing buffer
+    size_t capacity = src_len * 4 + ZSTD_DStreamOutSize();
+    char *buf = malloc(capacity);
+    if (!buf) {
+        perror("malloc for zstd frame failed");
+        return false;
+    }
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    ZSTD_inBuffer input = { src, src_len, 0 };
+    ZSTD_outBuffer output = { buf, capacity, 0 };
+    size_t ret;
+    do {
+        if (output.pos == output.size) {
+            char *grown = realloc(buf, capacity * 2);
+            if (!grown) {
+                perror("realloc for zstd frame failed");
+                free(buf);
+                return false;
+            }
+            buf = grown;
+            capacity *= 2;
+            output.dst = buf;
+            output.size = capacity;
+        }
+        ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+            free(buf);
+            return false;
+        }
+    } while (ret != 0 && (input.pos < input.size || output.pos == output.size));
+    *out = buf;
+    *out_len = output.pos;
+    return true;
+}
+
+static void *frame_decoder(void *arg) {
+    ZstdFrames *frames = arg;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    pthread_mutex_lock(&frames->mutex);
+    if (!dctx) {
+        fprintf(stderr, "zstd: failed to create decoder context\n");
+        frames->failed = true;
+        pthread_cond_broadcast(&frames->cond);
+    }
+    while (dctx && !frames->stop && frames->next_to_claim < frames->num_frames) {
+        long f = frames->next_to_claim;
+        FrameSlot *slot = &frames->slots[f % frames->num_slots];
+        if (slot->frame != -1) {
+            pthread_cond_wait(&frames->cond, &frames->mutex); // Reader still holds an earlier frame there
+            continue;
+        }
+        frames->next_to_claim++;
+        slot->frame = f;
+        slot->ready = false;
+        pthread_mutex_unlock(&frames->mutex);
+
+        char *data = NULL;
+        size_t length = 0;
+        const unsigned char *src = frames->map + frames->offsets[f];
+        bool ok = decode_frame(dctx, src, frames->offsets[f + 1] - frames->offsets[f], &data, &length);
+
+        pthread_mutex_lock(&frames->mutex);
+        slot->data = data;
+        slot->length = length;
+        slot->ready = true;
+        if (!ok) {
+            frames->failed = true;
+        }
+        pthread_cond_broadcast(&frames->cond);
+    }
+    pthread_mutex_unlock(&frames->mutex);
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+static void frames_destroy(ZstdFrames *frames) {
+    pthread_mutex_lock(&frames->mutex);
+    frames->stop = true;
+    pthread_cond_broadcast(&frames->cond);
+    pthread_mutex_unlock(&frames->mutex);
+    for (int i = 0; i < frames->num_threads; i++) {
+        pthread_join(frames->threads[i], NULL);
+    }
+    for (int i = 0; frames->slots && i < frames->num_slots; i++) {
+        free(frames->slots[i].data);
+    }
+    pthread_mutex_destroy(&frames->mutex);
+    pthread_cond_destroy(&frames->cond);
+    munmap((void *)frames->map, frames->map_size);
+    free(frames->threads);
+    free(frames->slots);
+    free(frames->offsets);
+    free(frames);
+}
+
+// Maps a regular file and indexes its frames. Returns NULL (and leaves the caller on the
+// sequential path) when the file has fewer than two frames or cannot be mapped.
+static ZstdFrames *frames_create(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    size_t *offsets = NULL;
+    long num_frames = 0;
+    size_t capacity = 0;
+    for (size_t pos = 0; pos < size; ) {
+        size_t frame_size = ZSTD_findFrameCompressedSize(map + pos, size - pos);
+        if (ZSTD_isError(frame_size)) {
+            free(offsets);
+            munmap(map, size);
+            return NULL; // Let the sequential decoder report the corruption
+        }
+        if ((size_t)num_frames + 2 > capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            size_t *grown = realloc(offsets, sizeof(size_t) * capacity);
+            if (!grown) {
+                free(offsets);
+                munmap(map, size);
+                return NULL;
+            }
+            offsets = grown;
+        }
+        offsets[num_frames++] = pos;
+        pos += frame_size;
+    }
+    if (num_frames < 2) {
+        free(offsets);
+        munmap(map, size);
+        return NULL; // Nothing to parallelize
+    }
+    offsets[num_frames] = size;
+
+    ZstdFrames *frames = calloc(1, sizeof(ZstdFrames));
+    if (!frames) {
+        free(offsets);
+        munmap(map, size);
+        return NULL;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int decoders = cpus < 1 ? 1 : cpus > ZSTD_MAX_DECODERS ? ZSTD_MAX_DECODERS : (int)cpus;
+    if (decoders > num_frames) {
+        decoders = (int)num_frames;
+    }
+    frames->map = map;
+    frames->map_size = size;
+    frames->offsets = offsets;
+    frames->num_frames = num_frames;
+    frames->num_slots = decoders;
+    frames->slots = calloc(decoders, sizeof(FrameSlot));
+    frames->threads = calloc(decoders, sizeof(pthread_t));
+    pthread_mutex_init(&frames->mutex, NULL);
+    pthread_cond_init(&frames->cond, NULL);
+    if (!frames->slots || !frames->threads) {
+        frames_destroy(frames);
+        return NULL;
+    }
+    for (int i = 0; i < decoders; i++) {
+        frames->slots[i].frame = -1;
+    }
+    for (int i = 0; i < decoders; i++) {
+        if (pthread_create(&frames->threads[i], NULL, frame_decoder, frames) != 0) {
+            break; // Fewer decoders still make progress
+        }
+        frames->num_threads++;
+    }
+    if (frames->num_threads == 0) {
+        frames_destroy(frames);
+        return NULL;
+    }
+    return frames;
+}
+
+static ssize_t frames_read(ZstdFrames *frames, char *buf, size_t length) {
+    for (;;) {
+        pthread_mutex_lock(&frames->mutex);
+        if (frames->next_to_read == frames->num_frames) {
+            pthread_mutex_unlock(&frames->mutex);
+            return 0;
+        }
+        FrameSlot *slot = &frames->slots[frames->next_to_read % frames->num_slots];
+        while (!(slot->frame == frames->next_to_read && slot->ready) && !frames->failed) {
+            pthread_cond_wait(&frames->cond, &frames->mutex);
+        }
+        if (frames->failed) {
+            pthread_mutex_unlock(&frames->mutex);
+            return -1;
+        }
+        pthread_mutex_unlock(&frames->mutex); // The ready slot is the reader's until released
+
+        size_t n = slot->length - frames->read_pos;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(buf, slot->data + frames->read_pos, n);
+        frames->read_pos += n;
+        if (frames->read_pos == slot->length) {
+            pthread_mutex_lock(&frames->mutex);
+            free(slot->data);
+            slot->data = NULL;
+            slot->frame = -1;
+            frames->next_to_read++;
+            frames->read_pos = 0;
+            pthread_cond_broadcast(&frames->cond);
+            pthread_mutex_unlock(&frames->mutex);
+        }
+        if (n > 0) {
+            return (ssize_t)n;
+        }
+        // Empty (e.g. skippable) frame: move on to the next one
+    }
+}
+
+static ssize_t zstd_stream_read(InputStream *in, char *buf, size_t length) {
+    ZSTD_outBuffer output = { buf, length, 0 };
+    while (output.pos < output.size) {
+        if (in->in_pos == in->in_len) {
+            int r = refill(in);
+            if (r < 0) {
+                return output.pos > 0 ? (ssize_t)output.pos : -1;
+            }
+            if (r == 0) {
+                if (in->zs_hint != 0 && output.pos == 0) {
+                    fprintf(stderr, "zstd: unexpected end of compressed input\n");
+                    return -1;
+                }
+                break;
+            }
+        }
+        ZSTD_inBuffer input = { in->in_buf, in->in_len, in->in_pos };
+        size_t ret = ZSTD_decompressStream(in->zs, &output, &input);
+        in->in_pos = input.pos;
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        in->zs_hint = ret;
+    }
+    return (ssize_t)output.pos;
+}
+#endif
+
+InputStream *input_open_fd(int fd) {
+    InputStream *in = calloc(1, sizeof(InputStream));
+    unsigned char *in_buf = malloc(INPUT_READ_SIZE);
+    if (!in || !in_buf) {
+        perror("Failed to allocate input stream");
+        free(in);
+        free(in_buf);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        return NULL;
+    }
+    in->fd = fd;
+    in->in_buf = in_buf;
+    ssize_t n = read_fully(fd, in_buf, SNIFF_SIZE);
+    if (n < 0) {
+        perror("read failed");
+        input_close(in);
+        return NULL;
+    }
+    in->in_len = (size_t)n;
+    in->format = format_of(in_buf, in->in_len);
+
+    switch (in->format) {
+        case INPUT_PLAIN:
+            break;
+        case INPUT_GZIP:
+#ifdef HAVE_ZLIB
+            // 15 + 32: full window, gzip or zlib header detected automatically
+            if (inflateInit2(&in->z, 15 + 32) != Z_OK) {
+                fprintf(stderr, "gzip: failed to initialize inflate\n");
+                input_close(in);
+                return NULL;
+            }
+            in->z_ready = true;
+            break;
+#else
+            fprintf(stderr, "Error: Input is gzip-compressed, but gzip support was not compiled in (make GZIP=1).\n");
+            input_close(in);
+            return NULL;
+#endif
+        case INPUT_ZSTD:
+#ifdef HAVE_ZSTD
+            in->frames = frames_create(fd);
+            if (!in->frames) {
+                in->zs = ZSTD_createDStream();
+                if (!in->zs) {
+                    fprintf(stderr, "zstd: failed to create decoder\n");
+                    input_close(in);
+                    return NULL;
+                }
+                ZSTD_initDStream(in->zs);
+            }
+            break;
+#else
+            fprintf(stderr, "Error: Input is zstd-compressed, but zstd support was not compiled in (make ZSTD=1).\n");
+            input_close(in);
+            return NULL;
+#endif
+    }
+    return in;
+}
+
+ssize_t input_read(InputStream *in, char *buf, size_t length) {
+    switch (in->format) {
+#ifdef HAVE_ZLIB
+        case INPUT_GZIP:
+            return gzip_read(in, buf, length);
+#endif
+#ifdef HAVE_ZSTD
+        case INPUT_ZSTD:
+            return in->frames ? frames_read(in->frames, buf, length) : zstd_stream_read(in, buf, length);
+#endif
+        default:
+            return plain_read(in, buf, length);
+    }
+}
+
+int input_fd(const InputStream *in) {
+    return in->fd;
+}
+
+InputFormat input_format(const InputStream *in) {
+    return in->format;
+}
+
+void input_close(InputStream *in) {
+    if (!in) {
+        return;
+    }
+#ifdef HAVE_ZLIB
+    if (in->z_ready) {
+        inflateEnd(&in->z);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (in->frames) {
+        frames_destroy(in->frames);
+    }
+    ZSTD_freeDStream(in->zs);
+#endif
+    if (in->fd != STDIN_FILENO) {
+        close(in->fd);
+    }
+    free(in->in_buf);
+    free(in);
+}
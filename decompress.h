@@ -0,0 +1,57 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Sequential input stream over a plain, gzip or zstd log, detected from its first bytes.
+ * gzip support needs HAVE_ZLIB (make GZIP=1, the default) and zstd support HAVE_ZSTD
+ * (make ZSTD=1). A zstd file made of several frames (zstd -T, pzstd, or concatenated
+ * files) is decoded by a small pool of threads, several frames ahead of the reader.
+ */
+typedef enum {
+    INPUT_PLAIN,
+    INPUT_GZIP,
+    INPUT_ZSTD
+} InputFormat;
+
+typedef struct InputStream InputStream;
+
+/**
+ * @brief Reads the first bytes of a file to find its format.
+ * @param path Path of the file.
+ * @return The format; INPUT_PLAIN if the file cannot be read or is too short to tell.
+ */
+InputFormat input_sniff(const char *path);
+
+/**
+ * @brief Opens a stream over a file descriptor, detecting its format from the first bytes.
+ *        The stream takes ownership of fd unless it is STDIN_FILENO.
+ * @param fd Descriptor to read from; for zstd multi-frame decoding it must be a regular file.
+ * @return The stream, or NULL on error (reported with perror / to stderr) after closing fd.
+ */
+InputStream *input_open_fd(int fd);
+
+/**
+ * @brief Reads decompressed bytes, like read(2).
+ * @return Number of bytes read, 0 at the end of the input, or -1 on error (already reported).
+ */
+ssize_t input_read(InputStream *in, char *buf, size_t length);
+
+/**
+ * @brief Returns the underlying descriptor, e.g. for poll().
+ */
+int input_fd(const InputStream *in);
+
+/**
+ * @brief Returns the detected format.
+ */
+InputFormat input_format(const InputStream *in);
+
+/**
+ * @brief Stops any decoder threads and closes the stream.
+ */
+void input_close(InputStream *in);
+
+#endif // DECOMPRESS_H
@@ -0,0 +1,853 @@
+#define _GNU_SOURCE // For getaddrinfo
+#include "distributed.h"
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define REQUEST_MAGIC "LAQ1"
+#define RESULT_MAGIC "LAR1"
+#define REQUEST_MAX_ARGS 1024
+#define REQUEST_MAX_ARG_LENGTH (64 * 1024)
+#define RESULT_MAX_GROUPS (1u << 28)
+#define RESULT_MAX_KEY_LENGTH (1u << 20)
+#define RETRY_DELAY_MS 200 // Times the host's failures in a row, before it takes another shard
+#define DIST_IO_TIMEOUT_S 10 // For the coordinator's connect and request send
+#define ACCEPT_RETRY_DELAY_MS 100 // Pause of the server after a failed accept
+#define SHARD_MAX_BUFFER_SIZE (1L << 24) // Bounds on what a request may ask a server for
+#define SHARD_MAX_WORKERS 1024L          // Also bounds --readers
+#define SHARD_MAX_BATCH 65536L
+#define SHARD_MAX_MEMORY_MB 16384L
+#define SHARD_MAX_TOP 65536L
+
+// ---- Wire format -------------------------------------------------------------------------
+
+// A message being encoded; grown as needed
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    bool failed; // An allocation failed; the message is incomplete
+} WireBuffer;
+
+static void put_bytes(WireBuffer *wire, const void *bytes, size_t length) {
+    if (wire->failed) {
+        return;
+    }
+    if (wire->length + length > wire->capacity) {
+        size_t capacity = wire->capacity ? wire->capacity : 4096;
+        while (capacity < wire->length + length) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(wire->data, capacity);
+        if (!grown) {
+            wire->failed = true;
+            return;
+        }
+        wire->data = grown;
+        wire->capacity = capacity;
+    }
+    memcpy(wire->data + wire->length, bytes, length);
+    wire->length += length;
+}
+
+static void put_u32(WireBuffer *wire, uint32_t value) {
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+    put_bytes(wire, bytes, sizeof(bytes));
+}
+
+static void put_u64(WireBuffer *wire, uint64_t value) {
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+    put_bytes(wire, bytes, sizeof(bytes));
+}
+
+static bool write_all(int fd, const unsigned char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Sends an encoded message and frees it
+static bool wire_send(int fd, WireBuffer *wire) {
+    bool sent = !wire->failed && write_all(fd, wire->data, wire->length);
+    free(wire->data);
+    return sent;
+}
+
+static bool read_all(int fd, void *buf, size_t length) {
+    unsigned char *p = buf;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false; // Error, or the connection ended early
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static bool get_u32(int fd, uint32_t *value) {
+    unsigned char bytes[4];
+    if (!read_all(fd, bytes, sizeof(bytes))) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        *value |= (uint32_t)bytes[i] << (8 * i);
+    }
+    return true;
+}
+
+static bool get_u64(int fd, uint64_t *value) {
+    unsigned char bytes[8];
+    if (!read_all(fd, bytes, sizeof(bytes))) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 8; i++) {
+        *value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return true;
+}
+
+static bool get_magic(int fd, const char *magic) {
+    char bytes[4];
+    return read_all(fd, bytes, sizeof(bytes)) && memcmp(bytes, magic, sizeof(bytes)) == 0;
+}
+
+// Result: magic, status, matches, pattern count and counts, then a group count (UINT64_MAX
+// without --group-by) and per group its key length, key and count
+bool shard_result_send(int fd, const ShardResult *result) {
+    WireBuffer wire = { NULL, 0, 0, false };
+    put_bytes(&wire, RESULT_MAGIC, 4);
+    put_u32(&wire, result->status);
+    put_u64(&wire, result->matches);
+    put_u32(&wire, result->num_patterns);
+    for (uint32_t p = 0; p < result->num_patterns; p++) {
+        put_u64(&wire, result->pattern_counts[p]);
+    }
+    if (!result->groups) {
+        put_u64(&wire, UINT64_MAX);
+    } else {
+        size_t size = group_table_size(result->groups);
+        GroupEntry *entries = malloc(sizeof(GroupEntry) * (size > 0 ? size : 1));
+        if (!entries) {
+            wire.failed = true;
+        } else {
+            int n = group_table_top(result->groups, entries, (int)size); // Every entry
+            put_u64(&wire, (uint64_t)n);
+            for (int i = 0; i < n; i++) {
+                put_u32(&wire, (uint32_t)entries[i].key_len);
+                put_bytes(&wire, entries[i].key, entries[i].key_len);
+                put_u64(&wire, entries[i].count);
+            }
+            free(entries);
+        }
+    }
+    if (!wire_send(fd, &wire)) {
+        perror("Failed to send shard result");
+        return false;
+    }
+    return true;
+}
+
+void shard_result_free(ShardResult *result) {
+    free(result->pattern_counts);
+    result->pattern_counts = NULL;
+    group_table_destroy(result->groups);
+    result->groups = NULL;
+}
+
+bool shard_result_receive(int fd, ShardResult *result, uint32_t num_patterns, bool with_groups) {
+    memset(result, 0, sizeof(*result));
+    if (!get_magic(fd, RESULT_MAGIC) || !get_u32(fd, &result->status) || result->status > SHARD_FAILED
+            || !get_u64(fd, &result->matches) || !get_u32(fd, &result->num_patterns)
+            || result->num_patterns != num_patterns) {
+        return false;
+    }
+    result->pattern_counts = calloc(num_patterns > 0 ? num_patterns : 1, sizeof(uint64_t));
+    if (!result->pattern_counts) {
+        return false;
+    }
+    for (uint32_t p = 0; p < num_patterns; p++) {
+        if (!get_u64(fd, &result->pattern_counts[p])) {
+            shard_result_free(result);
+            return false;
+        }
+    }
+    uint64_t num_groups;
+    if (!get_u64(fd, &num_groups) || (num_groups != UINT64_MAX) != with_groups
+            || (with_groups && num_groups > RESULT_MAX_GROUPS)) {
+        shard_result_free(result);
+        return false;
+    }
+    if (!with_groups) {
+        return true;
+    }
+    result->groups = group_table_create();
+    char *key = malloc(RESULT_MAX_KEY_LENGTH);
+    bool ok = key != NULL;
+    for (uint64_t i = 0; ok && i < num_groups; i++) {
+        uint32_t key_len;
+        uint64_t count;
+        ok = get_u32(fd, &key_len) && key_len <= RESULT_MAX_KEY_LENGTH && read_all(fd, key, key_len) && get_u64(fd, &count);
+        if (ok) {
+            group_table_add(result->groups, key, key_len, count);
+        }
+    }
+    free(key);
+    if (!ok) {
+        shard_result_free(result);
+    }
+    return ok;
+}
+
+// Request: magic, argument count, then per argument its length and bytes (argv[0] included)
+static bool request_send(int fd, int argc, char *const argv[]) {
+    WireBuffer wire = { NULL, 0, 0, false };
+    put_bytes(&wire, REQUEST_MAGIC, 4);
+    put_u32(&wire, (uint32_t)argc);
+    for (int i = 0; i < argc; i++) {
+        size_t length = strlen(argv[i]);
+        put_u32(&wire, (uint32_t)length);
+        put_bytes(&wire, argv[i], length);
+    }
+    return wire_send(fd, &wire);
+}
+
+// Reads a request into a NULL-terminated argv. Returns NULL if it is malformed.
+static char **request_receive(int fd) {
+    uint32_t argc;
+    if (!get_magic(fd, REQUEST_MAGIC) || !get_u32(fd, &argc) || argc == 0 || argc > REQUEST_MAX_ARGS) {
+        return NULL;
+    }
+    char **argv = calloc(argc + 1, sizeof(char *));
+    for (uint32_t i = 0; argv && i < argc; i++) {
+        uint32_t length;
+        if (!get_u32(fd, &length) || length > REQUEST_MAX_ARG_LENGTH || !(argv[i] = malloc(length + 1))
+                || !read_all(fd, argv[i], length)) {
+            // Only this process's memory, which exits right after; nothing to free
+            return NULL;
+        }
+        argv[i][length] = '\0';
+    }
+    return argv;
+}
+
+// ---- Server ------------------------------------------------------------------------------
+
+typedef enum {
+    SHARD_VALUE_NONE,       // A flag
+    SHARD_VALUE_ANY,        // Checked by the shard run itself, as on a local command line
+    SHARD_VALUE_PATH,       // A file, which must be under the served root
+    SHARD_VALUE_COUNT,      // A whole number in [1, max]
+    SHARD_VALUE_COUNT_PAIR, // MIN:MAX, two whole numbers in [1, max]
+    SHARD_VALUE_AMOUNT      // A number in (0, max], fractions allowed
+} ShardOptionValue;
+
+typedef struct {
+    const char *name;
+    ShardOptionValue value;
+    long max; // For the bounded kinds: what a request may ask the server's threads or memory for
+} ShardOption;
+
+// The options a shard run may be given, in the full form the coordinator forwards them in.
+// Anything else is refused: --index writes files, --file and --follow read other inputs and
+// --print, --stats and --interval write to the server's terminal; none belongs in a shard run.
+static const ShardOption s_shard_options[] = {
+    { "--mmap", SHARD_VALUE_NONE, 0 },
+    { "--batch", SHARD_VALUE_COUNT, SHARD_MAX_BATCH },
+    { "--lockfree", SHARD_VALUE_NONE, 0 },
+    { "--rate-limit", SHARD_VALUE_ANY, 0 },
+    { "--patterns-file", SHARD_VALUE_PATH, 0 },
+    { "--split", SHARD_VALUE_NONE, 0 },
+    { "--steal", SHARD_VALUE_NONE, 0 },
+    { "--adaptive", SHARD_VALUE_NONE, 0 },
+    { "--max-count", SHARD_VALUE_ANY, 0 },
+    { "--exists", SHARD_VALUE_NONE, 0 },
+    { "--since", SHARD_VALUE_ANY, 0 },
+    { "--until", SHARD_VALUE_ANY, 0 },
+    { "--aio", SHARD_VALUE_NONE, 0 },
+    { "--direct", SHARD_VALUE_NONE, 0 },
+    { "--readers", SHARD_VALUE_COUNT, SHARD_MAX_WORKERS },
+    { "--auto-size", SHARD_VALUE_COUNT_PAIR, SHARD_MAX_BUFFER_SIZE },
+    { "--memory-budget", SHARD_VALUE_AMOUNT, SHARD_MAX_MEMORY_MB },
+    { "--pin", SHARD_VALUE_NONE, 0 },
+    { "--ignore-case", SHARD_VALUE_NONE, 0 },
+    { "--regex", SHARD_VALUE_NONE, 0 },
+    { "--where", SHARD_VALUE_ANY, 0 },
+    { "--group-by", SHARD_VALUE_ANY, 0 },
+    { "--top", SHARD_VALUE_COUNT, SHARD_MAX_TOP },
+};
+
+static const ShardOption *find_shard_option(const char *arg) {
+    for (size_t i = 0; i < sizeof(s_shard_options) / sizeof(s_shard_options[0]); i++) {
+        if (strcmp(arg, s_shard_options[i].name) == 0) {
+            return &s_shard_options[i];
+        }
+    }
+    return NULL;
+}
+
+static bool refuse_request(const char *why, const char *arg) {
+    fprintf(stderr, "Refused a shard request: %s%s%s.\n", why, arg ? ": " : "", arg ? arg : "");
+    return false;
+}
+
+// A decimal count in [1, max], as <buffer_size> and <num_workers> must be
+static bool is_count(const char *text, long max) {
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    return errno == 0 && end != text && *end == '\0' && value >= 1 && value <= max;
+}
+
+// MIN:MAX, both counts in [1, max]
+static bool is_count_pair(const char *text, long max) {
+    const char *colon = strchr(text, ':');
+    char first[32];
+    if (!colon || (size_t)(colon - text) >= sizeof(first)) {
+        return false;
+    }
+    memcpy(first, text, colon - text);
+    first[colon - text] = '\0';
+    return is_count(first, max) && is_count(colon + 1, max);
+}
+
+// A number in (0, max], as --memory-budget's megabytes
+static bool is_amount(const char *text, long max) {
+    char *end;
+    double value = strtod(text, &end);
+    return end != text && *end == '\0' && value > 0 && value <= (double)max;
+}
+
+// Resolves path (relative to the server's working directory) and checks that it names a
+// regular file under root. Returns the resolved path, or NULL.
+static char *resolve_under_root(const char *path, const char *root) {
+    char *resolved = realpath(path, NULL);
+    struct stat st;
+    size_t root_length = strlen(root);
+    bool inside = resolved && strncmp(resolved, root, root_length) == 0
+                  && (resolved[root_length] == '/' || root_length == 1); // Root "/" holds every path
+    if (!inside || stat(resolved, &st) == -1 || !S_ISREG(st.st_mode)) {
+        free(resolved);
+        return NULL;
+    }
+    return resolved;
+}
+
+// Builds the shard run's argv from a request, taking from it only what s_shard_options and the
+// positional arguments allow, so the peer chooses neither the options nor the files beyond
+// that. Returns false (reported) if the request asks for anything else. The shape is what
+// the coordinator sends: argv[0], --shard I/N, options, "--", then <buffer_size>
+// <num_workers> <log_file> [search_term...].
+static bool build_shard_argv(char **request, const char *root, char **argv) {
+    int argc = 0;
+    while (request[argc]) {
+        argc++;
+    }
+    int index, count, consumed = 0;
+    if (argc < 3 || strcmp(request[1], "--shard") != 0
+            || sscanf(request[2], "%d/%d%n", &index, &count, &consumed) != 2 || request[2][consumed] != '\0'
+            || count <= 0 || index < 0 || index >= count) {
+        return refuse_request("no valid --shard I/N", NULL);
+    }
+    int out = 0;
+    argv[out++] = "LogAnalyzer";
+    argv[out++] = "--shard";
+    argv[out++] = request[2];
+    int i = 3;
+    for (; i < argc && strcmp(request[i], "--") != 0; i++) {
+        const ShardOption *option = find_shard_option(request[i]);
+        if (!option) {
+            return refuse_request("option not allowed", request[i]);
+        }
+        argv[out++] = (char *)option->name; // The server's own copy of the name
+        if (option->value == SHARD_VALUE_NONE) {
+            continue;
+        }
+        if (++i == argc) {
+            return refuse_request("missing value", option->name);
+        }
+        if (option->value == SHARD_VALUE_PATH && !(argv[out] = resolve_under_root(request[i], root))) {
+            return refuse_request("not a file under the served root", request[i]);
+        }
+        bool in_range = option->value == SHARD_VALUE_COUNT ? is_count(request[i], option->max)
+                        : option->value == SHARD_VALUE_COUNT_PAIR ? is_count_pair(request[i], option->max)
+                        : option->value == SHARD_VALUE_AMOUNT ? is_amount(request[i], option->max)
+                        : true;
+        if (!in_range) {
+            return refuse_request("value out of range", option->name);
+        }
+        if (option->value != SHARD_VALUE_PATH) {
+            argv[out] = request[i];
+        }
+        out++;
+    }
+    if (i == argc) {
+        return refuse_request("no \"--\" before the positional arguments", NULL);
+    }
+    if (argc - (i + 1) < 3) {
+        return refuse_request("missing <buffer_size> <num_workers> <log_file>", NULL);
+    }
+    i++; // Past "--": search terms that look like options stay terms
+    argv[out++] = "--";
+    if (!is_count(request[i], SHARD_MAX_BUFFER_SIZE) || !is_count(request[i + 1], SHARD_MAX_WORKERS)) {
+        return refuse_request("buffer size or worker count out of range", NULL);
+    }
+    argv[out++] = request[i++];
+    argv[out++] = request[i++];
+    if (!(argv[out++] = resolve_under_root(request[i], root))) {
+        return refuse_request("not a file under the served root", request[i]);
+    }
+    for (i++; i < argc; i++) {
+        argv[out++] = request[i];
+    }
+    argv[out] = NULL;
+    return true;
+}
+
+// Child of the server, one per connection: becomes the shard run the request asks for, with
+// the connection as its stdout. Does not return.
+static void run_shard_request(int conn, const char *root) {
+    char **request = request_receive(conn);
+    if (!request) {
+        fprintf(stderr, "Dropped a malformed shard request.\n");
+        _exit(EXIT_FAILURE); // The coordinator sees the connection end and retries elsewhere
+    }
+    // Never longer than the request: each of its arguments is taken at most once, plus argv[0]
+    int request_argc = 0;
+    while (request[request_argc]) {
+        request_argc++;
+    }
+    char **argv = calloc(request_argc + 2, sizeof(char *));
+    if (!argv || !build_shard_argv(request, root, argv)) {
+        _exit(EXIT_FAILURE); // Only this process's memory, which exits here; nothing to free
+    }
+    setsid(); // Out of the server's process group, so a Ctrl-C meant for the server leaves it be
+    if (dup2(conn, STDOUT_FILENO) == -1) {
+        perror("dup2 failed");
+        _exit(EXIT_FAILURE);
+    }
+    close(conn);
+    execv("/proc/self/exe", argv);
+    perror("execv failed");
+    _exit(EXIT_FAILURE);
+}
+
+bool dist_serve(const char *bind_address, int port, const char *root) {
+    // Resolved once, so every request's paths are checked against the same directory
+    char *served_root = realpath(root, NULL);
+    struct stat st;
+    if (!served_root || stat(served_root, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Error: --serve-root %s is not a directory.\n", root);
+        free(served_root);
+        return false;
+    }
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    struct addrinfo *addresses;
+    int error = getaddrinfo(bind_address, service, &hints, &addresses);
+    if (error != 0) {
+        fprintf(stderr, "getaddrinfo for %s failed: %s\n", bind_address, gai_strerror(error));
+        free(served_root);
+        return false;
+    }
+    int listener = -1;
+    for (struct addrinfo *a = addresses; a && listener == -1; a = a->ai_next) {
+        listener = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (listener == -1) {
+            continue;
+        }
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(listener, a->ai_addr, a->ai_addrlen) == -1 || listen(listener, 16) == -1) {
+            close(listener);
+            listener = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (listener == -1) {
+        perror("Failed to listen for shard requests");
+        free(served_root);
+        return false;
+    }
+
+    signal(SIGCHLD, SIG_IGN); // Shard runs are reaped automatically
+    fprintf(stdout, "Serving shards on %s port %d, for files under %s.\n", bind_address, port, served_root);
+    fflush(stdout);
+    for (;;) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn == -1) {
+            if (errno != EINTR) {
+                // Out of fds or memory, say: the error would repeat right away, so give the
+                // shard runs a moment to finish and free some
+                perror("accept failed");
+                struct timespec delay = { ACCEPT_RETRY_DELAY_MS / 1000, (ACCEPT_RETRY_DELAY_MS % 1000) * 1000000L };
+                nanosleep(&delay, NULL);
+            }
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            run_shard_request(conn, served_root);
+        }
+        if (pid == -1) {
+            perror("fork failed"); // The coordinator sees the connection end and retries
+        }
+        close(conn);
+    }
+}
+
+// ---- Coordinator -------------------------------------------------------------------------
+
+typedef struct Coordinator Coordinator;
+
+typedef struct {
+    Coordinator *coordinator;
+    char name[300];  // HOST:PORT as given, for reports
+    char host[256];
+    char port[32];
+    pthread_t thread;
+    int fd;          // Connection in use, or -1 (under the coordinator's mutex)
+    int failures;    // Failed shard runs in a row
+} DistHost;
+
+struct Coordinator {
+    const DistJob *job;
+    DistStats *stats;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    // Shards queued again, or the last one finished
+    int *queue;             // Shards waiting for a host, oldest first
+    int queue_length;
+    int *attempts;          // Runs of each shard so far
+    int in_flight;
+    int live_hosts;         // Hosts still taking shards
+    bool stopping;
+    int threads_done;       // Host threads that returned (atomic)
+    DistHost *hosts;
+    int num_hosts;
+};
+
+// Splits the HOST:PORT list. [IPv6]:PORT is accepted too.
+static bool parse_hosts(Coordinator *c, const char *list) {
+    int count = 1;
+    for (const char *p = list; *p; p++) {
+        count += *p == ',';
+    }
+    c->hosts = calloc(count, sizeof(DistHost));
+    if (!c->hosts) {
+        perror("calloc for hosts failed");
+        return false;
+    }
+    const char *item = list;
+    for (int i = 0; i < count; i++) {
+        const char *end = strchr(item, ',');
+        size_t length = end ? (size_t)(end - item) : strlen(item);
+        DistHost *host = &c->hosts[i];
+        if (length == 0 || length >= sizeof(host->name)) {
+            fprintf(stderr, "Error: Invalid host in --coordinate list: \"%.*s\".\n", (int)length, item);
+            return false;
+        }
+        memcpy(host->name, item, length);
+        host->name[length] = '\0';
+        char *colon = strrchr(host->name, ':');
+        const char *name = host->name;
+        size_t name_length = colon ? (size_t)(colon - host->name) : 0;
+        if (name_length >= 2 && name[0] == '[' && name[name_length - 1] == ']') {
+            name++;
+            name_length -= 2;
+        }
+        if (!colon || name_length == 0 || name_length >= sizeof(host->host) || colon[1] == '\0'
+                || strlen(colon + 1) >= sizeof(host->port)) {
+            fprintf(stderr, "Error: Invalid host in --coordinate list: \"%s\" (use HOST:PORT).\n", host->name);
+            return false;
+        }
+        memcpy(host->host, name, name_length);
+        host->host[name_length] = '\0';
+        strcpy(host->port, colon + 1);
+        host->coordinator = c;
+        host->fd = -1;
+        item = end ? end + 1 : item + length;
+    }
+    c->num_hosts = count;
+    return true;
+}
+
+static bool timed_out(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+// Connects to a host with the job's timeouts set: DIST_IO_TIMEOUT_S for the connect and the
+// request, which a live host takes at once, and the job's shard timeout for the result
+static int connect_to(const DistHost *host, int shard_timeout_s, char *reason, size_t reason_size) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses;
+    int error = getaddrinfo(host->host, host->port, &hints, &addresses);
+    if (error != 0) {
+        snprintf(reason, reason_size, "%s", gai_strerror(error));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = addresses; a && fd == -1; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        struct timeval send_timeout = { DIST_IO_TIMEOUT_S, 0 }; // Also bounds connect on Linux
+        struct timeval receive_timeout = { shard_timeout_s, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout));
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == -1) {
+            if (timed_out()) {
+                snprintf(reason, reason_size, "connect: no answer within %d s", DIST_IO_TIMEOUT_S);
+            } else {
+                snprintf(reason, reason_size, "connect: %s", strerror(errno));
+            }
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+// Runs one shard on a host. Returns false, with a reason, if it has to be run again.
+static bool run_remote_shard(DistHost *host, int shard, ShardResult *result, char *reason, size_t reason_size) {
+    Coordinator *c = host->coordinator;
+    const DistJob *job = c->job;
+    int fd = connect_to(host, job->shard_timeout_s, reason, reason_size);
+    if (fd == -1) {
+        return false;
+    }
+    pthread_mutex_lock(&c->mutex);
+    bool stopping = c->stopping;
+    host->fd = stopping ? -1 : fd; // Shut down by dist_coordinate if the run is stopped meanwhile
+    pthread_mutex_unlock(&c->mutex);
+    if (stopping) {
+        close(fd);
+        snprintf(reason, reason_size, "stopped");
+        return false;
+    }
+
+    char shard_arg[32];
+    snprintf(shard_arg, sizeof(shard_arg), "%d/%d", shard, job->num_shards);
+    char *argv[job->argc + 3];
+    argv[0] = "LogAnalyzer";
+    argv[1] = "--shard";
+    argv[2] = shard_arg;
+    for (int i = 0; i < job->argc; i++) {
+        argv[i + 3] = job->argv[i];
+    }
+    // A host that accepts and then stalls times out here, and the shard is run again elsewhere
+    bool ok = false;
+    errno = 0;
+    if (!request_send(fd, job->argc + 3, argv)) {
+        snprintf(reason, reason_size, "send: %s", timed_out() ? "timed out" : strerror(errno));
+    } else if (errno = 0, !shard_result_receive(fd, result, job->num_patterns, job->with_groups)) {
+        if (timed_out()) {
+            snprintf(reason, reason_size, "no result within %d s", job->shard_timeout_s);
+        } else {
+            snprintf(reason, reason_size, "connection ended without a valid result");
+        }
+    } else if (result->status == SHARD_FAILED) {
+        snprintf(reason, reason_size, "the shard run reported an error");
+        shard_result_free(result);
+    } else {
+        ok = true;
+    }
+
+    pthread_mutex_lock(&c->mutex);
+    host->fd = -1;
+    pthread_mutex_unlock(&c->mutex);
+    close(fd);
+    return ok;
+}
+
+// One per host: takes queued shards and runs them there, one at a time, until none are left
+// or the host has failed DIST_HOST_MAX_FAILURES times in a row
+static void *host_function(void *arg) {
+    DistHost *host = arg;
+    Coordinator *c = host->coordinator;
+    const DistJob *job = c->job;
+    pthread_mutex_lock(&c->mutex);
+    for (;;) {
+        while (c->queue_length == 0 && c->in_flight > 0 && !c->stopping) {
+            pthread_cond_wait(&c->cond, &c->mutex); // A shard still running may yet fail and come back
+        }
+        if (c->queue_length == 0 || c->stopping) {
+            break;
+        }
+        int shard = c->queue[0];
+        memmove(c->queue, c->queue + 1, sizeof(int) * --c->queue_length);
+        c->in_flight++;
+        pthread_mutex_unlock(&c->mutex);
+
+        ShardResult result;
+        char reason[160] = "unknown error";
+        bool ok = run_remote_shard(host, shard, &result, reason, sizeof(reason));
+
+        pthread_mutex_lock(&c->mutex);
+        c->in_flight--;
+        bool retire = false;
+        if (ok) {
+            job->merge(&result, job->ctx);
+            shard_result_free(&result);
+            c->stats->completed++;
+            host->failures = 0;
+            fprintf(job->report, "Shard %d/%d done on %s: %llu matches.\n", shard, job->num_shards, host->name,
+                    (unsigned long long)result.matches);
+        } else {
+            c->attempts[shard]++;
+            host->failures++;
+            if (c->stopping) {
+                c->stats->failed++;
+            } else if (c->attempts[shard] >= DIST_MAX_ATTEMPTS) {
+                c->stats->failed++;
+                fprintf(stderr, "Shard %d/%d failed on %s (%s); giving up after %d attempts.\n",
+                        shard, job->num_shards, host->name, reason, c->attempts[shard]);
+            } else {
+                c->queue[c->queue_length++] = shard;
+                c->stats->retried++;
+                fprintf(stderr, "Shard %d/%d failed on %s (%s); retrying.\n", shard, job->num_shards, host->name, reason);
+            }
+            if (host->failures >= DIST_HOST_MAX_FAILURES && !c->stopping) {
+                fprintf(stderr, "Host %s failed %d times in a row; no more shards for it.\n", host->name, host->failures);
+                retire = true;
+                if (--c->live_hosts == 0) {
+                    c->stats->failed += c->queue_length; // Nobody left to run them
+                    c->queue_length = 0;
+                }
+            }
+        }
+        pthread_cond_broadcast(&c->cond);
+        if (retire) {
+            break;
+        }
+        if (!ok) {
+            // Back off before the next shard, so a host that is restarting gets a moment
+            pthread_mutex_unlock(&c->mutex);
+            long delay_ms = (long)RETRY_DELAY_MS * host->failures;
+            struct timespec delay = { delay_ms / 1000, (delay_ms % 1000) * 1000000L };
+            nanosleep(&delay, NULL);
+            pthread_mutex_lock(&c->mutex);
+        }
+    }
+    pthread_mutex_unlock(&c->mutex);
+    __atomic_fetch_add(&c->threads_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+bool dist_coordinate(const DistJob *job, DistStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    signal(SIGPIPE, SIG_IGN); // A host that hangs up mid-request is a failed run, not a fatal signal
+    Coordinator c;
+    memset(&c, 0, sizeof(c));
+    c.job = job;
+    c.stats = stats;
+    if (!parse_hosts(&c, job->hosts)) {
+        free(c.hosts);
+        return false;
+    }
+    stats->hosts = c.num_hosts;
+    c.queue = malloc(sizeof(int) * job->num_shards);
+    c.attempts = calloc(job->num_shards, sizeof(int));
+    if (!c.queue || !c.attempts) {
+        perror("malloc for shard queue failed");
+        free(c.queue);
+        free(c.attempts);
+        free(c.hosts);
+        return false;
+    }
+    for (int i = 0; i < job->num_shards; i++) {
+        c.queue[i] = i;
+    }
+    c.queue_length = job->num_shards;
+    pthread_mutex_init(&c.mutex, NULL);
+    pthread_cond_init(&c.cond, NULL);
+
+    // Host threads block SIGINT, so it reaches this thread and can stop the run
+    sigset_t block, previous;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &previous);
+    int started = 0;
+    for (int i = 0; i < c.num_hosts; i++) {
+        if (pthread_create(&c.hosts[i].thread, NULL, host_function, &c.hosts[i]) != 0) {
+            perror("pthread_create for host failed");
+            break;
+        }
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    pthread_mutex_lock(&c.mutex);
+    c.live_hosts = started;
+    if (started == 0) {
+        stats->failed = c.queue_length;
+        c.queue_length = 0;
+    }
+    pthread_cond_broadcast(&c.cond);
+    pthread_mutex_unlock(&c.mutex);
+
+    while (__atomic_load_n(&c.threads_done, __ATOMIC_ACQUIRE) < started) {
+        struct timespec delay = { 0, 50 * 1000000L };
+        nanosleep(&delay, NULL); // Cut short by SIGINT
+        if (*job->stop && !c.stopping) {
+            pthread_mutex_lock(&c.mutex);
+            c.stopping = true;
+            stats->failed += c.queue_length; // Never handed out
+            c.queue_length = 0;
+            for (int i = 0; i < c.num_hosts; i++) {
+                if (c.hosts[i].fd != -1) {
+                    shutdown(c.hosts[i].fd, SHUT_RDWR); // Ends the read of the result
+                }
+            }
+            pthread_cond_broadcast(&c.cond);
+            pthread_mutex_unlock(&c.mutex);
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(c.hosts[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&c.mutex);
+    pthread_cond_destroy(&c.cond);
+    free(c.queue);
+    free(c.attempts);
+    free(c.hosts);
+    return stats->completed == job->num_shards;
+}
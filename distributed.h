@@ -0,0 +1,124 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "group_table.h"
+
+/*
+ * Coordinator/worker mode over TCP, for logs too big for one host to scan in time.
+ *
+ * Each host runs `LogAnalyzer --serve PORT`. For every connection the server forks, reads one
+ * shard request (the command line of a LogAnalyzer run, including --shard I/N) and re-executes
+ * itself with it, so each shard is an ordinary local run (Buffer, worker_function and all) of
+ * its own process, restricted to the I-th of N line-aligned byte ranges of the file. The run
+ * writes its counts back over the connection as a ShardResult instead of printing them. The
+ * server builds that command line itself, from the options of a fixed list that a shard run
+ * may take and from files under the directory it serves; a request asking for anything else
+ * is refused.
+ *
+ * The coordinator (`--coordinate HOST:PORT,...`) keeps one connection per host busy, hands out
+ * the shards as hosts become free, merges the results as they arrive and gives a failed shard
+ * to the next free host, up to DIST_MAX_ATTEMPTS times. A shard whose result does not arrive
+ * within the job's shard timeout has failed too, so a host that stalls cannot hold up the run.
+ * Every host must see the same file at the same path (shared storage or identical copies),
+ * since each works out its range itself.
+ *
+ * Requests and results are length-prefixed little-endian binary. There is no authentication:
+ * anyone who can reach a server can have it scan its files, so it listens on loopback unless
+ * given another address, which should be on a trusted network.
+ */
+
+#define DIST_DEFAULT_BIND "127.0.0.1" // What --serve listens on without --bind
+
+#define DIST_MAX_ATTEMPTS 3      // Runs of one shard before it counts as failed
+#define DIST_HOST_MAX_FAILURES 3 // Failures in a row after which a host gets no more shards
+#define DIST_SHARDS_PER_HOST 4   // Default --shards per host, so a slow host does not hold up the rest
+#define DIST_DEFAULT_SHARD_TIMEOUT_S 600 // Default --shard-timeout: wait for one shard's result
+
+typedef enum {
+    SHARD_COMPLETE = 0, // Every line of the shard was scanned
+    SHARD_LIMITED = 1,  // The run stopped at --max-count; the counts are enough to answer it
+    SHARD_FAILED = 2    // Read error or interrupted: the counts are partial, run the shard again
+} ShardStatus;
+
+/**
+ * @brief Counts of one shard, as sent from a shard run to the coordinator.
+ */
+typedef struct {
+    uint32_t status;          // ShardStatus
+    uint64_t matches;         // Lines matching any term
+    uint32_t num_patterns;
+    uint64_t *pattern_counts; // Matches per pattern, num_patterns entries
+    GroupTable *groups;       // --group-by counts, or NULL without --group-by
+} ShardResult;
+
+/**
+ * @brief Writes a result to a socket or pipe. Retries short writes.
+ * @return false on a write error (reported with perror).
+ */
+bool shard_result_send(int fd, const ShardResult *result);
+
+/**
+ * @brief Reads a result written by shard_result_send, allocating its arrays.
+ * @param fd Where to read from.
+ * @param result Receives the result; free it with shard_result_free.
+ * @param num_patterns The number of patterns the result must carry.
+ * @param with_groups Whether the result must carry --group-by counts.
+ * @return false if the connection ended early or the result is malformed; nothing is left allocated.
+ */
+bool shard_result_receive(int fd, ShardResult *result, uint32_t num_patterns, bool with_groups);
+
+/**
+ * @brief Frees what shard_result_receive allocated.
+ */
+void shard_result_free(ShardResult *result);
+
+/**
+ * @brief Serves shard requests on a TCP port until the process is killed.
+ * @param bind_address Local address to listen on, such as DIST_DEFAULT_BIND or "0.0.0.0".
+ * @param port TCP port to listen on.
+ * @param root Directory whose files (at any depth) requests may scan and read patterns from.
+ * @return false if root is not a directory or the port cannot be listened on (reported);
+ *         otherwise it does not return.
+ */
+bool dist_serve(const char *bind_address, int port, const char *root);
+
+/**
+ * @brief One distributed run, as set up by the coordinator.
+ */
+typedef struct {
+    const char *hosts;       // Comma-separated HOST:PORT list
+    int num_shards;
+    int shard_timeout_s;     // Seconds to wait for a shard's result before running it again
+    int argc;                // Command line for each shard run, without argv[0]; --shard I/N is added
+    char *const *argv;
+    uint32_t num_patterns;   // Expected in every result
+    bool with_groups;        // Whether results carry --group-by counts
+    void (*merge)(const ShardResult *result, void *ctx); // Called for each completed shard, one at a time
+    void *ctx;
+    volatile sig_atomic_t *stop; // Set (by SIGINT) to abandon the run
+    FILE *report;            // Progress lines
+} DistJob;
+
+/**
+ * @brief How a distributed run went.
+ */
+typedef struct {
+    int hosts;     // Hosts in the list
+    int completed; // Shards merged
+    int retried;   // Shard runs that failed and were handed out again
+    int failed;    // Shards given up on: after DIST_MAX_ATTEMPTS runs, or with no host left, or stopped
+} DistStats;
+
+/**
+ * @brief Runs every shard of a job on the hosts and merges the results.
+ * @param job The job.
+ * @param stats Receives how it went.
+ * @return true if every shard was merged.
+ */
+bool dist_coordinate(const DistJob *job, DistStats *stats);
+
+#endif // DISTRIBUTED_H
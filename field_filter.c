@@ -0,0 +1,175 @@
+#define _GNU_SOURCE // For memmem
+#include "field_filter.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const s_field_names[CLF_NUM_FIELDS] = {
+    "ip", "ident", "user", "time", "method", "path", "protocol", "status", "bytes"
+};
+
+// Tokenizer position within one line. Fields are produced strictly in ClfField order.
+typedef struct {
+    const char *p;
+    const char *end;
+    int next_field;                 // Field the next clf_next_field call returns
+    const char *request[3];         // Method, path and protocol, split when the request is reached
+    size_t request_len[3];
+} ClfCursor;
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    return p;
+}
+
+// Returns the first c at or after p, or end if there is none
+static const char *find_byte(const char *p, const char *end, char c) {
+    const char *found = memchr(p, c, (size_t)(end - p));
+    return found ? found : end;
+}
+
+// Produces the next field of the line. Returns false when the line has no more fields.
+static bool clf_next_field(ClfCursor *cursor, const char **start, size_t *length) {
+    int field = cursor->next_field;
+    if (field >= CLF_NUM_FIELDS) {
+        return false;
+    }
+    cursor->next_field = field + 1;
+
+    if (field > CLF_METHOD && field <= CLF_PROTOCOL) {
+        *start = cursor->request[field - CLF_METHOD]; // Split along with the method
+        *length = cursor->request_len[field - CLF_METHOD];
+        return true;
+    }
+
+    const char *p = skip_spaces(cursor->p, cursor->end);
+    const char *end = cursor->end;
+    if (p == end) {
+        return false;
+    }
+    if (field == CLF_METHOD) {
+        // Split the whole quoted request line at once; a short request such as "-" leaves
+        // the missing words empty
+        const char *close = *p == '"' ? memchr(p + 1, '"', (size_t)(end - p - 1)) : NULL;
+        if (!close) {
+            return false;
+        }
+        const char *word = p + 1;
+        for (int k = 0; k < 3; k++) {
+            const char *stop = k < 2 ? find_byte(word, close, ' ') : close;
+            cursor->request[k] = word;
+            cursor->request_len[k] = (size_t)(stop - word);
+            word = stop < close ? stop + 1 : close;
+        }
+        cursor->p = close + 1;
+        *start = cursor->request[0];
+        *length = cursor->request_len[0];
+    } else if (field == CLF_TIME && *p == '[') {
+        const char *close = memchr(p, ']', (size_t)(end - p));
+        if (!close) {
+            return false;
+        }
+        *start = p + 1;
+        *length = (size_t)(close - p - 1);
+        cursor->p = close + 1;
+    } else {
+        const char *stop = find_byte(p, end, ' ');
+        *start = p;
+        *length = (size_t)(stop - p);
+        cursor->p = stop;
+    }
+    return true;
+}
+
+int clf_field_from_name(const char *name, size_t name_len) {
+    for (int field = 0; field < CLF_NUM_FIELDS; field++) {
+        if (strlen(s_field_names[field]) == name_len && strncmp(name, s_field_names[field], name_len) == 0) {
+            return field;
+        }
+    }
+    return -1;
+}
+
+const char *clf_field_name(ClfField field) {
+    return s_field_names[field];
+}
+
+bool clf_get_field(const char *line, size_t length, ClfField field, const char **start, size_t *field_len) {
+    ClfCursor cursor = { line, line + length, 0, { NULL, NULL, NULL }, { 0, 0, 0 } };
+    for (int current = 0; current <= (int)field; current++) {
+        if (!clf_next_field(&cursor, start, field_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void filter_init(FieldFilter *filter) {
+    filter->predicates = NULL;
+    filter->count = 0;
+}
+
+bool filter_add(FieldFilter *filter, const char *expr) {
+    size_t name_len = strcspn(expr, "=~");
+    if (expr[name_len] == '\0') {
+        return false; // No operator
+    }
+    int field = clf_field_from_name(expr, name_len);
+    if (field < 0) {
+        return false; // Unknown field
+    }
+
+    FieldPredicate *grown = realloc(filter->predicates, sizeof(FieldPredicate) * (filter->count + 1));
+    if (!grown) {
+        return false;
+    }
+    filter->predicates = grown;
+    FieldPredicate predicate = { (ClfField)field, expr[name_len] == '~', strdup(expr + name_len + 1), 0 };
+    if (!predicate.value) {
+        return false;
+    }
+    predicate.value_len = strlen(predicate.value);
+
+    // Insert in field order (stable for equal fields)
+    int i = filter->count;
+    while (i > 0 && filter->predicates[i - 1].field > predicate.field) {
+        filter->predicates[i] = filter->predicates[i - 1];
+        i--;
+    }
+    filter->predicates[i] = predicate;
+    filter->count++;
+    return true;
+}
+
+void filter_destroy(FieldFilter *filter) {
+    for (int i = 0; i < filter->count; i++) {
+        free(filter->predicates[i].value);
+    }
+    free(filter->predicates);
+    filter_init(filter);
+}
+
+bool filter_match_line(const FieldFilter *filter, const char *line, size_t length) {
+    ClfCursor cursor = { line, line + length, 0, { NULL, NULL, NULL }, { 0, 0, 0 } };
+    const char *start = NULL;
+    size_t field_len = 0;
+    int current = -1; // Field held in start/field_len
+
+    for (int i = 0; i < filter->count; i++) {
+        const FieldPredicate *predicate = &filter->predicates[i];
+        while (current < (int)predicate->field) {
+            if (!clf_next_field(&cursor, &start, &field_len)) {
+                return false;
+            }
+            current++;
+        }
+        bool ok = predicate->contains
+            ? memmem(start, field_len, predicate->value, predicate->value_len) != NULL
+            : field_len == predicate->value_len && memcmp(start, predicate->value, field_len) == 0;
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
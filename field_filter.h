@@ -0,0 +1,92 @@
+#ifndef FIELD_FILTER_H
+#define FIELD_FILTER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Field-aware predicates over Common Log Format lines:
+ *   ip ident user [time] "method path protocol" status bytes
+ * An expression is <field>=<value> (the field equals value) or <field>~<value> (the field
+ * contains value), e.g. status=404 or path~/api/. A line matches a filter when it satisfies
+ * every predicate. Lines are tokenized in place, without allocating, and only as far as the
+ * last field the predicates need; a line too short or malformed to have a field fails any
+ * predicate on it.
+ */
+typedef enum {
+    CLF_IP,
+    CLF_IDENT,
+    CLF_USER,
+    CLF_TIME,     // Without the surrounding brackets
+    CLF_METHOD,   // First word of the quoted request line
+    CLF_PATH,
+    CLF_PROTOCOL,
+    CLF_STATUS,
+    CLF_BYTES,
+    CLF_NUM_FIELDS
+} ClfField;
+
+typedef struct {
+    ClfField field;
+    bool contains;     // '~': substring match; '=': exact match
+    char *value;
+    size_t value_len;
+} FieldPredicate;
+
+typedef struct {
+    FieldPredicate *predicates; // Sorted by field, so one left-to-right tokenizer pass checks them all
+    int count;
+} FieldFilter;
+
+/**
+ * @brief Looks up a field by its name ("ip", "status", ...).
+ * @param name Start of the name. It does not need to be NUL-terminated.
+ * @param name_len Length of the name.
+ * @return The field, or -1 if there is no field with that name.
+ */
+int clf_field_from_name(const char *name, size_t name_len);
+
+/**
+ * @brief Returns the name of a field, as accepted by clf_field_from_name.
+ */
+const char *clf_field_name(ClfField field);
+
+/**
+ * @brief Extracts one field of a line (without its '\n'), tokenizing only up to that field.
+ * @param line Start of the line. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the line.
+ * @param field The field to extract.
+ * @param start Receives the start of the field, which points into line.
+ * @param field_len Receives the length of the field.
+ * @return false if the line is too short or malformed to have the field.
+ */
+bool clf_get_field(const char *line, size_t length, ClfField field, const char **start, size_t *field_len);
+
+/**
+ * @brief Initializes an empty filter, which matches every line.
+ */
+void filter_init(FieldFilter *filter);
+
+/**
+ * @brief Parses an expression such as "status=404" and adds it to the filter.
+ * @param filter Pointer to the FieldFilter struct.
+ * @param expr The expression.
+ * @return false if the field name or operator is invalid, or on allocation failure.
+ */
+bool filter_add(FieldFilter *filter, const char *expr);
+
+/**
+ * @brief Frees the predicates of a filter.
+ */
+void filter_destroy(FieldFilter *filter);
+
+/**
+ * @brief Checks one line (without its '\n') against every predicate of the filter.
+ * @param filter The filter.
+ * @param line Start of the line. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the line.
+ * @return true if the line satisfies all predicates.
+ */
+bool filter_match_line(const FieldFilter *filter, const char *line, size_t length);
+
+#endif // FIELD_FILTER_H
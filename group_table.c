@@ -0,0 +1,213 @@
+#include "group_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define GROUP_INITIAL_SLOTS 1024        // Power of two
+#define GROUP_KEY_BLOCK_SIZE (64 * 1024) // Regular size of a key store block
+
+// One slot; count == 0 marks an empty slot, since every inserted key has a positive count
+typedef struct {
+    uint64_t hash;
+    const char *key;
+    size_t key_len;
+    uint64_t count;
+} GroupSlot;
+
+// Keys are copied into large blocks instead of one malloc each
+typedef struct KeyBlock {
+    struct KeyBlock *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} KeyBlock;
+
+struct GroupTable {
+    GroupSlot *slots;
+    size_t mask;       // Number of slots - 1
+    size_t size;       // Occupied slots
+    KeyBlock *keys;    // Newest block first
+};
+
+static void *group_alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        perror("Failed to allocate group-by table");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// FNV-1a; keys are short fields such as IPs, status codes and paths
+static uint64_t hash_key(const char *key, size_t key_len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < key_len; i++) {
+        hash = (hash ^ (unsigned char)key[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static const char *store_key(GroupTable *table, const char *key, size_t key_len) {
+    KeyBlock *block = table->keys;
+    if (block == NULL || block->capacity - block->used < key_len) {
+        size_t capacity = key_len > GROUP_KEY_BLOCK_SIZE ? key_len : GROUP_KEY_BLOCK_SIZE;
+        block = group_alloc(sizeof(KeyBlock) + capacity);
+        block->capacity = capacity;
+        block->next = table->keys;
+        table->keys = block;
+    }
+    char *copy = block->data + block->used;
+    memcpy(copy, key, key_len);
+    block->used += key_len;
+    return copy;
+}
+
+// Returns the slot holding the key, or the empty slot where it belongs
+static GroupSlot *find_slot(GroupSlot *slots, size_t mask, uint64_t hash, const char *key, size_t key_len) {
+    size_t i = (size_t)hash & mask;
+    for (;;) {
+        GroupSlot *slot = &slots[i];
+        if (slot->count == 0 ||
+            (slot->hash == hash && slot->key_len == key_len && memcmp(slot->key, key, key_len) == 0)) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// Doubles the slot array; keys stay where they are in the key store
+static void grow(GroupTable *table) {
+    size_t new_mask = table->mask * 2 + 1;
+    GroupSlot *slots = group_alloc(sizeof(GroupSlot) * (new_mask + 1));
+    for (size_t i = 0; i <= table->mask; i++) {
+        GroupSlot *old = &table->slots[i];
+        if (old->count != 0) {
+            *find_slot(slots, new_mask, old->hash, old->key, old->key_len) = *old;
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->mask = new_mask;
+}
+
+GroupTable *group_table_create(void) {
+    GroupTable *table = group_alloc(sizeof(GroupTable));
+    table->slots = group_alloc(sizeof(GroupSlot) * GROUP_INITIAL_SLOTS);
+    table->mask = GROUP_INITIAL_SLOTS - 1;
+    return table;
+}
+
+void group_table_destroy(GroupTable *table) {
+    if (!table) {
+        return;
+    }
+    while (table->keys) {
+        KeyBlock *next = table->keys->next;
+        free(table->keys);
+        table->keys = next;
+    }
+    free(table->slots);
+    free(table);
+}
+
+static void add_hashed(GroupTable *table, uint64_t hash, const char *key, size_t key_len, uint64_t count) {
+    GroupSlot *slot = find_slot(table->slots, table->mask, hash, key, key_len);
+    if (slot->count == 0) {
+        if ((table->size + 1) * 4 > (table->mask + 1) * 3) { // Keep the load factor below 3/4
+            grow(table);
+            slot = find_slot(table->slots, table->mask, hash, key, key_len);
+        }
+        slot->hash = hash;
+        slot->key = store_key(table, key, key_len);
+        slot->key_len = key_len;
+        table->size++;
+    }
+    slot->count += count;
+}
+
+void group_table_add(GroupTable *table, const char *key, size_t key_len, uint64_t count) {
+    if (count > 0) {
+        add_hashed(table, hash_key(key, key_len), key, key_len, count);
+    }
+}
+
+size_t group_table_size(const GroupTable *table) {
+    return table->size;
+}
+
+void group_table_merge(GroupTable *dst, const GroupTable *src) {
+    for (size_t i = 0; i <= src->mask; i++) {
+        const GroupSlot *slot = &src->slots[i];
+        if (slot->count != 0) {
+            add_hashed(dst, slot->hash, slot->key, slot->key_len, slot->count); // Reuse the stored hash
+        }
+    }
+}
+
+// true if a ranks below b: smaller count, or equal count and larger key
+static bool ranks_below(const GroupEntry *a, const GroupEntry *b) {
+    if (a->count != b->count) {
+        return a->count < b->count;
+    }
+    size_t n = a->key_len < b->key_len ? a->key_len : b->key_len;
+    int cmp = memcmp(a->key, b->key, n);
+    return cmp != 0 ? cmp > 0 : a->key_len > b->key_len;
+}
+
+static void sift_down(GroupEntry *heap, int n, int i) {
+    for (;;) {
+        int lowest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < n && ranks_below(&heap[left], &heap[lowest])) {
+            lowest = left;
+        }
+        if (right < n && ranks_below(&heap[right], &heap[lowest])) {
+            lowest = right;
+        }
+        if (lowest == i) {
+            return;
+        }
+        GroupEntry tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+int group_table_top(const GroupTable *table, GroupEntry *out, int k) {
+    // out[] is a min-heap of the best k seen so far, so a pass costs O(size * log k)
+    int n = 0;
+    for (size_t i = 0; k > 0 && i <= table->mask; i++) {
+        const GroupSlot *slot = &table->slots[i];
+        if (slot->count == 0) {
+            continue;
+        }
+        GroupEntry entry = { slot->key, slot->key_len, slot->count };
+        if (n < k) {
+            out[n++] = entry;
+            if (n == k) {
+                for (int j = k / 2 - 1; j >= 0; j--) {
+                    sift_down(out, n, j);
+                }
+            }
+        } else if (ranks_below(&out[0], &entry)) {
+            out[0] = entry;
+            sift_down(out, n, 0);
+        }
+    }
+    if (n < k) {
+        for (int j = n / 2 - 1; j >= 0; j--) {
+            sift_down(out, n, j);
+        }
+    }
+    // Heap sort in place: repeatedly move the lowest to the back, leaving the highest first
+    for (int end = n - 1; end > 0; end--) {
+        GroupEntry tmp = out[0];
+        out[0] = out[end];
+        out[end] = tmp;
+        sift_down(out, end, 0);
+    }
+    return n;
+}
@@ -0,0 +1,59 @@
+#ifndef GROUP_TABLE_H
+#define GROUP_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Counting hash table for --group-by: open addressing with linear probing and a table-owned
+ * key store. Each worker fills its own table with no locking; the tables are merged once, by
+ * the last worker to finish (or the manager, if it finishes last), as it prints the summary
+ * from reduce_release.
+ */
+typedef struct GroupTable GroupTable;
+
+typedef struct {
+    const char *key;   // Points into the table's key store; not NUL-terminated
+    size_t key_len;
+    uint64_t count;
+} GroupEntry;
+
+/**
+ * @brief Creates an empty table. Exits on allocation failure, like buffer_init.
+ */
+GroupTable *group_table_create(void);
+
+/**
+ * @brief Frees a table created by group_table_create. NULL is ignored.
+ */
+void group_table_destroy(GroupTable *table);
+
+/**
+ * @brief Adds count to the entry for a key, inserting a copy of the key if it is new.
+ * @param table The table.
+ * @param key Start of the key. It does not need to be NUL-terminated.
+ * @param key_len Length of the key in bytes.
+ * @param count Amount to add.
+ */
+void group_table_add(GroupTable *table, const char *key, size_t key_len, uint64_t count);
+
+/**
+ * @brief Returns the number of distinct keys.
+ */
+size_t group_table_size(const GroupTable *table);
+
+/**
+ * @brief Adds every entry of src into dst. src is left unchanged.
+ */
+void group_table_merge(GroupTable *dst, const GroupTable *src);
+
+/**
+ * @brief Returns the k entries with the highest counts, highest first; ties are ordered by key.
+ * @param table The table.
+ * @param out Receives up to k entries; they stay valid until the table is modified or destroyed.
+ * @param k Maximum number of entries.
+ * @return The number of entries written, min(k, group_table_size(table)).
+ */
+int group_table_top(const GroupTable *table, GroupEntry *out, int k);
+
+#endif // GROUP_TABLE_H
@@ -0,0 +1,55 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdint.h>
+
+/*
+ * Optional hot-path instrumentation for the queues, enabled by building with
+ * -DLOG_INSTRUMENT (make INSTRUMENT=1). It records how long producers and consumers
+ * block waiting for space or items and samples queue occupancy. Without the flag the
+ * counters are not compiled in and every hook below expands to nothing.
+ * Counters are updated and read with relaxed atomics, so they can be dumped while the
+ * run is in progress (SIGUSR1).
+ */
+#ifdef LOG_INSTRUMENT
+
+#include "stats.h"
+
+#define INSTRUMENT_ENABLED 1
+#define OCCUPANCY_BUCKETS 11 // Fill level in tenths of capacity: 0 is empty, 10 is full
+
+typedef struct {
+    uint64_t push_wait_ns;                 // Time producers blocked waiting for space
+    uint64_t push_waits;                   // Number of such waits
+    uint64_t pop_wait_ns;                  // Time consumers blocked waiting for items
+    uint64_t pop_waits;
+    uint64_t occupancy[OCCUPANCY_BUCKETS]; // Fill level seen by each push and pop call
+} BufferInstrument;
+
+static inline void instrument_wait_done(uint64_t *wait_ns, uint64_t *waits, uint64_t start_ns) {
+    __atomic_fetch_add(wait_ns, stats_now_ns() - start_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(waits, 1, __ATOMIC_RELAXED);
+}
+
+static inline void instrument_occupancy(BufferInstrument *instrument, uint64_t count, uint64_t capacity) {
+    __atomic_fetch_add(&instrument->occupancy[count * (OCCUPANCY_BUCKETS - 1) / capacity], 1, __ATOMIC_RELAXED);
+}
+
+#define INSTRUMENT_NOW() stats_now_ns()
+#define INSTRUMENT_PUSH_WAIT_DONE(instrument, start) \
+    instrument_wait_done(&(instrument)->push_wait_ns, &(instrument)->push_waits, (start))
+#define INSTRUMENT_POP_WAIT_DONE(instrument, start) \
+    instrument_wait_done(&(instrument)->pop_wait_ns, &(instrument)->pop_waits, (start))
+#define INSTRUMENT_OCCUPANCY(instrument, count, capacity) instrument_occupancy((instrument), (count), (capacity))
+
+#else
+
+#define INSTRUMENT_ENABLED 0
+#define INSTRUMENT_NOW() ((uint64_t)0)
+#define INSTRUMENT_PUSH_WAIT_DONE(instrument, start) ((void)(start))
+#define INSTRUMENT_POP_WAIT_DONE(instrument, start) ((void)(start))
+#define INSTRUMENT_OCCUPANCY(instrument, count, capacity) ((void)0)
+
+#endif // LOG_INSTRUMENT
+
+#endif // INSTRUMENT_H
@@ -0,0 +1,150 @@
+#include "line_arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+// The reference count starts at a large bias instead of being bumped for every line: the
+// producer counts the lines it hands out privately and folds that count in with a single
+// atomic when it retires the chunk. Consumers can decrement freely in the meantime without
+// ever reaching zero early, since the bias is far above any possible number of lines.
+#define CHUNK_REF_BIAS (1L << 40)
+
+struct LineChunk {
+    long refcount;       // CHUNK_REF_BIAS - released lines while filling; outstanding lines once retired
+    long handed_out;     // Lines copied into this chunk (producer only)
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+// Binds the whole pages of a fresh chunk's data to a NUMA node before anything touches them,
+// so they are allocated there rather than next to the manager that fills them
+static void chunk_place(LineChunk *chunk, int node) {
+#ifdef HAVE_NUMA
+    if (node < 0 || numa_available() == -1) {
+        return;
+    }
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)chunk->data + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)chunk->data + chunk->capacity) & ~(page - 1);
+    unsigned long node_mask = node < (int)(sizeof(unsigned long) * 8) ? 1UL << node : 0;
+    if (end > start && node_mask != 0) {
+        // Best effort and silent (numa_tonode_memory would print): a failure only costs locality
+        mbind((void *)start, end - start, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8, 0);
+    }
+#else
+    (void)chunk;
+    (void)node;
+#endif
+}
+
+static LineChunk *chunk_create(size_t capacity, int node) {
+    LineChunk *chunk = malloc(sizeof(LineChunk) + capacity);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->refcount = CHUNK_REF_BIAS;
+    chunk->handed_out = 0;
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    chunk_place(chunk, node);
+    return chunk;
+}
+
+// Producer side: stop filling a chunk and let the outstanding lines own it
+static void chunk_retire(LineChunk *chunk) {
+    long remaining = __atomic_sub_fetch(&chunk->refcount, CHUNK_REF_BIAS - chunk->handed_out, __ATOMIC_ACQ_REL);
+    if (remaining == 0) {
+        free(chunk); // Every line was already released
+    }
+}
+
+void chunk_release(LineChunk *chunk) {
+    if (__atomic_sub_fetch(&chunk->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(chunk);
+    }
+}
+
+void arena_init(LineArena *arena, size_t chunk_size) {
+    arena->current = NULL;
+    arena->chunk_size = chunk_size;
+    arena->pending = 0;
+    arena->node = -1;
+}
+
+void arena_set_node(LineArena *arena, int node) {
+    arena->node = node;
+}
+
+char *arena_copy(LineArena *arena, const char *src, size_t length, LineChunk **chunk_out) {
+    size_t needed = length + 1; // Room for the NUL terminator
+    LineChunk *chunk = arena->current;
+    if (chunk == NULL || chunk->capacity - chunk->used < needed) {
+        if (chunk != NULL) {
+            chunk_retire(chunk);
+            arena->current = NULL;
+        }
+        chunk = chunk_create(needed > arena->chunk_size ? needed : arena->chunk_size, arena->node);
+        if (!chunk) {
+            return NULL;
+        }
+        arena->current = chunk;
+    }
+
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, src, length);
+    copy[length] = '\0';
+    chunk->used += needed;
+    chunk->handed_out++;
+    *chunk_out = chunk;
+    return copy;
+}
+
+void arena_destroy(LineArena *arena) {
+    if (arena->current) {
+        chunk_retire(arena->current);
+        arena->current = NULL;
+    }
+}
+
+char *arena_prepare_write(LineArena *arena, size_t min_free, size_t *free_out) {
+    LineChunk *chunk = arena->current;
+    if (chunk == NULL || chunk->capacity - chunk->used - arena->pending < min_free) {
+        size_t needed = arena->pending + min_free;
+        LineChunk *fresh = chunk_create(needed > arena->chunk_size ? needed : arena->chunk_size, arena->node);
+        if (!fresh) {
+            return NULL;
+        }
+        if (chunk != NULL) {
+            memcpy(fresh->data, chunk->data + chunk->used, arena->pending); // Carry the partial line over
+            chunk_retire(chunk);
+        }
+        arena->current = chunk = fresh;
+    }
+    *free_out = chunk->capacity - chunk->used - arena->pending;
+    return chunk->data + chunk->used + arena->pending;
+}
+
+void arena_wrote(LineArena *arena, size_t n) {
+    arena->pending += n;
+}
+
+char *arena_pending(LineArena *arena, size_t *length_out) {
+    *length_out = arena->pending;
+    return arena->current ? arena->current->data + arena->current->used : NULL;
+}
+
+char *arena_commit(LineArena *arena, size_t length, LineChunk **chunk_out) {
+    LineChunk *chunk = arena->current;
+    char *start = chunk->data + chunk->used;
+    chunk->used += length;
+    arena->pending -= length;
+    chunk->handed_out++;
+    *chunk_out = chunk;
+    return start;
+}
@@ -0,0 +1,94 @@
+#ifndef LINE_ARENA_H
+#define LINE_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Slab storage for lines read by the manager. Lines are copied back to back into large
+ * chunks instead of being malloc'd one by one; each chunk is reference counted and freed
+ * as a whole once the manager has moved on and every line in it has been released.
+ */
+
+typedef struct LineChunk LineChunk;
+
+typedef struct {
+    LineChunk *current;  // Chunk being filled (producer only)
+    size_t chunk_size;   // Capacity of a regular chunk
+    size_t pending;      // Bytes written into current past its committed part (see arena_prepare_write)
+    int node;            // NUMA node new chunks are placed on, or -1 for wherever they are first touched
+} LineArena;
+
+#define LINE_ARENA_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * @brief Initializes an arena. The arena itself is single-producer: only one thread may copy lines into it.
+ * @param arena Pointer to the LineArena struct.
+ * @param chunk_size Capacity of each chunk; lines longer than this get a chunk of their own.
+ */
+void arena_init(LineArena *arena, size_t chunk_size);
+
+/**
+ * @brief Places the arena's future chunks on a NUMA node (only in builds with libnuma, see
+ *        make NUMA=1; otherwise ignored), so they are local to the workers that read them.
+ * @param arena Pointer to the LineArena struct.
+ * @param node The node id, or -1 to leave placement to the kernel.
+ */
+void arena_set_node(LineArena *arena, int node);
+
+/**
+ * @brief Copies a line into the arena and takes a reference on its chunk for the caller.
+ *        The copy is NUL-terminated, although slices never rely on that.
+ * @param arena Pointer to the LineArena struct.
+ * @param src The bytes to copy.
+ * @param length Number of bytes to copy.
+ * @param chunk_out Receives the chunk holding the copy; pass it to chunk_release when done with the line.
+ * @return The copy, or NULL on allocation failure.
+ */
+char *arena_copy(LineArena *arena, const char *src, size_t length, LineChunk **chunk_out);
+
+/**
+ * @brief Returns room to read() straight into the arena, after any pending bytes. This avoids
+ *        copying blocks of lines: bytes are written in place, and complete lines are then
+ *        committed as slices while a trailing partial line stays pending for the next read.
+ *        If the current chunk lacks min_free bytes, a new chunk is started and the pending
+ *        bytes are moved into it.
+ * @param arena Pointer to the LineArena struct.
+ * @param min_free Minimum number of writable bytes needed.
+ * @param free_out Receives the number of writable bytes (at least min_free).
+ * @return The writable region, or NULL on allocation failure.
+ */
+char *arena_prepare_write(LineArena *arena, size_t min_free, size_t *free_out);
+
+/**
+ * @brief Records that n bytes were written into the region returned by arena_prepare_write.
+ */
+void arena_wrote(LineArena *arena, size_t n);
+
+/**
+ * @brief Returns the pending (written but not committed) bytes.
+ * @param arena Pointer to the LineArena struct.
+ * @param length_out Receives the number of pending bytes.
+ */
+char *arena_pending(LineArena *arena, size_t *length_out);
+
+/**
+ * @brief Commits the first length pending bytes as one slice and takes a chunk reference for the caller.
+ * @param arena Pointer to the LineArena struct.
+ * @param length Number of pending bytes to commit.
+ * @param chunk_out Receives the chunk holding the bytes; pass it to chunk_release when done.
+ * @return Start of the committed bytes.
+ */
+char *arena_commit(LineArena *arena, size_t length, LineChunk **chunk_out);
+
+/**
+ * @brief Drops the arena's own reference on its current chunk. Lines still referenced stay valid.
+ */
+void arena_destroy(LineArena *arena);
+
+/**
+ * @brief Releases one line's reference on a chunk, freeing the chunk when it was the last one.
+ *        Safe to call from any thread.
+ */
+void chunk_release(LineChunk *chunk);
+
+#endif // LINE_ARENA_H
@@ -0,0 +1,362 @@
+#define _GNU_SOURCE // For pwrite, posix_fadvise and st_mtim
+#include "line_index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC "LOGIDX\r\n"   // 8 bytes; the \r\n catches text-mode mangling
+#define INDEX_VERSION 1
+#define INDEX_BLOOM_BITS_LOG2 17   // 16 KiB filter per 1 MiB block
+#define INDEX_BLOOM_BYTES ((size_t)1 << (INDEX_BLOOM_BITS_LOG2 - 3))
+#define INDEX_READ_SIZE (1024 * 1024)
+
+// File layout: header, then one bloom filter per block, then num_blocks + 1 block offsets and
+// num_blocks + 1 first line numbers. The filters come first so that they can be written while
+// the log is read; the two small arrays are kept in memory until the end.
+typedef struct {
+    char magic[8];
+    uint32_t version;         // Also tells a byte-swapped file apart
+    uint32_t bloom_bytes;
+    uint64_t block_size;
+    uint64_t num_blocks;
+    uint64_t log_size;        // The log this index describes
+    uint64_t log_inode;
+    int64_t log_mtime_sec;
+    int64_t log_mtime_nsec;
+} IndexHeader;
+
+struct LineIndex {
+    void *map;
+    size_t map_size;
+    const IndexHeader *header;
+    const unsigned char *blooms;   // num_blocks filters of INDEX_BLOOM_BYTES
+    const uint64_t *offsets;       // num_blocks + 1 entries
+    const uint64_t *first_lines;   // num_blocks + 1 entries
+};
+
+static inline unsigned char fold_byte(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c | 0x20) : c;
+}
+
+// Bit of a block filter for a trigram (the folded bytes in the low 24 bits)
+static inline uint32_t trigram_bit(uint32_t trigram) {
+    return (trigram * 2654435761u) >> (32 - INDEX_BLOOM_BITS_LOG2);
+}
+
+static size_t index_file_size(uint64_t num_blocks) {
+    return sizeof(IndexHeader) + num_blocks * INDEX_BLOOM_BYTES + 2 * (num_blocks + 1) * sizeof(uint64_t);
+}
+
+// Path of the sidecar index of a log, with room for a temporary suffix. Returns NULL on error.
+static char *index_path_of(const char *log_path, const char *suffix) {
+    size_t length = strlen(log_path) + strlen(".idx") + strlen(suffix) + 1;
+    char *path = malloc(length);
+    if (!path) {
+        perror("malloc for index path failed");
+        return NULL;
+    }
+    snprintf(path, length, "%s.idx%s", log_path, suffix);
+    return path;
+}
+
+// Writes all of data, continuing after short writes. Returns false on error.
+static bool write_all(int fd, const void *data, size_t length) {
+    const char *p = data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Block boundaries collected while the log is read
+typedef struct {
+    uint64_t *offsets;
+    uint64_t *first_lines;
+    size_t count;
+    size_t capacity;
+} BlockList;
+
+// Appends a block boundary. Returns false on allocation failure (reported).
+static bool block_list_push(BlockList *list, uint64_t offset, uint64_t first_line) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        uint64_t *offsets = realloc(list->offsets, sizeof(uint64_t) * capacity);
+        if (offsets) {
+            list->offsets = offsets;
+        }
+        uint64_t *first_lines = offsets ? realloc(list->first_lines, sizeof(uint64_t) * capacity) : NULL;
+        if (!first_lines) {
+            perror("realloc for index blocks failed");
+            return false;
+        }
+        list->first_lines = first_lines;
+        list->capacity = capacity;
+    }
+    list->offsets[list->count] = offset;
+    list->first_lines[list->count] = first_line;
+    list->count++;
+    return true;
+}
+
+// Reads the first log_st->st_size bytes of the log once and writes its index to index_fd.
+// Returns false on error (reported).
+static bool write_index(int log_fd, const struct stat *log_st, int index_fd) {
+    unsigned char *buf = malloc(INDEX_READ_SIZE);
+    unsigned char *bloom = calloc(1, INDEX_BLOOM_BYTES);
+    BlockList blocks = { NULL, NULL, 0, 0 };
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!buf || !bloom) {
+        perror("malloc for index build failed");
+        free(buf);
+        free(bloom);
+        return false;
+    }
+    bool write_ok = write_all(index_fd, &header, sizeof(header)); // Filled in at the end
+    bool ok = write_ok && block_list_push(&blocks, 0, 0);
+
+    uint64_t log_size = (uint64_t)log_st->st_size; // Bytes appended meanwhile are left for a rebuild
+    uint64_t pos = 0;          // Offset of buf[0]
+    uint64_t block_start = 0;
+    uint64_t lines = 0;        // Lines started before the current position
+    uint32_t trigram = 0;
+    int run = 0;               // Bytes of the current block in trigram, up to 3
+    unsigned char last = '\n';
+    while (ok && pos < log_size) {
+        size_t want = log_size - pos < INDEX_READ_SIZE ? (size_t)(log_size - pos) : INDEX_READ_SIZE;
+        ssize_t n = read(log_fd, buf, want);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                perror("read failed while indexing");
+            } else {
+                fprintf(stderr, "Error: The log shrank while it was being indexed.\n");
+            }
+            ok = false;
+            break;
+        }
+        for (ssize_t i = 0; i < n && ok; i++) {
+            trigram = ((trigram << 8) | fold_byte(buf[i])) & 0xffffff;
+            if (run < 3) {
+                run++;
+            }
+            if (run == 3) {
+                uint32_t bit = trigram_bit(trigram);
+                bloom[bit >> 3] |= (unsigned char)(1u << (bit & 7));
+            }
+            if (buf[i] != '\n') {
+                continue;
+            }
+            lines++;
+            uint64_t end = pos + (uint64_t)i + 1;
+            if (end - block_start >= LINE_INDEX_BLOCK_SIZE && end < log_size) {
+                // Close the block after this line; the last one is closed after the loop
+                write_ok = write_all(index_fd, bloom, INDEX_BLOOM_BYTES);
+                ok = write_ok && block_list_push(&blocks, end, lines);
+                memset(bloom, 0, INDEX_BLOOM_BYTES);
+                block_start = end;
+                run = 0;
+            }
+        }
+        last = buf[n - 1];
+        pos += (uint64_t)n;
+    }
+    if (ok && log_size > 0) {
+        write_ok = write_all(index_fd, bloom, INDEX_BLOOM_BYTES);
+        ok = write_ok && block_list_push(&blocks, log_size, lines + (last != '\n' ? 1 : 0));
+    }
+    if (ok) {
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.version = INDEX_VERSION;
+        header.bloom_bytes = (uint32_t)INDEX_BLOOM_BYTES;
+        header.block_size = LINE_INDEX_BLOCK_SIZE;
+        header.num_blocks = blocks.count - 1;
+        header.log_size = log_size;
+        header.log_inode = (uint64_t)log_st->st_ino;
+        header.log_mtime_sec = (int64_t)log_st->st_mtim.tv_sec;
+        header.log_mtime_nsec = (int64_t)log_st->st_mtim.tv_nsec;
+        write_ok = write_all(index_fd, blocks.offsets, sizeof(uint64_t) * blocks.count) &&
+                   write_all(index_fd, blocks.first_lines, sizeof(uint64_t) * blocks.count) &&
+                   pwrite(index_fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        ok = write_ok;
+    }
+    if (!write_ok) {
+        perror("write failed while indexing");
+    }
+    free(buf);
+    free(bloom);
+    free(blocks.offsets);
+    free(blocks.first_lines);
+    return ok;
+}
+
+// Builds the index of a log into a temporary file and renames it to index_path
+static bool build_index(const char *log_path, const char *index_path) {
+    int log_fd = open(log_path, O_RDONLY);
+    struct stat log_st;
+    if (log_fd == -1 || fstat(log_fd, &log_st) == -1) {
+        perror("open failed");
+        if (log_fd != -1) {
+            close(log_fd);
+        }
+        return false;
+    }
+    posix_fadvise(log_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp.%ld", (long)getpid());
+    char *tmp_path = index_path_of(log_path, suffix);
+    if (!tmp_path) {
+        close(log_fd);
+        return false;
+    }
+    int index_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = index_fd != -1;
+    if (!ok) {
+        perror("Failed to create index file");
+    } else {
+        ok = write_index(log_fd, &log_st, index_fd);
+        if (close(index_fd) == -1 && ok) {
+            perror("close failed while indexing");
+            ok = false;
+        }
+        if (ok && rename(tmp_path, index_path) == -1) {
+            perror("rename of index file failed");
+            ok = false;
+        }
+        if (!ok) {
+            unlink(tmp_path);
+        }
+    }
+    free(tmp_path);
+    close(log_fd);
+    return ok;
+}
+
+// Maps index_path if it is a complete index of the log as it is now. Returns NULL otherwise,
+// silently: the caller then rebuilds it.
+static LineIndex *map_index(const char *index_path, const struct stat *log_st) {
+    int fd = open(index_path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(IndexHeader)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    const IndexHeader *header = map;
+    size_t map_size = (size_t)st.st_size;
+    bool valid = memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == INDEX_VERSION && header->bloom_bytes == INDEX_BLOOM_BYTES &&
+                 header->block_size == LINE_INDEX_BLOCK_SIZE &&
+                 header->num_blocks <= (map_size - sizeof(IndexHeader)) / INDEX_BLOOM_BYTES &&
+                 map_size == index_file_size(header->num_blocks) &&
+                 header->log_size == (uint64_t)log_st->st_size && header->log_inode == (uint64_t)log_st->st_ino &&
+                 header->log_mtime_sec == (int64_t)log_st->st_mtim.tv_sec &&
+                 header->log_mtime_nsec == (int64_t)log_st->st_mtim.tv_nsec;
+    LineIndex *index = valid ? malloc(sizeof(LineIndex)) : NULL;
+    if (!index) {
+        munmap(map, map_size);
+        return NULL;
+    }
+    index->map = map;
+    index->map_size = map_size;
+    index->header = header;
+    index->blooms = (const unsigned char *)map + sizeof(IndexHeader);
+    index->offsets = (const uint64_t *)(index->blooms + header->num_blocks * INDEX_BLOOM_BYTES);
+    index->first_lines = index->offsets + header->num_blocks + 1;
+    return index;
+}
+
+LineIndex *line_index_open(const char *log_path, bool *built) {
+    *built = false;
+    struct stat log_st;
+    if (stat(log_path, &log_st) == -1) {
+        perror("stat failed");
+        return NULL;
+    }
+    char *index_path = index_path_of(log_path, "");
+    if (!index_path) {
+        return NULL;
+    }
+    LineIndex *index = map_index(index_path, &log_st);
+    if (!index && build_index(log_path, index_path)) {
+        *built = true;
+        if (stat(log_path, &log_st) == -1 || !(index = map_index(index_path, &log_st))) {
+            fprintf(stderr, "Error: The log changed while %s was being built.\n", index_path);
+        }
+    }
+    free(index_path);
+    return index;
+}
+
+bool line_index_is_index_file(const char *path) {
+    size_t length = strlen(path);
+    if (length < strlen(".idx") || strcmp(path + length - strlen(".idx"), ".idx") != 0) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    char magic[8];
+    bool is_index = pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+                    memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return is_index;
+}
+
+void line_index_close(LineIndex *index) {
+    if (index) {
+        munmap(index->map, index->map_size);
+        free(index);
+    }
+}
+
+size_t line_index_num_blocks(const LineIndex *index) {
+    return (size_t)index->header->num_blocks;
+}
+
+uint64_t line_index_block_offset(const LineIndex *index, size_t block) {
+    return index->offsets[block];
+}
+
+uint64_t line_index_block_first_line(const LineIndex *index, size_t block) {
+    return index->first_lines[block];
+}
+
+bool line_index_block_may_contain(const LineIndex *index, size_t block, const char *term, size_t length) {
+    if (length < 3 || memchr(term, '\n', length)) {
+        return true; // No trigram of its own, or it may span lines, which the filters do not see whole
+    }
+    const unsigned char *bloom = index->blooms + block * INDEX_BLOOM_BYTES;
+    const unsigned char *bytes = (const unsigned char *)term;
+    uint32_t trigram = (uint32_t)fold_byte(bytes[0]) << 8 | fold_byte(bytes[1]);
+    for (size_t i = 2; i < length; i++) {
+        trigram = ((trigram << 8) | fold_byte(bytes[i])) & 0xffffff;
+        uint32_t bit = trigram_bit(trigram);
+        if (!(bloom[bit >> 3] & (1u << (bit & 7)))) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sidecar index for --index, stored next to the log as <log>.idx. It cuts the log into blocks of
+ * about LINE_INDEX_BLOCK_SIZE bytes that start and end on line boundaries, and records for each
+ * block its byte offset, the number of the first line in it and a bloom filter of every ASCII
+ * case-folded byte trigram the block contains. Later runs map the index read-only and skip the
+ * blocks whose filter shows they cannot contain a search term, handing out the rest to workers
+ * as byte ranges that need no newline resynchronization.
+ *
+ * The index records the log's size, mtime and inode; when any of them changed, the index is
+ * rebuilt, which costs one extra sequential read of the log. Terms shorter than a trigram, or
+ * containing '\n', can never rule a block out.
+ */
+typedef struct LineIndex LineIndex;
+
+#define LINE_INDEX_BLOCK_SIZE (1024 * 1024) // Target block size; a block is extended to the next newline
+
+/**
+ * @brief Maps the index of a log file, building (or rebuilding) it first if it is missing or
+ *        stale. The index file is written to a temporary name and renamed into place, so
+ *        concurrent runs never see a partial index.
+ * @param log_path Path of the plain (uncompressed) log file.
+ * @param built Set to true if the index had to be built by this call.
+ * @return The index, or NULL on error (reported with perror / to stderr).
+ */
+LineIndex *line_index_open(const char *log_path, bool *built);
+
+/**
+ * @brief Tells whether a file is an index written by line_index_open, so that directory and
+ *        glob inputs can leave sidecar files out.
+ */
+bool line_index_is_index_file(const char *path);
+
+/**
+ * @brief Unmaps an index opened by line_index_open. NULL is ignored.
+ */
+void line_index_close(LineIndex *index);
+
+/**
+ * @brief Returns the number of blocks; 0 for an empty log.
+ */
+size_t line_index_num_blocks(const LineIndex *index);
+
+/**
+ * @brief Returns the byte offset at which a block starts, always a line start.
+ *        Block num_blocks gives the size of the log.
+ */
+uint64_t line_index_block_offset(const LineIndex *index, size_t block);
+
+/**
+ * @brief Returns the (0-based) number of the first line of a block.
+ *        Block num_blocks gives the number of lines in the log.
+ */
+uint64_t line_index_block_first_line(const LineIndex *index, size_t block);
+
+/**
+ * @brief Tells whether a block may contain a term, either case: false only when some trigram
+ *        of the term is certainly absent from the block.
+ * @param index The index.
+ * @param block Block number, below num_blocks.
+ * @param term The term; it does not need to be NUL-terminated.
+ * @param length Length of the term.
+ */
+bool line_index_block_may_contain(const LineIndex *index, size_t block, const char *term, size_t length);
+
+#endif // LINE_INDEX_H
@@ -0,0 +1,160 @@
+#include "line_split.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPLIT_HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SPLIT_HAVE_NEON 1
+#endif
+
+// A kernel writes the offsets of up to max newlines of [data, data + length) and returns how many
+typedef size_t (*split_kernel_fn)(const char *data, size_t length, uint32_t *newlines, size_t max);
+
+static split_kernel_fn s_kernel;
+static const char *s_kernel_name;
+
+static size_t split_scalar(const char *data, size_t length, uint32_t *newlines, size_t max) {
+    size_t found = 0;
+    const char *p = data;
+    const char *end = data + length;
+    while (found < max && p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        newlines[found++] = (uint32_t)(p - data);
+        p++;
+    }
+    return found;
+}
+
+// The SIMD kernels compare 64 bytes at a time against '\n' and turn the result into one 64-bit
+// mask, then write one offset per set bit. The tail that does not fill a whole step is handed
+// to the scalar kernel.
+
+// Writes the offsets of the set bits of a 64-byte step at base. Returns false once max is
+// reached, with *found == max.
+static inline bool emit_mask(uint64_t mask, size_t base, uint32_t *newlines, size_t max, size_t *found) {
+    while (mask != 0) {
+        if (*found == max) {
+            return false;
+        }
+        newlines[(*found)++] = (uint32_t)(base + (size_t)__builtin_ctzll(mask));
+        mask &= mask - 1;
+    }
+    return *found < max;
+}
+
+static size_t split_tail(const char *data, size_t length, size_t i, uint32_t *newlines, size_t max, size_t found) {
+    size_t more = split_scalar(data + i, length - i, newlines + found, max - found);
+    for (size_t k = found; k < found + more; k++) {
+        newlines[k] += (uint32_t)i;
+    }
+    return found + more;
+}
+
+#ifdef SPLIT_HAVE_X86
+static size_t split_sse2(const char *data, size_t length, uint32_t *newlines, size_t max) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        uint64_t mask = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), newline)) |
+                        (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 16)), newline)) << 16 |
+                        (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 32)), newline)) << 32 |
+                        (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + 48)), newline)) << 48;
+        if (mask != 0 && !emit_mask(mask, i, newlines, max, &found)) {
+            return found;
+        }
+    }
+    return split_tail(data, length, i, newlines, max, found);
+}
+
+__attribute__((target("avx2")))
+static size_t split_avx2(const char *data, size_t length, uint32_t *newlines, size_t max) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        uint64_t low = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), newline));
+        uint64_t high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i + 32)), newline));
+        uint64_t mask = low | high << 32;
+        if (mask != 0 && !emit_mask(mask, i, newlines, max, &found)) {
+            return found;
+        }
+    }
+    return split_tail(data, length, i, newlines, max, found);
+}
+#endif
+
+#ifdef SPLIT_HAVE_NEON
+// NEON has no movemask: the 0xFF/0x00 compare bytes are ANDed with per-lane bit weights and
+// summed pairwise down to one bit per byte
+static uint64_t neon_mask64(const uint8_t *p, uint8x16_t newline) {
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t bits = vld1q_u8(weights);
+    uint8x16_t m0 = vandq_u8(vceqq_u8(vld1q_u8(p), newline), bits);
+    uint8x16_t m1 = vandq_u8(vceqq_u8(vld1q_u8(p + 16), newline), bits);
+    uint8x16_t m2 = vandq_u8(vceqq_u8(vld1q_u8(p + 32), newline), bits);
+    uint8x16_t m3 = vandq_u8(vceqq_u8(vld1q_u8(p + 48), newline), bits);
+    uint8x16_t sum = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+
+static size_t split_neon(const char *data, size_t length, uint32_t *newlines, size_t max) {
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    size_t found = 0;
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        uint64_t mask = neon_mask64((const uint8_t *)(data + i), newline);
+        if (mask != 0 && !emit_mask(mask, i, newlines, max, &found)) {
+            return found;
+        }
+    }
+    return split_tail(data, length, i, newlines, max, found);
+}
+#endif
+
+bool line_split_set_kernel(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        s_kernel = split_scalar;
+    }
+#ifdef SPLIT_HAVE_X86
+    else if (strcmp(name, "sse2") == 0) {
+        s_kernel = split_sse2;
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        s_kernel = split_avx2;
+    }
+#endif
+#ifdef SPLIT_HAVE_NEON
+    else if (strcmp(name, "neon") == 0) {
+        s_kernel = split_neon;
+    }
+#endif
+    else {
+        return false;
+    }
+    s_kernel_name = name;
+    return true;
+}
+
+const char *line_split_kernel_name(void) {
+    return s_kernel_name;
+}
+
+void line_split_init(void) {
+    // Runtime CPU dispatch: pick the widest kernel this machine supports
+#ifdef SPLIT_HAVE_X86
+    __builtin_cpu_init();
+    if (!line_split_set_kernel("avx2")) {
+        line_split_set_kernel("sse2"); // Part of the x86-64 baseline
+    }
+#elif defined(SPLIT_HAVE_NEON)
+    line_split_set_kernel("neon"); // Part of the AArch64 baseline
+#else
+    line_split_set_kernel("scalar");
+#endif
+}
+
+size_t line_split_find(const char *data, size_t length, uint32_t *newlines, size_t max) {
+    return s_kernel(data, length, newlines, max);
+}
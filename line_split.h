@@ -0,0 +1,45 @@
+#ifndef LINE_SPLIT_H
+#define LINE_SPLIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Newline scanning for the manager's line splitter. A whole block is scanned in one pass, 64
+ * bytes per step, and the offsets of its '\n' bytes are written to an array, so cutting a block
+ * into lines costs one vector compare per 16 or 32 bytes instead of a getline call and a
+ * terminator patch per line. As in search.h, the kernel (AVX2, SSE2, NEON or scalar) is picked
+ * by runtime CPU dispatch.
+ */
+
+/**
+ * @brief Picks the fastest newline kernel this CPU supports. Call once before line_split_find.
+ */
+void line_split_init(void);
+
+/**
+ * @brief Forces a specific newline kernel instead of the one picked by runtime CPU dispatch.
+ *        Mainly useful for benchmarking. Call after line_split_init.
+ * @param name One of "scalar", "sse2", "avx2" or "neon".
+ * @return false if the kernel is unknown or not supported by this CPU/build (the current one is kept).
+ */
+bool line_split_set_kernel(const char *name);
+
+/**
+ * @brief Returns the name of the active newline kernel, e.g. "avx2".
+ */
+const char *line_split_kernel_name(void);
+
+/**
+ * @brief Finds the '\n' bytes of a block, in order.
+ * @param data Start of the block. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the block; at most UINT32_MAX.
+ * @param newlines Receives the offsets of the newlines from data.
+ * @param max Room in newlines. If that many are found, the scan stops there: the caller
+ *            resumes after newlines[max - 1] to find the rest.
+ * @return The number of offsets written.
+ */
+size_t line_split_find(const char *data, size_t length, uint32_t *newlines, size_t max);
+
+#endif // LINE_SPLIT_H
@@ -0,0 +1,229 @@
+#include "ordered_output.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define ORDERED_IOV_BATCH 512 // Results gathered into one writev (IOV_MAX is at least 1024 on Linux)
+
+// Result for one sequence number, waiting for its turn
+typedef struct {
+    char *data;     // Owned; NULL if the slice had no matching lines
+    size_t length;
+    uint64_t lines;
+    bool ready;     // Submitted and not yet written
+} OrderedSlot;
+
+struct OrderedOutput {
+    OrderedSlot *slots;  // Result for seq lives in slots[seq % window]
+    size_t window;
+    uint64_t next;       // Lowest sequence number not written yet
+    uint64_t end;        // Number of sequence numbers issued, once finishing
+    bool finishing;      // end is set: exit once next reaches it
+    bool stopped;        // Stop writing and let the manager go
+    int fd;
+    uint64_t max_lines;  // 0 means no limit
+    uint64_t lines_written;
+    void (*on_stop)(void);
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_ready; // A result was submitted, or finishing/stopping: the writer waits
+    pthread_cond_t cond_room;  // The window moved on, or stopping: the manager waits
+    pthread_t thread;
+};
+
+// Cuts a run of results down to its first `lines` lines: the iovec holding the last wanted
+// line is shortened and the ones after it dropped. Returns the new iovec count.
+static int truncate_to_lines(struct iovec *iov, int count, uint64_t lines) {
+    for (int i = 0; i < count; i++) {
+        char *p = iov[i].iov_base;
+        char *end = p + iov[i].iov_len;
+        while (lines > 0 && p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+            p++;
+            lines--;
+        }
+        if (lines == 0) {
+            iov[i].iov_len = (size_t)(p - (char *)iov[i].iov_base);
+            return i + 1;
+        }
+    }
+    return count;
+}
+
+// Writes all of iov, continuing after short writes. Returns false on error (reported here).
+static bool write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("writev failed");
+            return false;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) { // Skip what was written
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return true;
+}
+
+// Writer thread: waits for the result at the front of the window, then writes it together with
+// every consecutive result already submitted behind it. The lock is not held while writing,
+// so workers keep submitting meanwhile; the slots being written stay ready, and therefore
+// reserved, until the window moves on.
+static void *writer_thread(void *arg) {
+    OrderedOutput *out = arg;
+    struct iovec iov[ORDERED_IOV_BATCH];
+
+    pthread_mutex_lock(&out->mutex);
+    for (;;) {
+        while (!out->stopped && !out->slots[out->next % out->window].ready &&
+               !(out->finishing && out->next >= out->end)) {
+            pthread_cond_wait(&out->cond_ready, &out->mutex);
+        }
+        if (out->stopped || !out->slots[out->next % out->window].ready) {
+            break; // Stopped, or every issued result has been written
+        }
+
+        uint64_t run_end = out->next;
+        uint64_t run_lines = 0;
+        int count = 0;
+        while (run_end < out->next + out->window && count < ORDERED_IOV_BATCH) {
+            OrderedSlot *slot = &out->slots[run_end % out->window];
+            if (!slot->ready) {
+                break;
+            }
+            if (slot->length > 0) {
+                iov[count].iov_base = slot->data;
+                iov[count].iov_len = slot->length;
+                count++;
+            }
+            run_lines += slot->lines;
+            run_end++;
+        }
+        pthread_mutex_unlock(&out->mutex);
+
+        bool limit_reached = false;
+        if (out->max_lines > 0 && out->lines_written + run_lines >= out->max_lines) {
+            run_lines = out->max_lines - out->lines_written;
+            count = truncate_to_lines(iov, count, run_lines);
+            limit_reached = true;
+        }
+        bool ok = write_all(out->fd, iov, count);
+        if (ok) {
+            out->lines_written += run_lines; // Only the writer touches it
+        }
+
+        pthread_mutex_lock(&out->mutex);
+        for (uint64_t seq = out->next; seq < run_end; seq++) {
+            OrderedSlot *slot = &out->slots[seq % out->window];
+            free(slot->data);
+            slot->data = NULL;
+            slot->ready = false;
+        }
+        out->next = run_end;
+        pthread_cond_broadcast(&out->cond_room);
+        if (!ok || limit_reached) {
+            out->stopped = true;
+            pthread_mutex_unlock(&out->mutex);
+            if (out->on_stop) {
+                out->on_stop();
+            }
+            return NULL;
+        }
+    }
+    pthread_mutex_unlock(&out->mutex);
+    return NULL;
+}
+
+OrderedOutput *ordered_output_create(int fd, size_t window, uint64_t max_lines, void (*on_stop)(void)) {
+    OrderedOutput *out = calloc(1, sizeof(OrderedOutput));
+    if (!out || !(out->slots = calloc(window, sizeof(OrderedSlot)))) {
+        perror("Failed to allocate ordered output window");
+        exit(EXIT_FAILURE);
+    }
+    out->window = window;
+    out->fd = fd;
+    out->max_lines = max_lines;
+    out->on_stop = on_stop;
+    pthread_mutex_init(&out->mutex, NULL);
+    pthread_cond_init(&out->cond_ready, NULL);
+    pthread_cond_init(&out->cond_room, NULL);
+    if (pthread_create(&out->thread, NULL, writer_thread, out) != 0) {
+        perror("pthread_create for output writer failed");
+        pthread_mutex_destroy(&out->mutex);
+        pthread_cond_destroy(&out->cond_ready);
+        pthread_cond_destroy(&out->cond_room);
+        free(out->slots);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+bool ordered_output_reserve(OrderedOutput *out, uint64_t seq) {
+    pthread_mutex_lock(&out->mutex);
+    while (!out->stopped && seq >= out->next + out->window) {
+        pthread_cond_wait(&out->cond_room, &out->mutex);
+    }
+    bool ok = !out->stopped;
+    pthread_mutex_unlock(&out->mutex);
+    return ok;
+}
+
+void ordered_output_submit(OrderedOutput *out, uint64_t seq, char *data, size_t length, uint64_t lines) {
+    pthread_mutex_lock(&out->mutex);
+    if (out->stopped) {
+        pthread_mutex_unlock(&out->mutex);
+        free(data); // Nobody will write it
+        return;
+    }
+    OrderedSlot *slot = &out->slots[seq % out->window];
+    slot->data = data;
+    slot->length = length;
+    slot->lines = lines;
+    slot->ready = true;
+    if (seq == out->next) {
+        pthread_cond_signal(&out->cond_ready); // Only the front of the window unblocks the writer
+    }
+    pthread_mutex_unlock(&out->mutex);
+}
+
+void ordered_output_stop(OrderedOutput *out) {
+    pthread_mutex_lock(&out->mutex);
+    out->stopped = true;
+    pthread_cond_broadcast(&out->cond_ready);
+    pthread_cond_broadcast(&out->cond_room);
+    pthread_mutex_unlock(&out->mutex);
+}
+
+uint64_t ordered_output_finish(OrderedOutput *out, uint64_t end) {
+    if (!out) {
+        return 0;
+    }
+    pthread_mutex_lock(&out->mutex);
+    out->end = end;
+    out->finishing = true;
+    pthread_cond_broadcast(&out->cond_ready);
+    pthread_mutex_unlock(&out->mutex);
+    pthread_join(out->thread, NULL);
+
+    for (size_t i = 0; i < out->window; i++) {
+        free(out->slots[i].data); // Left over if the writer stopped early
+    }
+    uint64_t lines = out->lines_written;
+    pthread_mutex_destroy(&out->mutex);
+    pthread_cond_destroy(&out->cond_ready);
+    pthread_cond_destroy(&out->cond_room);
+    free(out->slots);
+    free(out);
+    return lines;
+}
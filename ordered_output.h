@@ -0,0 +1,65 @@
+#ifndef ORDERED_OUTPUT_H
+#define ORDERED_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Reorder stage for --print. The manager tags every slice it pushes with a sequence number;
+ * workers hand in the matching lines of each slice under that number, in whatever order they
+ * finish, and a writer thread emits them strictly in sequence order. Runs of consecutive
+ * results go out in one writev call, so output costs few syscalls however short the lines are.
+ *
+ * The window bounds how far the manager may run ahead of the writer: a slice can only be
+ * numbered once every sequence number window places before it has been written. Workers
+ * never wait on the writer, so a slow slice holds back the manager (and with it memory use),
+ * not the other workers.
+ */
+typedef struct OrderedOutput OrderedOutput;
+
+/**
+ * @brief Creates the reorder window and starts the writer thread. Exits on allocation failure,
+ *        like buffer_init.
+ * @param fd Where the lines are written, e.g. STDOUT_FILENO.
+ * @param window Number of sequence numbers that may be outstanding at once.
+ * @param max_lines Stop after writing this many lines (--max-count); 0 means no limit.
+ * @param on_stop Called once, from the writer thread, when it stops early: after max_lines
+ *                lines or on a write error. May be NULL.
+ * @return The writer, or NULL if the thread could not be started.
+ */
+OrderedOutput *ordered_output_create(int fd, size_t window, uint64_t max_lines, void (*on_stop)(void));
+
+/**
+ * @brief Manager side: waits until seq fits in the window, i.e. every result window places
+ *        before it has been written. Sequence numbers are issued from 0 upwards, without gaps.
+ * @return false if the writer has stopped, in which case nothing more should be pushed.
+ */
+bool ordered_output_reserve(OrderedOutput *out, uint64_t seq);
+
+/**
+ * @brief Worker side: hands in the result for one sequence number. Never blocks on the writer.
+ * @param seq A sequence number previously reserved by the manager, submitted exactly once.
+ * @param data The matching lines, each ended by '\n', or NULL if there were none. The writer
+ *             takes ownership and frees it with free().
+ * @param length Number of bytes in data.
+ * @param lines Number of lines in data.
+ */
+void ordered_output_submit(OrderedOutput *out, uint64_t seq, char *data, size_t length, uint64_t lines);
+
+/**
+ * @brief Makes the writer stop at its next step and wakes a manager waiting in
+ *        ordered_output_reserve. Used on shutdown, when some results will never be submitted.
+ *        Safe to call more than once.
+ */
+void ordered_output_stop(OrderedOutput *out);
+
+/**
+ * @brief Waits until the writer has written the results for every sequence number below end
+ *        (or has stopped), joins it and frees everything. NULL is ignored.
+ * @param end Number of sequence numbers the manager issued.
+ * @return The number of lines written.
+ */
+uint64_t ordered_output_finish(OrderedOutput *out, uint64_t end);
+
+#endif // ORDERED_OUTPUT_H
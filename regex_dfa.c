@@ -0,0 +1,951 @@
+#define _GNU_SOURCE // For memrchr
+#include "regex_dfa.h"
+#include "search.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RX_MAX_REPEAT 1000     // Largest count allowed in {n,m}
+#define NFA_MAX_STATES 100000  // Counted repeats are expanded, so big counts cost states
+#define DFA_MAX_STATES 10000
+#define LITERAL_MAX 64         // Longest required literal tracked for the prefilter
+#define PREFILTER_PROBE 64     // Candidate lines after which a slice checks whether the prefilter pays off
+
+#define DFA_ACCEPT 1 // The line matches; the state is absorbing
+#define DFA_DEAD 2   // The line cannot match any more; the state is absorbing
+
+typedef struct {
+    uint8_t bits[32];
+} ByteSet;
+
+static void set_add(ByteSet *set, int c) {
+    set->bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static bool set_has(const ByteSet *set, int c) {
+    return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static void set_add_range(ByteSet *set, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) {
+        set_add(set, c);
+    }
+}
+
+static void set_invert(ByteSet *set) {
+    for (int i = 0; i < 32; i++) {
+        set->bits[i] = (uint8_t)~set->bits[i];
+    }
+}
+
+static int set_count(const ByteSet *set) {
+    int count = 0;
+    for (int i = 0; i < 32; i++) {
+        count += __builtin_popcount(set->bits[i]);
+    }
+    return count;
+}
+
+// Makes a set closed under ASCII case: a letter in either case brings in the other one
+static void set_fold_case(ByteSet *set) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (set_has(set, c) || set_has(set, c - 'a' + 'A')) {
+            set_add(set, c);
+            set_add(set, c - 'a' + 'A');
+        }
+    }
+}
+
+static void *rx_realloc(void *p, size_t size) {
+    void *grown = realloc(p, size > 0 ? size : 1);
+    if (!grown) {
+        perror("Failed to allocate regex");
+        exit(EXIT_FAILURE);
+    }
+    return grown;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Parsing: recursive descent into an AST whose nodes live in one array and refer to each other
+// by index
+
+enum { RX_EMPTY, RX_SET, RX_BOL, RX_EOL, RX_CONCAT, RX_ALT, RX_REPEAT };
+
+typedef struct {
+    int kind;
+    ByteSet set;     // RX_SET: the bytes matched
+    int left, right; // RX_CONCAT/RX_ALT operands; RX_REPEAT uses left
+    int min, max;    // RX_REPEAT bounds; max -1 is unbounded
+} RxNode;
+
+typedef struct {
+    const char *p;   // Next character to parse
+    bool nocase;
+    RxNode *nodes;
+    int num_nodes;
+    int capacity;
+    char *error;
+    size_t error_size;
+    bool failed;
+} Parser;
+
+static int parse_alt(Parser *ps);
+
+static int new_node(Parser *ps, int kind) {
+    if (ps->num_nodes == ps->capacity) {
+        ps->capacity = ps->capacity ? ps->capacity * 2 : 64;
+        ps->nodes = rx_realloc(ps->nodes, sizeof(RxNode) * ps->capacity);
+    }
+    RxNode *node = &ps->nodes[ps->num_nodes];
+    memset(node, 0, sizeof(RxNode));
+    node->kind = kind;
+    node->left = -1;
+    node->right = -1;
+    return ps->num_nodes++;
+}
+
+static int parse_error(Parser *ps, const char *message) {
+    if (!ps->failed) {
+        snprintf(ps->error, ps->error_size, "%s", message);
+        ps->failed = true;
+    }
+    return -1;
+}
+
+static int set_node(Parser *ps, ByteSet set) {
+    if (ps->nocase) {
+        set_fold_case(&set);
+    }
+    int n = new_node(ps, RX_SET);
+    ps->nodes[n].set = set;
+    return n;
+}
+
+static int binary_node(Parser *ps, int kind, int left, int right) {
+    int n = new_node(ps, kind);
+    ps->nodes[n].left = left;
+    ps->nodes[n].right = right;
+    return n;
+}
+
+// Parses the character after a backslash. Returns the byte it stands for, or -2 if it is a
+// class escape such as \d (then filled into set), or -1 on error.
+static int parse_escape(Parser *ps, ByteSet *set) {
+    int c = (unsigned char)*ps->p;
+    if (c == '\0') {
+        return parse_error(ps, "trailing backslash");
+    }
+    ps->p++;
+    memset(set, 0, sizeof(ByteSet));
+    switch (c) {
+        case 'd': case 'D':
+            set_add_range(set, '0', '9');
+            break;
+        case 'w': case 'W':
+            set_add_range(set, 'a', 'z');
+            set_add_range(set, 'A', 'Z');
+            set_add_range(set, '0', '9');
+            set_add(set, '_');
+            break;
+        case 's': case 'S':
+            set_add(set, ' ');
+            set_add_range(set, '\t', '\r'); // \t \n \v \f \r
+            break;
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        default: return c; // Escaped metacharacter, or any other byte taken literally
+    }
+    if (isupper(c)) {
+        set_invert(set);
+    }
+    return -2;
+}
+
+// Parses a bracket expression; ps->p is just past the '['
+static int parse_class(Parser *ps) {
+    ByteSet set;
+    memset(&set, 0, sizeof(set));
+    bool negate = *ps->p == '^';
+    if (negate) {
+        ps->p++;
+    }
+    bool first = true;
+    while (first || *ps->p != ']') { // A ']' right after the '[' or '[^' is literal
+        first = false;
+        if (*ps->p == '\0') {
+            return parse_error(ps, "missing ]");
+        }
+        ByteSet escaped;
+        int lo;
+        if (*ps->p == '\\') {
+            ps->p++;
+            lo = parse_escape(ps, &escaped);
+        } else {
+            lo = (unsigned char)*ps->p++;
+        }
+        if (lo == -1) {
+            return -1;
+        }
+        if (lo == -2) {
+            for (int i = 0; i < 32; i++) {
+                set.bits[i] |= escaped.bits[i];
+            }
+            continue;
+        }
+        if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+            ps->p++;
+            int hi;
+            if (*ps->p == '\\') {
+                ps->p++;
+                hi = parse_escape(ps, &escaped);
+            } else {
+                hi = (unsigned char)*ps->p++;
+            }
+            if (hi == -1) {
+                return -1;
+            }
+            if (hi == -2 || hi < lo) {
+                return parse_error(ps, "invalid range in [...]");
+            }
+            set_add_range(&set, lo, hi);
+        } else {
+            set_add(&set, lo);
+        }
+    }
+    ps->p++; // The ']'
+    if (ps->nocase) {
+        set_fold_case(&set); // Before inverting, so [^a] excludes 'A' too
+    }
+    if (negate) {
+        set_invert(&set);
+    }
+    return set_node(ps, set);
+}
+
+static int parse_atom(Parser *ps) {
+    ByteSet set;
+    memset(&set, 0, sizeof(set));
+    int c = (unsigned char)*ps->p;
+    switch (c) {
+        case '(': {
+            ps->p++;
+            if (ps->p[0] == '?' && ps->p[1] == ':') {
+                ps->p += 2; // Non-capturing group: nothing captures here anyway
+            }
+            int n = parse_alt(ps);
+            if (n < 0) {
+                return -1;
+            }
+            if (*ps->p != ')') {
+                return parse_error(ps, "missing )");
+            }
+            ps->p++;
+            return n;
+        }
+        case '[':
+            ps->p++;
+            return parse_class(ps);
+        case '.':
+            ps->p++;
+            set_invert(&set);
+            return set_node(ps, set);
+        case '^':
+            ps->p++;
+            return new_node(ps, RX_BOL);
+        case '$':
+            ps->p++;
+            return new_node(ps, RX_EOL);
+        case '\\': {
+            ps->p++;
+            int byte = parse_escape(ps, &set);
+            if (byte == -1) {
+                return -1;
+            }
+            if (byte >= 0) {
+                set_add(&set, byte);
+            }
+            return set_node(ps, set);
+        }
+        case '*': case '+': case '?':
+            return parse_error(ps, "nothing to repeat");
+        default: // Includes a '{' that does not start a quantifier
+            ps->p++;
+            set_add(&set, c);
+            return set_node(ps, set);
+    }
+}
+
+// Parses {n}, {n,} or {n,m} at ps->p. Returns false, consuming nothing, if the brace does not
+// start a well-formed quantifier; it is then a literal '{'.
+static bool parse_braces(Parser *ps, int *min, int *max) {
+    const char *p = ps->p + 1;
+    if (!isdigit((unsigned char)*p)) {
+        return false;
+    }
+    long lo = strtol(p, (char **)&p, 10);
+    long hi = lo;
+    if (*p == ',') {
+        p++;
+        hi = isdigit((unsigned char)*p) ? strtol(p, (char **)&p, 10) : -1;
+    }
+    if (*p != '}') {
+        return false;
+    }
+    ps->p = p + 1;
+    if (lo > RX_MAX_REPEAT || hi > RX_MAX_REPEAT) {
+        parse_error(ps, "repeat count too large");
+    } else if (hi != -1 && hi < lo) {
+        parse_error(ps, "invalid repeat bounds");
+    }
+    *min = (int)lo;
+    *max = (int)hi;
+    return true;
+}
+
+static int parse_repeat(Parser *ps) {
+    int atom = parse_atom(ps);
+    while (atom >= 0) {
+        int min, max;
+        char c = *ps->p;
+        if (c == '*') {
+            min = 0, max = -1;
+        } else if (c == '+') {
+            min = 1, max = -1;
+        } else if (c == '?') {
+            min = 0, max = 1;
+        } else if (c != '{' || !parse_braces(ps, &min, &max)) {
+            break;
+        }
+        if (ps->failed) {
+            return -1;
+        }
+        if (c != '{') {
+            ps->p++;
+        }
+        int n = new_node(ps, RX_REPEAT);
+        ps->nodes[n].left = atom;
+        ps->nodes[n].min = min;
+        ps->nodes[n].max = max;
+        atom = n;
+    }
+    return atom;
+}
+
+static int parse_concat(Parser *ps) {
+    int result = -1;
+    while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+        int n = parse_repeat(ps);
+        if (n < 0) {
+            return -1;
+        }
+        result = result < 0 ? n : binary_node(ps, RX_CONCAT, result, n);
+    }
+    return result < 0 ? new_node(ps, RX_EMPTY) : result;
+}
+
+static int parse_alt(Parser *ps) {
+    int left = parse_concat(ps);
+    while (left >= 0 && *ps->p == '|') {
+        ps->p++;
+        int right = parse_concat(ps);
+        if (right < 0) {
+            return -1;
+        }
+        left = binary_node(ps, RX_ALT, left, right);
+    }
+    return left;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Required literal: for each node, the literal it always matches exactly (if any), the literal
+// every match starts with, the one every match ends with, and the longest one every match
+// contains. Strings longer than LITERAL_MAX are cut, which keeps them valid as prefilters.
+
+typedef struct {
+    char s[LITERAL_MAX];
+    int len;
+} Literal;
+
+typedef struct {
+    bool exact;      // Every match is exactly `prefix` (then prefix == suffix == best)
+    Literal prefix;
+    Literal suffix;
+    Literal best;
+} LiteralInfo;
+
+// a followed by b; keep_tail chooses which end survives when the result is too long
+static Literal literal_cat(const Literal *a, const Literal *b, bool keep_tail, bool *truncated) {
+    Literal out;
+    char joined[2 * LITERAL_MAX];
+    memcpy(joined, a->s, a->len);
+    memcpy(joined + a->len, b->s, b->len);
+    int len = a->len + b->len;
+    *truncated = len > LITERAL_MAX;
+    out.len = *truncated ? LITERAL_MAX : len;
+    memcpy(out.s, joined + (keep_tail ? len - out.len : 0), out.len);
+    return out;
+}
+
+static const Literal *literal_longer(const Literal *a, const Literal *b) {
+    return b->len > a->len ? b : a;
+}
+
+// The single byte a set stands for as a literal (with nocase, a letter in both cases counts as
+// its lower case one), or -1
+static int set_literal(const ByteSet *set, bool nocase) {
+    int count = set_count(set);
+    for (int c = 0; c < 256; c++) {
+        if (!set_has(set, c) || c == '\n') {
+            continue;
+        }
+        if (count == 1) {
+            return c;
+        }
+        if (nocase && count == 2 && islower(c) && set_has(set, toupper(c))) {
+            return c;
+        }
+        return -1;
+    }
+    return -1;
+}
+
+static LiteralInfo literal_info(const RxNode *nodes, int n, bool nocase) {
+    LiteralInfo info;
+    memset(&info, 0, sizeof(info));
+    const RxNode *node = &nodes[n];
+    bool truncated = false;
+    switch (node->kind) {
+        case RX_EMPTY: case RX_BOL: case RX_EOL:
+            info.exact = true; // Match the empty string
+            break;
+        case RX_SET: {
+            int c = set_literal(&node->set, nocase);
+            if (c >= 0) {
+                info.exact = true;
+                info.prefix.s[0] = (char)c;
+                info.prefix.len = 1;
+                info.suffix = info.best = info.prefix;
+            }
+            break;
+        }
+        case RX_CONCAT: {
+            LiteralInfo a = literal_info(nodes, node->left, nocase);
+            LiteralInfo b = literal_info(nodes, node->right, nocase);
+            info.prefix = a.exact ? literal_cat(&a.prefix, &b.prefix, false, &truncated) : a.prefix;
+            info.exact = a.exact && b.exact && !truncated;
+            info.suffix = b.exact ? literal_cat(&a.suffix, &b.suffix, true, &truncated) : b.suffix;
+            Literal across = literal_cat(&a.suffix, &b.prefix, false, &truncated);
+            info.best = *literal_longer(literal_longer(&a.best, &b.best), &across);
+            break;
+        }
+        case RX_ALT: {
+            LiteralInfo a = literal_info(nodes, node->left, nocase);
+            LiteralInfo b = literal_info(nodes, node->right, nocase);
+            if (a.exact && b.exact && a.prefix.len == b.prefix.len && memcmp(a.prefix.s, b.prefix.s, a.prefix.len) == 0) {
+                return a;
+            }
+            // Only what both branches share is required
+            while (info.prefix.len < a.prefix.len && info.prefix.len < b.prefix.len &&
+                   a.prefix.s[info.prefix.len] == b.prefix.s[info.prefix.len]) {
+                info.prefix.s[info.prefix.len] = a.prefix.s[info.prefix.len];
+                info.prefix.len++;
+            }
+            while (info.suffix.len < a.suffix.len && info.suffix.len < b.suffix.len &&
+                   a.suffix.s[a.suffix.len - 1 - info.suffix.len] == b.suffix.s[b.suffix.len - 1 - info.suffix.len]) {
+                info.suffix.len++;
+            }
+            memcpy(info.suffix.s, a.suffix.s + a.suffix.len - info.suffix.len, info.suffix.len);
+            info.best = *literal_longer(&info.prefix, &info.suffix);
+            break;
+        }
+        case RX_REPEAT: {
+            if (node->min == 0) {
+                info.exact = node->max == 0;
+                break;
+            }
+            LiteralInfo child = literal_info(nodes, node->left, nocase);
+            info = child;
+            if (child.exact && node->max != node->min) {
+                info.exact = false;
+            }
+            if (child.exact) {
+                // The mandatory copies are back to back: x{3} is exactly xxx, x{2,} starts with xx
+                Literal run = child.prefix;
+                truncated = false;
+                for (int i = 1; i < node->min && !truncated; i++) {
+                    run = literal_cat(&run, &child.prefix, false, &truncated);
+                }
+                info.prefix = info.best = run;
+                info.suffix = run;
+                info.exact = info.exact && !truncated;
+            }
+            break;
+        }
+    }
+    return info;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Thompson NFA, built back to front: each node is compiled with the state to continue at once
+// it has matched, which keeps every fragment a single entry state
+
+enum { NFA_SET, NFA_EOL, NFA_SPLIT, NFA_BOL, NFA_MATCH };
+
+typedef struct {
+    int type;
+    int out;   // Next state; for NFA_SPLIT one of two
+    int out1;  // NFA_SPLIT: the other next state
+    int node;  // NFA_SET: the AST node holding its byte set
+} NfaState;
+
+typedef struct {
+    NfaState *states;
+    int num_states;
+    int capacity;
+    bool too_big;
+    const RxNode *nodes;
+} Nfa;
+
+static int nfa_state(Nfa *nfa, int type, int out, int out1, int node) {
+    if (nfa->num_states >= NFA_MAX_STATES) {
+        nfa->too_big = true;
+        return 0;
+    }
+    if (nfa->num_states == nfa->capacity) {
+        nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+        nfa->states = rx_realloc(nfa->states, sizeof(NfaState) * nfa->capacity);
+    }
+    NfaState *state = &nfa->states[nfa->num_states];
+    state->type = type;
+    state->out = out;
+    state->out1 = out1;
+    state->node = node;
+    return nfa->num_states++;
+}
+
+static int nfa_build(Nfa *nfa, int n, int out) {
+    const RxNode *node = &nfa->nodes[n];
+    if (nfa->too_big) {
+        return 0;
+    }
+    switch (node->kind) {
+        case RX_SET:
+            return nfa_state(nfa, NFA_SET, out, -1, n);
+        case RX_BOL:
+            return nfa_state(nfa, NFA_BOL, out, -1, -1);
+        case RX_EOL:
+            return nfa_state(nfa, NFA_EOL, out, -1, -1);
+        case RX_CONCAT:
+            return nfa_build(nfa, node->left, nfa_build(nfa, node->right, out));
+        case RX_ALT: {
+            int left = nfa_build(nfa, node->left, out);
+            int right = nfa_build(nfa, node->right, out);
+            return nfa_state(nfa, NFA_SPLIT, left, right, -1);
+        }
+        case RX_REPEAT: {
+            int child = node->left;
+            int min = node->min;
+            int max = node->max;
+            int cont = out;
+            if (max == -1) {
+                int loop = nfa_state(nfa, NFA_SPLIT, -1, out, -1);
+                int body = nfa_build(nfa, child, loop);
+                if (!nfa->too_big) {
+                    nfa->states[loop].out = body;
+                }
+                cont = loop;
+            } else {
+                for (int i = min; i < max; i++) { // Optional copies: skipping one skips the rest
+                    cont = nfa_state(nfa, NFA_SPLIT, nfa_build(nfa, child, cont), out, -1);
+                }
+            }
+            for (int i = 0; i < min; i++) {
+                cont = nfa_build(nfa, child, cont);
+            }
+            return cont;
+        }
+        default: // RX_EMPTY
+            return out;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Subset construction. A DFA state is the sorted set of NFA states that consume input or match
+// (the epsilon closure drops the others). Every state but the start one also contains the
+// closure of the NFA start, which is what makes the search unanchored.
+
+struct RegexDfa {
+    uint8_t byte_class[256]; // Bytes no set tells apart share a class, and a column of next
+    int eol_class;           // Column for the end of the line, which is what $ consumes
+    int stride;              // Columns per state: the byte classes plus the end of line
+    int num_states;
+    int *next;               // num_states * stride transitions; while building state 0 is the start
+    uint8_t *flags;          // Per state: DFA_ACCEPT, DFA_DEAD or 0
+    char *literal;           // Required literal for the prefilter, or NULL
+    // After finalize_dfa: next holds row offsets (state * stride) instead of state ids, and the
+    // accepting and dead states come last, so the match loop needs one load and one compare per byte
+    int start;               // Row offset of the start state
+    int first_final;         // Row offset of the first accepting or dead state
+};
+
+typedef struct {
+    const Nfa *nfa;
+    int start;        // NFA start state
+    int match;        // The NFA_MATCH state
+    int *marks;       // Per NFA state: stamp of the last closure that reached it
+    int stamp;
+    int *stack;
+    int *list;        // Closure being collected
+    int list_len;
+    int *pool;        // The NFA state lists of all DFA states, back to back
+    size_t pool_len;
+    size_t pool_capacity;
+    size_t *list_start; // Per DFA state: offset into pool
+    int *list_length;
+    int *table;       // Hash table of DFA state ids, -1 for empty slots
+    size_t table_mask;
+} Builder;
+
+static void closure_add(Builder *b, int s, bool at_start) {
+    int top = 0;
+    b->stack[top++] = s;
+    while (top > 0) {
+        s = b->stack[--top];
+        if (s < 0 || b->marks[s] == b->stamp) {
+            continue;
+        }
+        b->marks[s] = b->stamp;
+        const NfaState *state = &b->nfa->states[s];
+        switch (state->type) {
+            case NFA_SPLIT:
+                b->stack[top++] = state->out1;
+                b->stack[top++] = state->out;
+                break;
+            case NFA_BOL:
+                if (at_start) {
+                    b->stack[top++] = state->out;
+                }
+                break;
+            default:
+                b->list[b->list_len++] = s;
+                break;
+        }
+    }
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t hash_list(const int *list, int len) {
+    uint64_t hash = 1469598103934665603ULL; // FNV-1a over the state ids
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (uint32_t)list[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Finds the DFA state for b->list, adding it if it is new. Returns its id, or -1 if the DFA
+// would get too big.
+static int intern_state(Builder *b, RegexDfa *re, int *capacity) {
+    qsort(b->list, b->list_len, sizeof(int), compare_ints);
+    size_t slot = hash_list(b->list, b->list_len) & b->table_mask;
+    for (; b->table[slot] != -1; slot = (slot + 1) & b->table_mask) {
+        int id = b->table[slot];
+        if (b->list_length[id] == b->list_len &&
+            memcmp(b->pool + b->list_start[id], b->list, sizeof(int) * b->list_len) == 0) {
+            return id;
+        }
+    }
+    if (re->num_states == DFA_MAX_STATES) {
+        return -1;
+    }
+    int id = re->num_states++;
+    if (id == *capacity) {
+        *capacity *= 2;
+        re->next = rx_realloc(re->next, sizeof(int) * re->stride * *capacity);
+        re->flags = rx_realloc(re->flags, *capacity);
+        b->list_start = rx_realloc(b->list_start, sizeof(size_t) * *capacity);
+        b->list_length = rx_realloc(b->list_length, sizeof(int) * *capacity);
+    }
+    if (b->pool_len + b->list_len > b->pool_capacity) {
+        while (b->pool_len + b->list_len > b->pool_capacity) {
+            b->pool_capacity *= 2;
+        }
+        b->pool = rx_realloc(b->pool, sizeof(int) * b->pool_capacity);
+    }
+    memcpy(b->pool + b->pool_len, b->list, sizeof(int) * b->list_len);
+    b->list_start[id] = b->pool_len;
+    b->list_length[id] = b->list_len;
+    b->pool_len += b->list_len;
+    b->table[slot] = id;
+
+    re->flags[id] = b->list_len == 0 ? DFA_DEAD : 0;
+    for (int i = 0; i < b->list_len; i++) {
+        if (b->list[i] == b->match) {
+            re->flags[id] = DFA_ACCEPT;
+        }
+    }
+    return id;
+}
+
+// Splits the bytes into classes that every set either fully contains or fully excludes
+static int compute_byte_classes(const RxNode *nodes, int num_nodes, uint8_t *byte_class, int *representative) {
+    int num_classes = 1;
+    memset(byte_class, 0, 256);
+    for (int n = 0; n < num_nodes; n++) {
+        if (nodes[n].kind != RX_SET) {
+            continue;
+        }
+        int renumber[512];
+        memset(renumber, -1, sizeof(renumber));
+        int refined = 0;
+        for (int c = 0; c < 256; c++) {
+            int key = byte_class[c] * 2 + set_has(&nodes[n].set, c);
+            if (renumber[key] == -1) {
+                renumber[key] = refined++;
+            }
+            byte_class[c] = (uint8_t)renumber[key];
+        }
+        num_classes = refined;
+    }
+    for (int c = 255; c >= 0; c--) {
+        representative[byte_class[c]] = c;
+    }
+    return num_classes;
+}
+
+static bool build_dfa(RegexDfa *re, const Nfa *nfa, int start, int match, const RxNode *nodes, int num_nodes) {
+    int representative[256];
+    int num_classes = compute_byte_classes(nodes, num_nodes, re->byte_class, representative);
+    re->eol_class = num_classes;
+    re->stride = num_classes + 1;
+
+    Builder b;
+    memset(&b, 0, sizeof(b));
+    b.nfa = nfa;
+    b.start = start;
+    b.match = match;
+    b.marks = rx_realloc(NULL, sizeof(int) * nfa->num_states);
+    memset(b.marks, 0, sizeof(int) * nfa->num_states);
+    b.stack = rx_realloc(NULL, sizeof(int) * (2 * (size_t)nfa->num_states + 1)); // Splits push two
+    b.list = rx_realloc(NULL, sizeof(int) * nfa->num_states);
+    b.pool_capacity = 1024;
+    b.pool = rx_realloc(NULL, sizeof(int) * b.pool_capacity);
+    int capacity = 64;
+    re->next = rx_realloc(NULL, sizeof(int) * re->stride * capacity);
+    re->flags = rx_realloc(NULL, capacity);
+    b.list_start = rx_realloc(NULL, sizeof(size_t) * capacity);
+    b.list_length = rx_realloc(NULL, sizeof(int) * capacity);
+    b.table_mask = 2 * 16384 - 1; // Over twice DFA_MAX_STATES, so probing stays short
+    b.table = rx_realloc(NULL, sizeof(int) * (b.table_mask + 1));
+    memset(b.table, -1, sizeof(int) * (b.table_mask + 1));
+
+    b.stamp++;
+    b.list_len = 0;
+    closure_add(&b, start, true);
+    intern_state(&b, re, &capacity);
+
+    bool ok = true;
+    for (int id = 0; id < re->num_states && ok; id++) {
+        int *row = re->next + (size_t)id * re->stride;
+        if (re->flags[id] != 0) {
+            for (int c = 0; c < re->stride; c++) {
+                row[c] = id; // Accepting and dead states are absorbing
+            }
+            continue;
+        }
+        for (int c = 0; c < re->stride && ok; c++) {
+            b.stamp++;
+            b.list_len = 0;
+            // Note: the list pointer into pool may move when intern_state grows it, so index it afresh
+            for (int i = 0; i < b.list_length[id]; i++) {
+                const NfaState *state = &nfa->states[b.pool[b.list_start[id] + i]];
+                if (c == re->eol_class ? state->type == NFA_EOL
+                                       : state->type == NFA_SET && set_has(&nodes[state->node].set, representative[c])) {
+                    closure_add(&b, state->out, false);
+                }
+            }
+            if (c != re->eol_class) {
+                closure_add(&b, start, false); // A match may also start at the next byte
+            }
+            int target = intern_state(&b, re, &capacity);
+            if (target < 0) {
+                ok = false;
+                break;
+            }
+            row = re->next + (size_t)id * re->stride; // next may have moved
+            row[c] = target;
+        }
+    }
+    free(b.marks);
+    free(b.stack);
+    free(b.list);
+    free(b.pool);
+    free(b.list_start);
+    free(b.list_length);
+    free(b.table);
+    return ok;
+}
+
+// Renumbers the states so the accepting and dead ones come after all others, and turns the
+// transitions into row offsets (see struct RegexDfa)
+static void finalize_dfa(RegexDfa *re) {
+    int *new_id = rx_realloc(NULL, sizeof(int) * re->num_states);
+    int num_live = 0;
+    for (int pass = 0; pass < 2; pass++) { // Live states first, then the final ones
+        for (int id = 0; id < re->num_states; id++) {
+            if ((re->flags[id] != 0) == (pass == 1)) {
+                new_id[id] = num_live++;
+            }
+        }
+    }
+    int *next = rx_realloc(NULL, sizeof(int) * re->stride * re->num_states);
+    uint8_t *flags = rx_realloc(NULL, re->num_states);
+    int first_final = re->num_states;
+    for (int id = 0; id < re->num_states; id++) {
+        int row = new_id[id] * re->stride;
+        for (int c = 0; c < re->stride; c++) {
+            next[row + c] = new_id[re->next[id * re->stride + c]] * re->stride;
+        }
+        flags[new_id[id]] = re->flags[id];
+        if (re->flags[id] != 0 && new_id[id] < first_final) {
+            first_final = new_id[id];
+        }
+    }
+    re->start = new_id[0] * re->stride;
+    re->first_final = first_final * re->stride;
+    free(re->next);
+    free(re->flags);
+    re->next = next;
+    re->flags = flags;
+    free(new_id);
+}
+
+RegexDfa *regex_compile(const char *pattern, bool nocase, char *error, size_t error_size) {
+    Parser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = pattern;
+    ps.nocase = nocase;
+    ps.error = error;
+    ps.error_size = error_size;
+    int root = parse_alt(&ps);
+    if (root >= 0 && *ps.p == ')') {
+        root = parse_error(&ps, "unmatched )");
+    }
+    if (root < 0 || ps.failed) {
+        free(ps.nodes);
+        return NULL;
+    }
+
+    RegexDfa *re = rx_realloc(NULL, sizeof(RegexDfa));
+    memset(re, 0, sizeof(RegexDfa));
+    LiteralInfo info = literal_info(ps.nodes, root, nocase);
+    if (info.best.len > 0) {
+        re->literal = rx_realloc(NULL, info.best.len + 1);
+        memcpy(re->literal, info.best.s, info.best.len);
+        re->literal[info.best.len] = '\0';
+    }
+
+    Nfa nfa;
+    memset(&nfa, 0, sizeof(nfa));
+    nfa.nodes = ps.nodes;
+    int match = nfa_state(&nfa, NFA_MATCH, -1, -1, -1);
+    int start = nfa_build(&nfa, root, match);
+    bool ok = !nfa.too_big && build_dfa(re, &nfa, start, match, ps.nodes, ps.num_nodes);
+    if (ok) {
+        finalize_dfa(re);
+    } else {
+        snprintf(error, error_size, "pattern is too complex (over %d %s states)",
+                 nfa.too_big ? NFA_MAX_STATES : DFA_MAX_STATES, nfa.too_big ? "NFA" : "DFA");
+        regex_destroy(re);
+        re = NULL;
+    }
+    free(nfa.states);
+    free(ps.nodes);
+    return re;
+}
+
+void regex_destroy(RegexDfa *re) {
+    if (!re) {
+        return;
+    }
+    free(re->next);
+    free(re->flags);
+    free(re->literal);
+    free(re);
+}
+
+const char *regex_required_literal(const RegexDfa *re) {
+    return re->literal;
+}
+
+int regex_num_states(const RegexDfa *re) {
+    return re->num_states;
+}
+
+bool regex_match_line(const RegexDfa *re, const char *line, size_t length) {
+    const unsigned char *p = (const unsigned char *)line;
+    const unsigned char *end = p + length;
+    const int *next = re->next;
+    const int first_final = re->first_final;
+    int state = re->start;
+    for (; state < first_final && p < end; p++) {
+        state = next[state + re->byte_class[*p]];
+    }
+    if (state < first_final) {
+        state = next[state + re->eol_class];
+    }
+    return re->flags[state / re->stride] == DFA_ACCEPT; // Accepting or dead once final, whether or not the line was done
+}
+
+int regex_count_matching_lines(const RegexDfa *re, const char *data, size_t length) {
+    int matches = 0;
+    const char *end = data + length;
+    const char *line = data;
+    if (re->literal) {
+        // Only lines holding the literal can match: jump from one to the next with the search
+        // kernel and run the DFA on those lines alone. A non-empty literal cannot match an
+        // empty slice's single empty line either. When nearly every line holds the literal,
+        // the prefilter only adds work, so the rest of the slice then goes straight to the DFA.
+        size_t skipped = 0, verified = 0;
+        int candidates = 0;
+        while (line < end) {
+            if (++candidates == PREFILTER_PROBE && skipped < verified / 4) {
+                break;
+            }
+            const char *hit = search_find(line, (size_t)(end - line));
+            if (!hit) {
+                return matches;
+            }
+            const char *previous = memrchr(line, '\n', (size_t)(hit - line));
+            const char *line_start = previous ? previous + 1 : line;
+            const char *newline = memchr(hit, '\n', (size_t)(end - hit));
+            const char *line_end = newline ? newline : end;
+            if (regex_match_line(re, line_start, (size_t)(line_end - line_start))) {
+                matches++;
+            }
+            skipped += (size_t)(line_start - line);
+            verified += (size_t)(line_end - line_start);
+            line = newline ? newline + 1 : end;
+        }
+        if (line >= end) {
+            return matches;
+        }
+    }
+    do {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = newline ? newline : end;
+        if (regex_match_line(re, line, (size_t)(line_end - line))) {
+            matches++;
+        }
+        line = newline ? newline + 1 : end;
+    } while (line < end); // A trailing '\n' does not start another line
+    return matches;
+}
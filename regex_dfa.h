@@ -0,0 +1,63 @@
+#ifndef REGEX_DFA_H
+#define REGEX_DFA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Regular expressions for --regex, compiled once by the main thread into a DFA that all
+ * workers share read-only. A line matches if the expression matches anywhere in it, as with
+ * grep -E. Supported: literals, '.', [...] classes with ranges and negation, \d \w \s and
+ * their negations, escapes such as \. and \t, groups (...) and (?:...), '|', the quantifiers
+ * * + ? {n} {n,} {n,m}, and the anchors ^ and $. Matching is bytewise; case folding (-i) is ASCII.
+ *
+ * The pattern is compiled to a Thompson NFA and then, by subset construction, to a dense DFA
+ * over byte equivalence classes, so matching costs one table lookup per byte. Compilation also
+ * extracts the longest literal that every match must contain; regex_count_matching_lines uses
+ * it to skip straight to candidate lines with the search kernels.
+ */
+typedef struct RegexDfa RegexDfa;
+
+/**
+ * @brief Compiles a pattern. Exits on allocation failure, like buffer_init.
+ * @param pattern The NUL-terminated pattern.
+ * @param nocase Match letters ignoring ASCII case.
+ * @param error Receives a message if the pattern is invalid or needs too many DFA states.
+ * @param error_size Size of the error buffer.
+ * @return The compiled expression, or NULL on error; release it with regex_destroy.
+ */
+RegexDfa *regex_compile(const char *pattern, bool nocase, char *error, size_t error_size);
+
+/**
+ * @brief Frees an expression compiled by regex_compile. NULL is ignored.
+ */
+void regex_destroy(RegexDfa *re);
+
+/**
+ * @brief Returns the literal every match contains (lowercased with nocase), or NULL if there
+ *        is none. When it is not NULL, the caller must pass it to search_init (search_init_nocase
+ *        with nocase) before scanning, since regex_count_matching_lines prefilters with search_find.
+ */
+const char *regex_required_literal(const RegexDfa *re);
+
+/**
+ * @brief Returns the number of states of the DFA.
+ */
+int regex_num_states(const RegexDfa *re);
+
+/**
+ * @brief Tells whether a single line (without its '\n') matches. Does not use the prefilter.
+ */
+bool regex_match_line(const RegexDfa *re, const char *line, size_t length);
+
+/**
+ * @brief Counts the lines in a slice that match, using the same line conventions as
+ *        search_count_matching_lines.
+ * @param re The expression.
+ * @param data Start of the slice. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the slice.
+ * @return The number of matching lines.
+ */
+int regex_count_matching_lines(const RegexDfa *re, const char *data, size_t length);
+
+#endif // REGEX_DFA_H
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE // For memmem
+#include "search.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SEARCH_HAVE_NEON 1
+#endif
+
+// A kernel returns the first occurrence of s_term (s_term_len >= 2) in [data, data + length), or NULL
+typedef const char *(*search_kernel_fn)(const char *data, size_t length);
+
+static const char *s_term; // Lowercased copy of the term when caseless
+static size_t s_term_len;
+static bool s_term_has_newline; // Lines never contain '\n', so such a term can never match
+static search_kernel_fn s_kernel;
+static const char *s_kernel_name;
+static bool s_nocase;        // ASCII case-insensitive matching (search_init_nocase)
+static char *s_folded_term;  // The copy s_term points to when caseless
+static char s_first_fold;    // 0x20 if the first/last term byte is a letter and the search is caseless, else 0:
+static char s_last_fold;     // ORed into the data bytes compared against it, folding them to lower case
+
+// Compares n data bytes against the term bytes at the same offset
+static bool term_equal(const char *data, const char *term, size_t n) {
+    if (!s_nocase) {
+        return memcmp(data, term, n) == 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (tolower((unsigned char)data[i]) != (unsigned char)term[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *find_scalar(const char *data, size_t length) {
+    if (!s_nocase) {
+        return memmem(data, length, s_term, s_term_len);
+    }
+    for (size_t i = 0; i + s_term_len <= length; i++) {
+        if (term_equal(data + i, s_term, s_term_len)) {
+            return data + i;
+        }
+    }
+    return NULL;
+}
+
+// The SIMD kernels use the first-and-last-byte filter: compare a block of candidate start
+// positions against the term's first byte and, shifted by s_term_len - 1, against its last
+// byte. Only positions where both bytes agree are verified with memcmp on the middle part.
+// The tail that does not fill a whole block is handed to the scalar kernel. For a caseless
+// search the data bytes are ORed with s_first_fold/s_last_fold first (a no-op otherwise), which
+// lowercases letters; that can let a few non-letters through, but verification rejects them.
+
+#ifdef SEARCH_HAVE_X86
+static const char *find_sse2(const char *data, size_t length) {
+    const __m128i first = _mm_set1_epi8(s_term[0]);
+    const __m128i last = _mm_set1_epi8(s_term[s_term_len - 1]);
+    const __m128i first_fold = _mm_set1_epi8(s_first_fold);
+    const __m128i last_fold = _mm_set1_epi8(s_last_fold);
+    size_t i = 0;
+    for (; i + 16 + s_term_len - 1 <= length; i += 16) {
+        __m128i block_first = _mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i)), first_fold);
+        __m128i block_last = _mm_or_si128(_mm_loadu_si128((const __m128i *)(data + i + s_term_len - 1)), last_fold);
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (term_equal(data + i + bit + 1, s_term + 1, s_term_len - 2)) {
+                return data + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i < length ? find_scalar(data + i, length - i) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *data, size_t length) {
+    const __m256i first = _mm256_set1_epi8(s_term[0]);
+    const __m256i last = _mm256_set1_epi8(s_term[s_term_len - 1]);
+    const __m256i first_fold = _mm256_set1_epi8(s_first_fold);
+    const __m256i last_fold = _mm256_set1_epi8(s_last_fold);
+    size_t i = 0;
+    for (; i + 32 + s_term_len - 1 <= length; i += 32) {
+        __m256i block_first = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(data + i)), first_fold);
+        __m256i block_last = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(data + i + s_term_len - 1)), last_fold);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (term_equal(data + i + bit + 1, s_term + 1, s_term_len - 2)) {
+                return data + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i < length ? find_scalar(data + i, length - i) : NULL;
+}
+#endif
+
+#ifdef SEARCH_HAVE_NEON
+static const char *find_neon(const char *data, size_t length) {
+    const uint8x16_t first = vdupq_n_u8((uint8_t)s_term[0]);
+    const uint8x16_t last = vdupq_n_u8((uint8_t)s_term[s_term_len - 1]);
+    const uint8x16_t first_fold = vdupq_n_u8((uint8_t)s_first_fold);
+    const uint8x16_t last_fold = vdupq_n_u8((uint8_t)s_last_fold);
+    size_t i = 0;
+    for (; i + 16 + s_term_len - 1 <= length; i += 16) {
+        uint8x16_t block_first = vorrq_u8(vld1q_u8((const uint8_t *)(data + i)), first_fold);
+        uint8x16_t block_last = vorrq_u8(vld1q_u8((const uint8_t *)(data + i + s_term_len - 1)), last_fold);
+        uint8x16_t eq = vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last));
+        // NEON has no movemask; narrowing gives 4 mask bits per byte instead of 1
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        while (mask != 0) {
+            int bit = __builtin_ctzll(mask) / 4;
+            if (term_equal(data + i + bit + 1, s_term + 1, s_term_len - 2)) {
+                return data + i + bit;
+            }
+            mask &= ~(0xFULL << (bit * 4));
+        }
+    }
+    return i < length ? find_scalar(data + i, length - i) : NULL;
+}
+#endif
+
+bool search_set_kernel(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        s_kernel = find_scalar;
+    }
+#ifdef SEARCH_HAVE_X86
+    else if (strcmp(name, "sse2") == 0) {
+        s_kernel = find_sse2;
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        s_kernel = find_avx2;
+    }
+#endif
+#ifdef SEARCH_HAVE_NEON
+    else if (strcmp(name, "neon") == 0) {
+        s_kernel = find_neon;
+    }
+#endif
+    else {
+        return false;
+    }
+    s_kernel_name = name;
+    return true;
+}
+
+const char *search_kernel_name(void) {
+    return s_kernel_name;
+}
+
+void search_init(const char *term) {
+    free(s_folded_term);
+    s_folded_term = NULL;
+    s_nocase = false;
+    s_first_fold = 0;
+    s_last_fold = 0;
+    s_term = term;
+    s_term_len = strlen(term);
+    s_term_has_newline = memchr(term, '\n', s_term_len) != NULL;
+
+    // Runtime CPU dispatch: pick the widest kernel this machine supports
+#ifdef SEARCH_HAVE_X86
+    __builtin_cpu_init();
+    if (!search_set_kernel("avx2")) {
+        search_set_kernel("sse2"); // Part of the x86-64 baseline
+    }
+#elif defined(SEARCH_HAVE_NEON)
+    search_set_kernel("neon"); // Part of the AArch64 baseline
+#else
+    search_set_kernel("scalar");
+#endif
+}
+
+void search_init_nocase(const char *term) {
+    char *folded = strdup(term);
+    if (!folded) {
+        perror("Failed to allocate search term");
+        exit(EXIT_FAILURE);
+    }
+    for (char *p = folded; *p; p++) {
+        *p = (char)tolower((unsigned char)*p);
+    }
+    search_init(folded);
+    s_folded_term = folded;
+    s_nocase = true;
+    if (s_term_len > 0) {
+        s_first_fold = isalpha((unsigned char)folded[0]) ? 0x20 : 0;
+        s_last_fold = isalpha((unsigned char)folded[s_term_len - 1]) ? 0x20 : 0;
+    }
+}
+
+const char *search_find(const char *data, size_t length) {
+    if (s_term_len == 0) {
+        return data;
+    }
+    if (s_term_len == 1 && s_first_fold != 0) {
+        return find_scalar(data, length); // A single letter matches two bytes
+    }
+    if (s_term_len == 1) {
+        return memchr(data, s_term[0], length); // libc memchr is already vectorized
+    }
+    return s_kernel(data, length);
+}
+
+int search_count_lines(const char *data, size_t length) {
+    if (length == 0) {
+        return 1;
+    }
+    int lines = 0;
+    const char *p = data;
+    const char *end = data + length;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        lines++;
+        p++;
+    }
+    if (data[length - 1] != '\n') {
+        lines++; // Last line has no terminator
+    }
+    return lines;
+}
+
+int search_count_matching_lines(const char *data, size_t length) {
+    if (s_term_len == 0) {
+        return search_count_lines(data, length); // strstr(line, "") matches every line
+    }
+    if (s_term_has_newline) {
+        return 0;
+    }
+
+    // Search the whole slice at once instead of line by line. Since the term holds no '\n',
+    // a hit always lies inside a single line; count that line and resume at the next one.
+    int matches = 0;
+    const char *p = data;
+    const char *end = data + length;
+    while (p < end) {
+        const char *hit = search_find(p, end - p);
+        if (hit == NULL) {
+            break;
+        }
+        matches++;
+        const char *after = hit + s_term_len;
+        const char *newline = memchr(after, '\n', end - after);
+        if (newline == NULL) {
+            break;
+        }
+        p = newline + 1;
+    }
+    return matches;
+}
@@ -0,0 +1,62 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * @brief Prepares the search engine for a search term and picks the fastest kernel this CPU
+ *        supports (AVX2, SSE2, NEON or scalar). Must be called once, before any worker starts
+ *        scanning; the term is shared read-only afterwards.
+ * @param term The NUL-terminated search term. The string must outlive the search.
+ */
+void search_init(const char *term);
+
+/**
+ * @brief Like search_init, but matches the term ignoring ASCII case (-i), using the same
+ *        kernels: letters are folded to lower case before the first/last-byte comparison.
+ * @param term The NUL-terminated search term; a lowercased copy is kept, so it need not outlive the search.
+ */
+void search_init_nocase(const char *term);
+
+/**
+ * @brief Forces a specific search kernel instead of the one picked by runtime CPU dispatch.
+ *        Mainly useful for benchmarking. Call after search_init.
+ * @param name One of "scalar", "sse2", "avx2" or "neon".
+ * @return false if the kernel is unknown or not supported by this CPU/build (the current one is kept).
+ */
+bool search_set_kernel(const char *name);
+
+/**
+ * @brief Returns the name of the active search kernel, e.g. "avx2".
+ */
+const char *search_kernel_name(void);
+
+/**
+ * @brief Finds the first occurrence of the search term in a byte range.
+ * @param data Start of the range. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the range.
+ * @return Pointer to the start of the first occurrence, or NULL if there is none.
+ */
+const char *search_find(const char *data, size_t length);
+
+/**
+ * @brief Counts the lines in a slice, using the same line conventions as search_count_matching_lines.
+ * @param data Start of the slice. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the slice.
+ * @return The number of lines.
+ */
+int search_count_lines(const char *data, size_t length);
+
+/**
+ * @brief Counts the lines in a slice that contain the search term.
+ *        Lines are separated by '\n'; a trailing '\n' ends the last line rather than
+ *        starting a new empty one, and an empty slice is a single empty line.
+ *        A line matches exactly when strstr(line, term) would match it.
+ * @param data Start of the slice. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the slice.
+ * @return The number of matching lines.
+ */
+int search_count_matching_lines(const char *data, size_t length);
+
+#endif // SEARCH_H
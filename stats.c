@@ -0,0 +1,58 @@
+#include "stats.h"
+#include <time.h>
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Values below LATENCY_SUB_BUCKETS map to themselves; above that, bucket = (magnitude, top bits)
+static int bucket_index(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int magnitude = 63 - __builtin_clzll(value); // >= 4
+    int sub = (int)((value >> (magnitude - 4)) & (LATENCY_SUB_BUCKETS - 1));
+    return (magnitude - 3) * LATENCY_SUB_BUCKETS + sub;
+}
+
+static uint64_t bucket_upper_bound(int index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int magnitude = index / LATENCY_SUB_BUCKETS + 3;
+    uint64_t sub = (uint64_t)(index % LATENCY_SUB_BUCKETS);
+    uint64_t lower = (1ull << magnitude) | (sub << (magnitude - 4));
+    return lower + (1ull << (magnitude - 4)) - 1;
+}
+
+void latency_record(LatencyHistogram *hist, uint64_t nanoseconds) {
+    hist->counts[bucket_index(nanoseconds)]++;
+    hist->total++;
+}
+
+void latency_merge(LatencyHistogram *dst, const LatencyHistogram *src) {
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+}
+
+uint64_t latency_percentile(const LatencyHistogram *hist, double percentile) {
+    if (hist->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->total);
+    if (rank >= hist->total) {
+        rank = hist->total - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            return bucket_upper_bound(i);
+        }
+    }
+    return bucket_upper_bound(LATENCY_BUCKETS - 1);
+}
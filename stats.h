@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Run statistics for --stats: wall-clock helpers and a fixed-size latency histogram.
+ * Each worker records into its own histogram; they are merged after the workers are joined.
+ */
+
+#define LATENCY_SUB_BUCKETS 16                    // Linear sub-buckets per power of two
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS) // Covers the whole uint64_t nanosecond range
+
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+} LatencyHistogram;
+
+/**
+ * @brief Returns CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t stats_now_ns(void);
+
+/**
+ * @brief Records one sample. Relative bucket error is below 1/LATENCY_SUB_BUCKETS.
+ */
+void latency_record(LatencyHistogram *hist, uint64_t nanoseconds);
+
+/**
+ * @brief Adds all samples of src into dst.
+ */
+void latency_merge(LatencyHistogram *dst, const LatencyHistogram *src);
+
+/**
+ * @brief Returns the value at a percentile (0-100), as the upper bound of its bucket; 0 if empty.
+ */
+uint64_t latency_percentile(const LatencyHistogram *hist, double percentile);
+
+#endif // STATS_H
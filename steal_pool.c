@@ -0,0 +1,136 @@
+#include "steal_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <sched.h>
+
+void pool_init(StealPool *pool, int num_workers, int queue_capacity) {
+    pool->queues = malloc(sizeof(Buffer) * num_workers);
+    if (!pool->queues) {
+        perror("Failed to allocate worker queues");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        buffer_init(&pool->queues[i], queue_capacity);
+    }
+    pool->num_queues = num_workers;
+    pool->next_queue = 0;
+    pool->pending = 0;
+    pool->closed = false;
+    pool->idle_workers = 0;
+    pthread_mutex_init(&pool->idle_mutex, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+}
+
+void pool_destroy(StealPool *pool) {
+    for (int i = 0; i < pool->num_queues; i++) {
+        buffer_destroy(&pool->queues[i]);
+    }
+    free(pool->queues);
+    pool->queues = NULL;
+    pthread_mutex_destroy(&pool->idle_mutex);
+    pthread_cond_destroy(&pool->idle_cond);
+}
+
+// Wakes up to count sleeping workers. pending/closed are updated before this, and sleepers
+// re-check them under idle_mutex, so taking the mutex here is what prevents lost wake-ups.
+static void wake_idle_workers(StealPool *pool, int count) {
+    pthread_mutex_lock(&pool->idle_mutex);
+    if (count >= pool->idle_workers) {
+        pthread_cond_broadcast(&pool->idle_cond);
+    } else {
+        for (int i = 0; i < count; i++) {
+            pthread_cond_signal(&pool->idle_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->idle_mutex);
+}
+
+int pool_push_batch(StealPool *pool, LineSlice *lines, int n) {
+    int target = pool->next_queue;
+    pool->next_queue = (pool->next_queue + 1) % pool->num_queues;
+
+    // Prefer the round-robin target, but do not stall on it while another queue has room
+    int pushed = 0;
+    for (int i = 0; i < pool->num_queues && pushed < n; i++) {
+        Buffer *queue = &pool->queues[(target + i) % pool->num_queues];
+        pushed += buffer_try_push_batch(queue, lines + pushed, n - pushed);
+    }
+    if (pushed > 0) {
+        __atomic_add_fetch(&pool->pending, pushed, __ATOMIC_SEQ_CST);
+        wake_idle_workers(pool, pushed);
+    }
+
+    if (pushed < n) {
+        // Every queue is full. Count the rest as pending before blocking, so that workers keep
+        // draining (rather than going to sleep) while this push waits for space.
+        int rest = n - pushed;
+        __atomic_add_fetch(&pool->pending, rest, __ATOMIC_SEQ_CST);
+        wake_idle_workers(pool, pool->num_queues);
+        int blocked_pushed = buffer_push_batch(&pool->queues[target], lines + pushed, rest);
+        if (blocked_pushed < rest) {
+            __atomic_sub_fetch(&pool->pending, rest - blocked_pushed, __ATOMIC_SEQ_CST); // Shutting down
+        }
+        pushed += blocked_pushed;
+    }
+    return pushed;
+}
+
+int pool_pop_batch(StealPool *pool, int worker_id, LineSlice *lines, int max) {
+    while (1) {
+        // 1. Own queue
+        int popped = buffer_try_pop_batch(&pool->queues[worker_id], lines, max, false);
+
+        // 2. Steal half of the fullest peer's queue
+        if (popped == 0 && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0) {
+            int victim = -1;
+            int victim_count = 0;
+            for (int i = 1; i < pool->num_queues; i++) {
+                int candidate = (worker_id + i) % pool->num_queues;
+                int count = buffer_count(&pool->queues[candidate]);
+                if (count > victim_count) {
+                    victim = candidate;
+                    victim_count = count;
+                }
+            }
+            if (victim != -1) {
+                popped = buffer_try_pop_batch(&pool->queues[victim], lines, max, true);
+            }
+        }
+
+        if (popped > 0) {
+            __atomic_sub_fetch(&pool->pending, popped, __ATOMIC_SEQ_CST);
+            return popped;
+        }
+        if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0) {
+            sched_yield(); // Work is pending but not visible yet (a push is in flight); let it land
+            continue;
+        }
+
+        // 3. Nothing anywhere: sleep until work is pushed or the pool closes
+        pthread_mutex_lock(&pool->idle_mutex);
+        pool->idle_workers++;
+        while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0 && !pool->closed) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_mutex);
+        }
+        pool->idle_workers--;
+        bool finished = pool->closed && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&pool->idle_mutex);
+        if (finished) {
+            return 0;
+        }
+    }
+}
+
+void pool_close(StealPool *pool) {
+    pthread_mutex_lock(&pool->idle_mutex);
+    pool->closed = true;
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_mutex);
+}
+
+void pool_signal_shutdown(StealPool *pool) {
+    for (int i = 0; i < pool->num_queues; i++) {
+        buffer_signal_shutdown(&pool->queues[i]); // Releases a producer blocked on a full queue
+    }
+    pool_close(pool);
+}
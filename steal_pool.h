@@ -0,0 +1,67 @@
+#ifndef STEAL_POOL_H
+#define STEAL_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+/*
+ * Work-stealing scheduler: one bounded queue per worker instead of a single shared Buffer.
+ * The manager deals batches out round-robin; a worker drains its own queue first and, when
+ * it runs dry, steals half of a peer's queue. Idle workers sleep until new work arrives or
+ * the pool is closed, so no EOF markers are needed.
+ */
+typedef struct {
+    Buffer *queues;            // One mutex-based Buffer per worker
+    int num_queues;
+    int next_queue;            // Round-robin cursor (manager only)
+    long pending;              // Slices queued across all queues (atomic)
+    bool closed;               // No more pushes will come; workers exit once pending reaches 0
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;  // Broadcast when work is added or the pool is closed
+    int idle_workers;          // Workers sleeping on idle_cond (protected by idle_mutex)
+} StealPool;
+
+/**
+ * @brief Initializes the pool. Exits on allocation failure, like buffer_init.
+ * @param pool Pointer to the StealPool struct.
+ * @param num_workers Number of workers, i.e. of queues.
+ * @param queue_capacity Capacity of each worker's queue.
+ */
+void pool_init(StealPool *pool, int num_workers, int queue_capacity);
+
+/**
+ * @brief Destroys the pool, releasing any slices still queued.
+ */
+void pool_destroy(StealPool *pool);
+
+/**
+ * @brief Pushes a batch to the next queue in round-robin order, falling over to any queue with
+ *        space and blocking on the chosen one only when every queue is full. Single producer only.
+ * @return The number of slices pushed. Less than n only if the pool is shutting down; the caller
+ *         keeps ownership of lines[return value .. n-1].
+ */
+int pool_push_batch(StealPool *pool, LineSlice *lines, int n);
+
+/**
+ * @brief Pops work for a worker: from its own queue, else stolen from a peer, else it sleeps.
+ * @param pool Pointer to the StealPool struct.
+ * @param worker_id The calling worker's queue index.
+ * @param lines Output array receiving the slices. The caller owns them afterwards.
+ * @param max Capacity of lines.
+ * @return The number of slices popped, or 0 once the pool is closed and all queues are empty.
+ */
+int pool_pop_batch(StealPool *pool, int worker_id, LineSlice *lines, int max);
+
+/**
+ * @brief Marks the end of input: workers finish the queued work and then pool_pop_batch returns 0.
+ */
+void pool_close(StealPool *pool);
+
+/**
+ * @brief Shuts the pool down (e.g. on SIGINT): a blocked producer gives up and workers stop
+ *        once the queues are drained.
+ */
+void pool_signal_shutdown(StealPool *pool);
+
+#endif // STEAL_POOL_H
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE // For pread
+#include "time_range.h"
+#include "field_filter.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TIME_READ_SIZE (64 * 1024)   // Bytes per pread while probing
+#define TIME_SCAN_WINDOW (64 * 1024) // Below this, the search walks the remaining lines in order
+
+static const char *const s_months[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+// Days from 1970-01-01 to a civil date of the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// Parses exactly count digits at *p, advancing it. Returns -1 if they are not all digits.
+static int parse_digits(const char **p, const char *end, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++, (*p)++) {
+        if (*p >= end || **p < '0' || **p > '9') {
+            return -1;
+        }
+        value = value * 10 + (**p - '0');
+    }
+    return value;
+}
+
+static bool expect(const char **p, const char *end, char c) {
+    if (*p < end && **p == c) {
+        (*p)++;
+        return true;
+    }
+    return false;
+}
+
+// Parses a zone offset such as +0000 or +02:00 at *p into seconds east of UTC
+static bool parse_zone(const char **p, const char *end, int64_t *offset) {
+    if (*p >= end || (**p != '+' && **p != '-')) {
+        return false;
+    }
+    int sign = **p == '-' ? -1 : 1;
+    (*p)++;
+    int hours = parse_digits(p, end, 2);
+    expect(p, end, ':');
+    int minutes = parse_digits(p, end, 2);
+    if (hours < 0 || minutes < 0 || hours > 23 || minutes > 59) {
+        return false;
+    }
+    *offset = sign * (hours * 3600 + minutes * 60);
+    return true;
+}
+
+static bool valid_time(int month, int day, int hour, int minute, int second) {
+    return month >= 1 && month <= 12 && day >= 1 && day <= 31 && hour >= 0 && hour <= 23 &&
+           minute >= 0 && minute <= 59 && second >= 0 && second <= 60;
+}
+
+// Parses a CLF time, 12/May/2023:14:00:01 followed by an optional " +0000", advancing
+// *p past what was read
+static bool parse_clf_time(const char **p, const char *end, int64_t *seconds) {
+    int day = parse_digits(p, end, 2);
+    if (day < 0 || !expect(p, end, '/') || end - *p < 3) {
+        return false;
+    }
+    int month = 0;
+    for (int m = 0; m < 12 && month == 0; m++) {
+        if (memcmp(*p, s_months[m], 3) == 0) {
+            month = m + 1;
+        }
+    }
+    *p += 3;
+    if (month == 0 || !expect(p, end, '/')) {
+        return false;
+    }
+    int year = parse_digits(p, end, 4);
+    int hour = expect(p, end, ':') ? parse_digits(p, end, 2) : -1;
+    int minute = expect(p, end, ':') ? parse_digits(p, end, 2) : -1;
+    int second = expect(p, end, ':') ? parse_digits(p, end, 2) : -1;
+    if (year < 0 || !valid_time(month, day, hour, minute, second)) {
+        return false;
+    }
+    int64_t offset = 0;
+    const char *zone = *p;
+    if (expect(&zone, end, ' ') && parse_zone(&zone, end, &offset)) {
+        *p = zone;
+    }
+    *seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+    return true;
+}
+
+bool clf_line_time(const char *line, size_t length, int64_t *seconds) {
+    const char *field;
+    size_t field_len;
+    if (!clf_get_field(line, length, CLF_TIME, &field, &field_len)) {
+        return false;
+    }
+    return parse_clf_time(&field, field + field_len, seconds);
+}
+
+bool time_parse_arg(const char *text, int64_t *seconds) {
+    const char *p = text;
+    const char *end = text + strlen(text);
+    if (parse_clf_time(&p, end, seconds)) {
+        return p == end;
+    }
+
+    p = text;
+    int year = parse_digits(&p, end, 4);
+    int month = expect(&p, end, '-') ? parse_digits(&p, end, 2) : -1;
+    int day = expect(&p, end, '-') ? parse_digits(&p, end, 2) : -1;
+    int hour = 0, minute = 0, second = 0;
+    if (expect(&p, end, 'T') || expect(&p, end, ' ')) {
+        hour = parse_digits(&p, end, 2);
+        minute = expect(&p, end, ':') ? parse_digits(&p, end, 2) : -1;
+        if (expect(&p, end, ':')) {
+            second = parse_digits(&p, end, 2);
+        }
+    }
+    int64_t offset = 0;
+    if (!expect(&p, end, 'Z') && p < end && !parse_zone(&p, end, &offset)) {
+        return false;
+    }
+    if (p != end || year < 0 || !valid_time(month, day, hour, minute, second)) {
+        return false;
+    }
+    *seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+    return true;
+}
+
+// Buffered pread access to whole lines of the log
+typedef struct {
+    int fd;
+    off_t file_size;
+    char *buf;
+    off_t buf_start;  // File offset of buf[0]
+    size_t buf_len;   // Bytes of buf holding data
+} LineReader;
+
+// Reads TIME_READ_SIZE bytes (or up to the end of the file) at offset into the buffer
+static bool reader_fill(LineReader *reader, off_t offset) {
+    off_t left = offset < reader->file_size ? reader->file_size - offset : 0;
+    size_t want = left < TIME_READ_SIZE ? (size_t)left : TIME_READ_SIZE;
+    size_t filled = 0;
+    while (filled < want) {
+        ssize_t n = pread(reader->fd, reader->buf + filled, want - filled, offset + (off_t)filled);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                perror("pread failed");
+                return false;
+            }
+            break; // The file shrank: treat what was read as its end
+        }
+        filled += (size_t)n;
+    }
+    reader->buf_start = offset;
+    reader->buf_len = filled;
+    if (filled < want) {
+        reader->file_size = offset + (off_t)filled;
+    }
+    return true;
+}
+
+// Returns through next the offset just past the first '\n' at or after from, or the file size
+static bool reader_skip_line(LineReader *reader, off_t from, off_t *next) {
+    for (;;) {
+        if (from >= reader->file_size) {
+            *next = reader->file_size;
+            return true;
+        }
+        if (from < reader->buf_start || from >= reader->buf_start + (off_t)reader->buf_len) {
+            if (!reader_fill(reader, from)) {
+                return false;
+            }
+            continue;
+        }
+        size_t skip = (size_t)(from - reader->buf_start);
+        char *newline = memchr(reader->buf + skip, '\n', reader->buf_len - skip);
+        if (newline) {
+            *next = reader->buf_start + (newline - reader->buf) + 1;
+            return true;
+        }
+        from = reader->buf_start + (off_t)reader->buf_len;
+    }
+}
+
+// Reads the line starting at offset: whether it has a timestamp, which one, and where the
+// next line starts. The timestamp is near the start, so a line longer than the buffer is
+// parsed from its first TIME_READ_SIZE bytes only.
+static bool reader_line_time(LineReader *reader, off_t offset, bool *timed, int64_t *seconds, off_t *next) {
+    if (offset < reader->buf_start || offset >= reader->buf_start + (off_t)reader->buf_len ||
+        (!memchr(reader->buf + (offset - reader->buf_start), '\n', reader->buf_len - (size_t)(offset - reader->buf_start)) &&
+         reader->buf_start + (off_t)reader->buf_len < reader->file_size)) {
+        if (!reader_fill(reader, offset)) { // The line is not all in the buffer: start it there
+            return false;
+        }
+    }
+    const char *line = reader->buf + (offset - reader->buf_start);
+    size_t available = reader->buf_len - (size_t)(offset - reader->buf_start);
+    const char *newline = memchr(line, '\n', available);
+    *timed = clf_line_time(line, newline ? (size_t)(newline - line) : available, seconds);
+    if (newline) {
+        *next = offset + (newline - line) + 1;
+        return true;
+    }
+    return reader_skip_line(reader, offset + (off_t)available, next);
+}
+
+// Offset of the first line starting at or after pos
+static bool reader_line_start(LineReader *reader, off_t pos, off_t *start) {
+    if (pos == 0) {
+        *start = 0;
+        return true;
+    }
+    return reader_skip_line(reader, pos - 1, start);
+}
+
+// Finds the first line in [lo, hi) timed at or after target, or hi if there is none. On entry
+// and throughout, lo and hi are line starts, the timed lines before lo are earlier than target,
+// and the first timed line at or after hi (if any) is not.
+static bool lower_bound(LineReader *reader, int64_t target, off_t lo, off_t hi, off_t *result) {
+    while (hi - lo > TIME_SCAN_WINDOW) {
+        off_t probe;
+        if (!reader_line_start(reader, lo + (hi - lo) / 2, &probe)) {
+            return false;
+        }
+        if (probe >= hi) {
+            break; // One long line spans the rest of the range
+        }
+        off_t at = probe;
+        bool timed = false;
+        int64_t seconds = 0;
+        off_t next = probe;
+        while (at < hi) { // First timed line at or after the probe
+            if (!reader_line_time(reader, at, &timed, &seconds, &next)) {
+                return false;
+            }
+            if (timed) {
+                break;
+            }
+            at = next;
+        }
+        if (timed && seconds < target) {
+            lo = next;
+        } else {
+            hi = probe;
+        }
+    }
+    off_t at = lo;
+    while (at < hi) {
+        bool timed;
+        int64_t seconds;
+        off_t next;
+        if (!reader_line_time(reader, at, &timed, &seconds, &next)) {
+            return false;
+        }
+        if (timed && seconds >= target) {
+            break;
+        }
+        at = next;
+    }
+    *result = at < hi ? at : hi;
+    return true;
+}
+
+bool time_range_find(int fd, off_t file_size, int64_t since, int64_t until, off_t *start, off_t *end) {
+    LineReader reader = { fd, file_size, malloc(TIME_READ_SIZE), 0, 0 };
+    if (!reader.buf) {
+        perror("malloc for time range search failed");
+        return false;
+    }
+    *start = 0;
+    *end = file_size;
+    bool ok = true;
+    if (since != INT64_MIN) {
+        ok = lower_bound(&reader, since, 0, file_size, start);
+    }
+    if (ok && until != INT64_MAX) {
+        ok = lower_bound(&reader, until + 1, *start, file_size, end); // The first line after until
+    }
+    if (*end < *start) {
+        *end = *start;
+    }
+    free(reader.buf);
+    return ok;
+}
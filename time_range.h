@@ -0,0 +1,51 @@
+#ifndef TIME_RANGE_H
+#define TIME_RANGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Time-range selection for --since/--until over time-ordered Common Log Format files. The
+ * bounds are found by binary search on the [time] field of the lines, reading a few blocks
+ * with pread per probe, so a narrow window of a huge log costs a few dozen reads before any
+ * line is scanned. Lines without a parsable timestamp are kept with the lines around them.
+ * If the file is not ordered by time, the range is only approximate.
+ *
+ * Times are seconds since the Unix epoch, UTC.
+ */
+
+/**
+ * @brief Parses a --since/--until argument: either CLF style, 12/May/2023:14:00:01 with an
+ *        optional " +0000" zone, or ISO 8601 style, 2023-05-12, 2023-05-12T14:00 or
+ *        2023-05-12 14:00:01 with an optional Z or +02:00 zone. Without a zone the time is UTC.
+ * @param text The NUL-terminated argument.
+ * @param seconds Receives the time.
+ * @return false if the text is not a valid time.
+ */
+bool time_parse_arg(const char *text, int64_t *seconds);
+
+/**
+ * @brief Parses the timestamp of a CLF line, e.g. the 12/May/2023:14:00:01 +0000 in brackets.
+ * @param line Start of the line. It does not need to be NUL-terminated.
+ * @param length Number of bytes in the line.
+ * @param seconds Receives the time.
+ * @return false if the line has no valid timestamp.
+ */
+bool clf_line_time(const char *line, size_t length, int64_t *seconds);
+
+/**
+ * @brief Finds the byte range of a time-ordered log holding the lines timed within
+ *        [since, until], both ends included to the second.
+ * @param fd The log, open for reading; only pread is used on it.
+ * @param file_size Size of the log.
+ * @param since First time wanted, or INT64_MIN for the start of the log.
+ * @param until Last time wanted, or INT64_MAX for the end of the log.
+ * @param start Receives the offset of the first line in range (a line start).
+ * @param end Receives the offset just past the last line in range (a line start or file_size).
+ * @return false on a read or allocation error (reported with perror).
+ */
+bool time_range_find(int fd, off_t file_size, int64_t since, int64_t until, off_t *start, off_t *end);
+
+#endif // TIME_RANGE_H